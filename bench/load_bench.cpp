@@ -0,0 +1,373 @@
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// load generator for a running daemon: C connections spread over T threads, each thread keeps its sockets full of lines
+// (non-blocking sends driven by epoll), for D seconds after a warmup.
+// the daemon never answers, so throughput is what it consumed: once the socket buffers are full (the warmup),
+// a send only succeeds when the daemon read as much, bytes sent after the warmup / line size = lines handled.
+// then one connection sends P "ping" lines one at a time: the "pong" round trips are the latency of the endpoint
+// (transport + one pass through the daemon's line handling, nothing else queued).
+// each endpoint is measured in turn, a summary compares them:
+//
+//   ./load_bench [-c connections] [-t threads] [-d seconds] [-w warmup seconds] [-s line bytes] [-p pings] [endpoint...]
+//
+// endpoint: IPV4[:PORT], [IPV6][:PORT], unix:PATH or unix:@NAME (abstract), 127.0.0.1:4242 by default
+// the daemon has to accept the connections: run it with --max-clients >= C (extra connections get a "busy" reply and are closed),
+// and with --ping for the round trips (otherwise they're logged and never answered)
+
+struct Endpoint {
+    std::string name;
+    struct sockaddr_storage addr;
+    socklen_t addrLen;
+};
+
+struct Config {
+    size_t connections = 64;
+    size_t threads = 4;
+    double seconds = 5;
+    double warmup = 1;
+    size_t lineSize = 64; // newline included
+    size_t pings = 10000;
+    std::vector<Endpoint> endpoints;
+};
+
+struct Result {
+    uint64_t bytes = 0; // sent after the warmup
+    size_t connected = 0;
+    size_t refused = 0;
+    size_t closed = 0; // by the daemon (connection limit) or failed
+};
+
+struct Latency {
+    size_t count = 0;
+    double p50 = 0; // microseconds
+    double p99 = 0;
+    double max = 0;
+};
+
+static std::atomic<bool> measuring(false);
+static std::atomic<bool> done(false);
+
+static void usage(const char *name) {
+    printf("usage: %s [-c connections] [-t threads] [-d seconds] [-w warmup seconds] [-s line bytes] [-p pings] [endpoint...]\n"
+           "  endpoint: IPV4[:PORT], [IPV6][:PORT], unix:PATH, unix:@NAME (default 127.0.0.1:4242)\n", name);
+    exit(EXIT_FAILURE);
+}
+
+static bool parseEndpoint(const char *arg, Endpoint *endpoint) {
+    std::string spec(arg);
+    std::string host = spec;
+    int port = 4242;
+
+    endpoint->name = spec;
+    memset(&endpoint->addr, 0, sizeof(endpoint->addr));
+    if (spec.compare(0, 5, "unix:") == 0) {
+        struct sockaddr_un *addr = (struct sockaddr_un *)&endpoint->addr;
+        std::string path = spec.substr(5);
+        if (path.empty() || path.size() >= sizeof(addr->sun_path)) {
+            return (false);
+        }
+        addr->sun_family = AF_UNIX;
+        memcpy(addr->sun_path, path.data(), path.size());
+        endpoint->addrLen = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + path.size());
+        if (path[0] == '@') {
+            addr->sun_path[0] = '\0'; // abstract namespace
+        } else {
+            endpoint->addrLen += 1;
+        }
+        return (true);
+    }
+
+    if (spec[0] == '[') {
+        size_t close = spec.find(']');
+        if (close == std::string::npos) {
+            return (false);
+        }
+        host = spec.substr(1, close - 1);
+        if (close + 1 < spec.size()) {
+            if (spec[close + 1] != ':') {
+                return (false);
+            }
+            port = atoi(spec.c_str() + close + 2);
+        }
+    } else if (std::count(spec.begin(), spec.end(), ':') == 1) {
+        host = spec.substr(0, spec.find(':'));
+        port = atoi(spec.c_str() + spec.find(':') + 1);
+    }
+
+    struct sockaddr_in *addr4 = (struct sockaddr_in *)&endpoint->addr;
+    struct sockaddr_in6 *addr6 = (struct sockaddr_in6 *)&endpoint->addr;
+    if (inet_pton(AF_INET, host.c_str(), &addr4->sin_addr) == 1) {
+        addr4->sin_family = AF_INET;
+        addr4->sin_port = htons((uint16_t)port);
+        endpoint->addrLen = sizeof(*addr4);
+    } else if (inet_pton(AF_INET6, host.c_str(), &addr6->sin6_addr) == 1) {
+        addr6->sin6_family = AF_INET6;
+        addr6->sin6_port = htons((uint16_t)port);
+        endpoint->addrLen = sizeof(*addr6);
+    } else {
+        return (false);
+    }
+    return (port > 0 && port < 65536);
+}
+
+// a chunk of lines "load <thread> <n> xxxx...\n" of exactly lineSize bytes each, sent over and over
+static std::string makeChunk(size_t thread, size_t lineSize) {
+    std::string chunk;
+
+    for (size_t n = 0; chunk.size() + lineSize <= 16 * 1024; ++n) {
+        std::string line = "load " + std::to_string(thread) + " " + std::to_string(n) + " ";
+        line.resize(lineSize - 1, 'x');
+        chunk += line + "\n";
+    }
+    return (chunk);
+}
+
+static int connectTo(const Endpoint &endpoint) {
+    int family = endpoint.addr.ss_family;
+    int fd = socket(family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return (-1);
+    }
+    // blocking connect (a refused connection shows up here), the sends are MSG_DONTWAIT
+    if (connect(fd, (const struct sockaddr *)&endpoint.addr, endpoint.addrLen) < 0) {
+        close(fd);
+        return (-1);
+    }
+
+    if (family != AF_UNIX) {
+        int opt = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    }
+    return (fd);
+}
+
+static void runThread(const Config &config, const Endpoint &endpoint, size_t index, size_t connections, Result &result) {
+    std::string chunk = makeChunk(index, config.lineSize);
+    std::vector<size_t> offsets(connections, 0); // position in the chunk of each connection (partial sends)
+    std::vector<int> fds(connections, -1);
+    int epollFd = epoll_create1(EPOLL_CLOEXEC);
+
+    for (size_t i = 0; i < connections; ++i) {
+        fds[i] = connectTo(endpoint);
+        if (fds[i] < 0) {
+            result.refused += 1;
+            continue;
+        }
+
+        struct epoll_event event;
+        event.events = EPOLLOUT; // level-triggered: writable means there is room for more lines
+        event.data.u64 = i;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, fds[i], &event);
+        result.connected += 1;
+    }
+
+    struct epoll_event events[64];
+    while (!done.load(std::memory_order_relaxed) && result.connected > result.closed) {
+        int ready = epoll_wait(epollFd, events, 64, 100);
+
+        for (int e = 0; e < ready; ++e) {
+            size_t i = (size_t)events[e].data.u64;
+            ssize_t sent = send(fds[i], chunk.data() + offsets[i], chunk.size() - offsets[i], MSG_DONTWAIT | MSG_NOSIGNAL);
+
+            if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+                continue;
+            }
+            if (sent <= 0 || (events[e].events & (EPOLLERR | EPOLLHUP))) {
+                close(fds[i]); // the daemon closed it
+                fds[i] = -1;
+                result.closed += 1;
+                continue;
+            }
+
+            offsets[i] = (offsets[i] + (size_t)sent) % chunk.size();
+            if (measuring.load(std::memory_order_relaxed)) {
+                result.bytes += (uint64_t)sent;
+            }
+        }
+    }
+
+    for (int fd : fds) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+    close(epollFd);
+}
+
+// one ping at a time: send, then block until the whole "pong\n" is back
+static Latency measurePings(const Endpoint &endpoint, size_t pings) {
+    Latency latency;
+    std::vector<double> samples;
+    int fd = connectTo(endpoint);
+
+    if (fd < 0) {
+        return (latency);
+    }
+    // the first pong waits for the lines of the load phase still queued in the daemon: not counted
+    samples.reserve(pings);
+    for (size_t i = 0; i <= pings; ++i) {
+        char reply[5];
+        size_t received = 0;
+        auto start = std::chrono::steady_clock::now();
+
+        if (send(fd, "ping\n", 5, MSG_NOSIGNAL) != 5) {
+            break;
+        }
+        while (received < sizeof(reply)) {
+            ssize_t bytes = recv(fd, reply + received, sizeof(reply) - received, 0);
+            if (bytes <= 0) {
+                break;
+            }
+            received += (size_t)bytes;
+        }
+        if (received < sizeof(reply) || memcmp(reply, "pong\n", 5) != 0) {
+            break; // closed (busy, idle timeout) or a daemon that doesn't answer pings (no --ping)
+        }
+        if (i > 0) {
+            samples.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+        }
+    }
+    close(fd);
+
+    if (!samples.empty()) {
+        std::sort(samples.begin(), samples.end());
+        latency.count = samples.size();
+        latency.p50 = samples[samples.size() / 2];
+        latency.p99 = samples[std::min(samples.size() - 1, samples.size() * 99 / 100)];
+        latency.max = samples.back();
+    }
+    return (latency);
+}
+
+static Result measureLoad(const Config &config, const Endpoint &endpoint, double *elapsed) {
+    std::vector<Result> results(config.threads);
+    std::vector<std::thread> threads;
+
+    measuring = false;
+    done = false;
+    for (size_t t = 0; t < config.threads; ++t) {
+        size_t connections = config.connections / config.threads + (t < config.connections % config.threads ? 1 : 0);
+        threads.emplace_back(runThread, std::cref(config), std::cref(endpoint), t, connections, std::ref(results[t]));
+    }
+
+    std::this_thread::sleep_for(std::chrono::duration<double>(config.warmup));
+    measuring = true;
+    auto start = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(std::chrono::duration<double>(config.seconds));
+    measuring = false;
+    *elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    done = true;
+
+    Result total;
+    for (size_t t = 0; t < config.threads; ++t) {
+        threads[t].join();
+        total.bytes += results[t].bytes;
+        total.connected += results[t].connected;
+        total.refused += results[t].refused;
+        total.closed += results[t].closed;
+    }
+    return (total);
+}
+
+int main(int argc, char **argv) {
+    Config config;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:t:d:w:s:p:")) != -1) {
+        switch (opt) {
+            case 'c':
+                config.connections = strtoull(optarg, nullptr, 10);
+                break;
+            case 't':
+                config.threads = strtoull(optarg, nullptr, 10);
+                break;
+            case 'd':
+                config.seconds = strtod(optarg, nullptr);
+                break;
+            case 'w':
+                config.warmup = strtod(optarg, nullptr);
+                break;
+            case 's':
+                config.lineSize = strtoull(optarg, nullptr, 10);
+                break;
+            case 'p':
+                config.pings = strtoull(optarg, nullptr, 10);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    for (; optind < argc; ++optind) {
+        Endpoint endpoint;
+        if (!parseEndpoint(argv[optind], &endpoint)) {
+            usage(argv[0]);
+        }
+        config.endpoints.push_back(endpoint);
+    }
+    if (config.endpoints.empty()) {
+        Endpoint endpoint;
+        parseEndpoint("127.0.0.1:4242", &endpoint);
+        config.endpoints.push_back(endpoint);
+    }
+    if (config.connections == 0 || config.threads == 0 || config.seconds <= 0 || config.lineSize < 16) {
+        usage(argv[0]);
+    }
+    config.threads = (config.threads > config.connections) ? config.connections : config.threads;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    std::vector<double> rates;
+    std::vector<Latency> latencies;
+    bool connected = false;
+    for (const Endpoint &endpoint : config.endpoints) {
+        double elapsed;
+        Result total = measureLoad(config, endpoint, &elapsed);
+        Latency latency = measurePings(endpoint, config.pings);
+        double lines = (double)total.bytes / config.lineSize;
+
+        printf("%s  %zu connections (%zu threads), %zu refused, %zu closed by the daemon\n",
+            endpoint.name.c_str(), total.connected, config.threads, total.refused, total.closed);
+        printf("  %.0f lines/s  %.1f MB/s  (%zu-byte lines, %.1fs measured)\n",
+            lines / elapsed, (double)total.bytes / elapsed / (1024 * 1024), config.lineSize, elapsed);
+        if (latency.count > 0) {
+            printf("  ping round trip: p50 %.1f us  p99 %.1f us  max %.1f us  (%zu pings)\n",
+                latency.p50, latency.p99, latency.max, latency.count);
+        } else if (config.pings > 0) {
+            printf("  ping round trip: no answer\n");
+        }
+        rates.push_back(lines / elapsed);
+        latencies.push_back(latency);
+        connected = connected || total.connected > 0;
+    }
+
+    // relative to the first endpoint
+    if (config.endpoints.size() > 1) {
+        printf("\n%-24s %12s %10s %10s\n", "endpoint", "lines/s", "p50 us", "p99 us");
+        for (size_t i = 0; i < config.endpoints.size(); ++i) {
+            printf("%-24s %12.0f %10.1f %10.1f", config.endpoints[i].name.c_str(), rates[i], latencies[i].p50, latencies[i].p99);
+            if (i > 0 && rates[0] > 0 && latencies[0].p50 > 0 && latencies[i].p50 > 0) {
+                printf("   x%.2f throughput, x%.2f p50", rates[i] / rates[0], latencies[i].p50 / latencies[0].p50);
+            }
+            printf("\n");
+        }
+    }
+    return (connected ? EXIT_SUCCESS : EXIT_FAILURE);
+}
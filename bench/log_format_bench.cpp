@@ -0,0 +1,80 @@
+#include "Log_record.hpp"
+#include "Timestamp_cache.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+// cpu and bytes per record of the log encodings:
+//   legacy: time() + localtime_r() + strftime() + snprintf() per record (the original Tintin_reporter::log())
+//   text:   cached timestamp + Log_record::formatText() (--log-format=text)
+//   binary: Log_record::encodeBinary() (--log-format=binary)
+
+static constexpr size_t LINE_MAX_LEN = 4096;
+
+struct Result {
+    double nsPerRecord;
+    double bytesPerRecord;
+};
+
+static volatile size_t sink; // keeps the compiler from dropping the encoded bytes
+
+static constexpr size_t MESSAGES = 1024;
+static char messages[MESSAGES][64]; // prepared outside of the timed loops
+static size_t messagesLen[MESSAGES];
+
+template <typename Encode>
+static Result run(size_t records, Encode encode) {
+    char line[LINE_MAX_LEN];
+    size_t bytes = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < records; ++i) {
+        bytes += encode(line, messages[i % MESSAGES], messagesLen[i % MESSAGES]);
+        sink += (unsigned char)line[bytes % 16];
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    return (Result{ ns / records, (double)bytes / records });
+}
+
+int main(int argc, char **argv) {
+    size_t records = (argc > 1) ? strtoull(argv[1], nullptr, 10) : 2000000;
+    Timestamp_cache timestamps;
+
+    for (size_t i = 0; i < MESSAGES; ++i) {
+        messagesLen[i] = (size_t)snprintf(messages[i], sizeof(messages[i]), "User input: client line %zu", i * 7919);
+    }
+
+    Result legacy = run(records, [](char *out, const char *msg, size_t) {
+        char timestamp[256];
+        struct tm tmp;
+        time_t t = time(NULL);
+        localtime_r(&t, &tmp);
+        strftime(timestamp, sizeof(timestamp), "%d/%m/%Y-%H:%M:%S", &tmp);
+        int written = snprintf(out, LINE_MAX_LEN, "[%s] [ %s ] - Matt_daemon: %s.\n", timestamp, "LOG", msg);
+        return ((size_t)written);
+    });
+
+    Result text = run(records, [&timestamps](char *out, const char *msg, size_t len) {
+        struct timespec ts;
+        char timestamp[Timestamp_cache::MAX_LEN];
+        Timestamp_cache::now(&ts);
+        size_t timestampLen = timestamps.format(timestamp, ts, Timestamp_cache::SECONDS);
+        return (Log_record::formatText(out, LINE_MAX_LEN, timestamp, timestampLen, 0, msg, len));
+    });
+
+    Result binary = run(records, [](char *out, const char *msg, size_t len) {
+        struct timespec ts;
+        Timestamp_cache::now(&ts);
+        return (Log_record::encodeBinary(out, LINE_MAX_LEN, ts, 0, msg, len));
+    });
+
+    printf("%zu records\n", records);
+    printf("%-8s %12s %14s\n", "format", "ns/record", "bytes/record");
+    printf("%-8s %12.1f %14.1f\n", "legacy", legacy.nsPerRecord, legacy.bytesPerRecord);
+    printf("%-8s %12.1f %14.1f\n", "text", text.nsPerRecord, text.bytesPerRecord);
+    printf("%-8s %12.1f %14.1f\n", "binary", binary.nsPerRecord, binary.bytesPerRecord);
+    return (0);
+}
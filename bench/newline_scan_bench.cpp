@@ -0,0 +1,96 @@
+#include "Newline_scanner.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// line splitting throughput of the Newline_scanner implementations, for short (chat-like) and long (bulk) lines:
+// every implementation has to find the same offsets, then each one splits the same buffer over and over.
+//
+//   ./newline_scan_bench [megabytes]
+
+static constexpr size_t BATCH = 128; // Line_buffer::LINE_BATCH
+
+static volatile size_t sink; // keeps the compiler from dropping the results
+
+struct Impl {
+    const char *name;
+    Newline_scanner::ScanFn scan;
+};
+
+// the whole buffer, batch after batch like Line_buffer does
+static size_t splitAll(Newline_scanner::ScanFn scan, const std::string &data, std::vector<uint32_t> *all) {
+    uint32_t offsets[BATCH];
+    size_t pos = 0;
+    size_t lines = 0;
+
+    while (pos < data.size()) {
+        size_t covered = 0;
+        size_t count = scan(data.data() + pos, data.size() - pos, offsets, BATCH, &covered);
+        for (size_t i = 0; i < count; ++i) {
+            if (all != nullptr) {
+                all->push_back((uint32_t)(pos + offsets[i]));
+            }
+            sink += offsets[i];
+        }
+        lines += count;
+        pos += covered;
+    }
+    return (lines);
+}
+
+static std::string makeData(size_t bytes, size_t lineLen) {
+    std::string data;
+
+    data.reserve(bytes);
+    for (size_t n = 0; data.size() < bytes; ++n) {
+        // lengths vary around lineLen so that newlines land at every position of the vector blocks
+        size_t len = lineLen / 2 + (n * 7919) % lineLen;
+        for (size_t i = 0; i < len; ++i) {
+            data += (char)('a' + (n + i) % 26);
+        }
+        data += '\n';
+    }
+    data.resize(bytes);
+    return (data);
+}
+
+int main(int argc, char **argv) {
+    size_t megabytes = (argc > 1) ? strtoull(argv[1], nullptr, 10) : 64;
+    std::vector<Impl> impls = { { "scalar", Newline_scanner::scanScalar } };
+
+#if defined(__x86_64__) || defined(__i386__)
+    impls.push_back({ "sse2", Newline_scanner::scanSse2 });
+    if (__builtin_cpu_supports("avx2")) {
+        impls.push_back({ "avx2", Newline_scanner::scanAvx2 });
+    }
+#endif
+    printf("dispatch: %s\n", Newline_scanner::implementation());
+
+    const size_t lineLens[] = { 16, 64, 1024 };
+    for (size_t lineLen : lineLens) {
+        std::string data = makeData(megabytes * 1024 * 1024, lineLen);
+
+        std::vector<uint32_t> expected;
+        splitAll(Newline_scanner::scanScalar, data, &expected);
+        for (const Impl &impl : impls) {
+            std::vector<uint32_t> found;
+            splitAll(impl.scan, data, &found);
+            if (found != expected) {
+                printf("%s: wrong offsets (%zu newlines, expected %zu)\n", impl.name, found.size(), expected.size());
+                return (EXIT_FAILURE);
+            }
+        }
+
+        printf("~%zu-byte lines (%zu lines):\n", lineLen, expected.size());
+        for (const Impl &impl : impls) {
+            auto start = std::chrono::steady_clock::now();
+            splitAll(impl.scan, data, nullptr);
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            printf("  %-7s %6.2f GB/s  %7.1f M lines/s\n", impl.name, data.size() / seconds / 1e9, expected.size() / seconds / 1e6);
+        }
+    }
+    return (EXIT_SUCCESS);
+}
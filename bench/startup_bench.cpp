@@ -0,0 +1,167 @@
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <string>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+// startup latency of the daemon: runs it R times, each time measuring from the exec to
+//  - launcher: the command returned (the first parent's _exit; with --wait-ready, the daemon is serving by then)
+//  - served: a connection was accepted and answered ("ping" => "pong", the event loop is running; the daemon needs --ping)
+// then asks it to quit and waits for the lock to be free before the next run:
+//
+//   ./startup_bench [-n runs] [-p port] DAEMON [daemon options...]
+//
+// must run as root (the daemon does), with no other daemon running
+
+static constexpr const char *LOCK_FILE = "/var/lock/matt_daemon.lock";
+static constexpr double TIMEOUT_SEC = 10;
+
+typedef std::chrono::steady_clock Clock;
+
+static void usage(const char *name) {
+    printf("usage: %s [-n runs] [-p port] DAEMON [daemon options...]\n", name);
+    exit(EXIT_FAILURE);
+}
+
+static double elapsedUs(Clock::time_point since) {
+    return (std::chrono::duration<double, std::micro>(Clock::now() - since).count());
+}
+
+static bool lockFree(void) {
+    int fd = open(LOCK_FILE, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return (true); // removed by the daemon on its way out
+    }
+    bool free = (flock(fd, LOCK_SH | LOCK_NB) == 0); // released right away (a new daemon would fail to lock it meanwhile)
+    close(fd);
+    return (free);
+}
+
+static bool waitLockFree(void) {
+    Clock::time_point start = Clock::now();
+    while (!lockFree()) {
+        if (elapsedUs(start) > TIMEOUT_SEC * 1e6) {
+            return (false);
+        }
+        usleep(1000);
+    }
+    return (true);
+}
+
+// connects until the listener exists, then one "ping" round trip (false: timed out). *fd: the connection, left open
+static bool firstPong(const struct sockaddr_in &addr, Clock::time_point start, int *fd) {
+    while (elapsedUs(start) < TIMEOUT_SEC * 1e6) {
+        *fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (*fd < 0) {
+            return (false);
+        }
+        if (connect(*fd, (const struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            close(*fd);
+            usleep(100); // no listener yet
+            continue;
+        }
+
+        char reply[16];
+        struct pollfd pfd = { *fd, POLLIN, 0 };
+        if (send(*fd, "ping\n", 5, MSG_NOSIGNAL) == 5 && poll(&pfd, 1, (int)(TIMEOUT_SEC * 1000)) == 1
+            && recv(*fd, reply, sizeof(reply), 0) >= 4 && memcmp(reply, "pong", 4) == 0) {
+            return (true);
+        }
+        close(*fd); // the previous daemon's listener (it was quitting), or refused: "busy"
+    }
+    return (false);
+}
+
+static double percentile(std::vector<double> values, double p) {
+    std::sort(values.begin(), values.end());
+    return (values[std::min(values.size() - 1, (size_t)(p * (double)values.size()))]);
+}
+
+int main(int argc, char **argv) {
+    size_t runs = 20;
+    int port = 4242;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "+n:p:")) != -1) {
+        switch (opt) {
+            case 'n':
+                runs = strtoull(optarg, nullptr, 10);
+                break;
+            case 'p':
+                port = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (optind >= argc || runs == 0) {
+        usage(argv[0]);
+    }
+    char **command = argv + optind;
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    std::vector<double> launcher;
+    std::vector<double> served;
+    for (size_t run = 0; run < runs; ++run) {
+        if (!waitLockFree()) {
+            printf("a daemon is still running (%s is locked)\n", LOCK_FILE);
+            return (EXIT_FAILURE);
+        }
+
+        Clock::time_point start = Clock::now();
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            return (EXIT_FAILURE);
+        }
+        if (pid == 0) {
+            execv(command[0], command);
+            _exit(127);
+        }
+
+        int status;
+        waitpid(pid, &status, 0);
+        double launcherUs = elapsedUs(start);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+            printf("%s failed to start (status %d)\n", command[0], status);
+            return (EXIT_FAILURE);
+        }
+
+        int fd;
+        if (!firstPong(addr, start, &fd)) {
+            printf("no answer on port %d\n", port);
+            return (EXIT_FAILURE);
+        }
+        served.push_back(elapsedUs(start));
+        launcher.push_back(launcherUs);
+
+        ssize_t ret = send(fd, "quit\n", 5, MSG_NOSIGNAL);
+        (void)ret;
+        close(fd);
+    }
+    waitLockFree();
+
+    printf("%zu runs of %s\n", runs, command[0]);
+    printf("%-10s %10s %10s %10s %10s\n", "us", "min", "p50", "p90", "max");
+    printf("%-10s %10.0f %10.0f %10.0f %10.0f\n", "launcher", percentile(launcher, 0), percentile(launcher, 0.5),
+        percentile(launcher, 0.9), percentile(launcher, 1));
+    printf("%-10s %10.0f %10.0f %10.0f %10.0f\n", "served", percentile(served, 0), percentile(served, 0.5),
+        percentile(served, 0.9), percentile(served, 1));
+    return (EXIT_SUCCESS);
+}
@@ -0,0 +1,56 @@
+#ifndef BUFFER_POOL_HPP
+#define BUFFER_POOL_HPP
+
+// recycles client read buffers (Line_buffer, std::vector...): a released buffer is cleared but keeps its heap block,
+// the next connection gets it back, so connection churn doesn't go through malloc/free
+// single threaded (one pool per event loop)
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+template <typename Buffer>
+class Buffer_pool {
+    private:
+        std::vector<Buffer> buffers; // free buffers (capacity reserved once)
+        size_t initialCapacity; // capacity of a fresh buffer
+        size_t maxKept; // free buffers kept at most
+        size_t maxCapacity; // larger buffers are freed instead of kept (a client sent one huge line)
+
+    public:
+        Buffer_pool(size_t initialCapacity, size_t maxKept, size_t maxCapacity):
+            initialCapacity(initialCapacity), maxKept(maxKept), maxCapacity(maxCapacity) {
+            this->buffers.reserve(maxKept);
+        }
+
+        Buffer_pool(const Buffer_pool &other) = delete;
+        Buffer_pool &operator=(const Buffer_pool &other) = delete;
+
+    public:
+        Buffer acquire(void) {
+            if (this->buffers.empty()) {
+                Buffer buffer;
+                buffer.reserve(this->initialCapacity);
+                return (buffer);
+            }
+
+            Buffer buffer = std::move(this->buffers.back());
+            this->buffers.pop_back();
+            return (buffer);
+        }
+
+        void release(Buffer &&buffer) {
+            if (this->buffers.size() >= this->maxKept || buffer.capacity() > this->maxCapacity) {
+                return; // freed with the caller's moved-from object
+            }
+
+            buffer.clear();
+            this->buffers.push_back(std::move(buffer));
+        }
+
+        size_t available(void) const {
+            return (this->buffers.size());
+        }
+};
+
+#endif
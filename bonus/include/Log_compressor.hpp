@@ -0,0 +1,40 @@
+#ifndef LOG_COMPRESSOR_HPP
+#define LOG_COMPRESSOR_HPP
+
+// gzips rotated log files from a background thread running at the lowest cpu and io priority
+// (file.log.<date> becomes file.log.<date>.gz, the event loop never waits for it)
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+
+class Log_compressor {
+    private:
+        static constexpr size_t QUEUE_MAX = 8; // rotated files waiting for compression (more are left uncompressed)
+        static constexpr size_t PATH_MAX_LEN = 4096;
+
+        char queue[QUEUE_MAX][PATH_MAX_LEN];
+        size_t head;
+        size_t count;
+        bool stopping;
+        std::mutex mutex;
+        std::condition_variable wakeup;
+        std::thread thread; // started by the first submit()
+
+    public:
+        Log_compressor();
+        ~Log_compressor(); // compresses what is still queued, then joins the thread
+        Log_compressor(const Log_compressor &other) = delete;
+        Log_compressor &operator=(const Log_compressor &other) = delete;
+
+    private:
+        void        loop(void);
+        static bool compress(const char *path); // path -> path.gz (the original is removed on success)
+
+    public:
+        bool submit(const char *path); // false if the queue is full or the thread can't start
+        void stop(void);
+};
+
+#endif
@@ -0,0 +1,121 @@
+#ifndef LOG_FORMAT_HPP
+#define LOG_FORMAT_HPP
+
+// compile-time checked "{}" formats for Tintin_reporter::log<Type>(fmt, args...)
+// the format is split around its placeholders at compile time, at runtime each argument is
+// written straight into the record buffer (no printf parsing, no heap allocation)
+//
+//     tintin_reporter.log<Tintin_reporter::INFO>(TINTIN_FMT("started. PID: {}"), getpid());
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+// wraps a string literal into a type, so the literal can be inspected in constant expressions
+#define TINTIN_FMT(str) \
+    ([]() { \
+        struct Fmt { static constexpr const char *value() { return (str); } }; \
+        return (Fmt{}); \
+    }())
+
+struct Log_format {
+    template <size_t N>
+    struct Layout {
+        size_t start[N + 1]; // literal segments around the N placeholders
+        size_t len[N + 1];
+    };
+
+    // number of "{}" placeholders, -1 if a '{' or '}' is not part of one
+    static constexpr int count(const char *fmt) {
+        int n = 0;
+
+        for (size_t i = 0; fmt[i] != '\0'; ++i) {
+            if (fmt[i] == '{' && fmt[i + 1] == '}') {
+                n += 1;
+                i += 1;
+            } else if (fmt[i] == '{' || fmt[i] == '}') {
+                return (-1);
+            }
+        }
+        return (n);
+    }
+
+    template <size_t N>
+    static constexpr Layout<N> layout(const char *fmt) {
+        Layout<N> result{};
+        size_t segment = 0;
+        size_t i = 0;
+
+        result.start[0] = 0;
+        for (; fmt[i] != '\0'; ++i) {
+            if (fmt[i] == '{' && fmt[i + 1] == '}') {
+                result.len[segment] = i - result.start[segment];
+                segment += 1;
+                result.start[segment] = i + 2;
+                i += 1;
+            }
+        }
+        result.len[segment] = i - result.start[segment];
+        return (result);
+    }
+
+    // (*) argument writers: append at out + pos (cap - 1 bytes at most), return the new position
+
+    static size_t append(char *out, size_t cap, size_t pos, const char *data, size_t len) {
+        size_t n = (len < cap - 1 - pos) ? len : cap - 1 - pos;
+        memcpy(out + pos, data, n);
+        return (pos + n);
+    }
+
+    static size_t write(char *out, size_t cap, size_t pos, std::string_view value) {
+        return (Log_format::append(out, cap, pos, value.data(), value.size()));
+    }
+
+    static size_t write(char *out, size_t cap, size_t pos, const char *value) {
+        return (Log_format::write(out, cap, pos, std::string_view(value ? value : "(null)")));
+    }
+
+    static size_t write(char *out, size_t cap, size_t pos, const std::string &value) {
+        return (Log_format::write(out, cap, pos, std::string_view(value)));
+    }
+
+    static size_t write(char *out, size_t cap, size_t pos, char value) {
+        return (Log_format::append(out, cap, pos, &value, 1));
+    }
+
+    static size_t write(char *out, size_t cap, size_t pos, bool value) {
+        return (Log_format::write(out, cap, pos, std::string_view(value ? "true" : "false")));
+    }
+
+    template <typename Int, typename std::enable_if<std::is_integral<Int>::value, int>::type = 0>
+    static size_t write(char *out, size_t cap, size_t pos, Int value) {
+        char digits[24];
+        size_t n = sizeof(digits);
+        bool negative = value < 0;
+        typename std::make_unsigned<Int>::type magnitude = negative ? 0 - (typename std::make_unsigned<Int>::type)value : value;
+
+        do {
+            digits[--n] = (char)('0' + magnitude % 10);
+            magnitude /= 10;
+        } while (magnitude != 0);
+        if (negative) {
+            digits[--n] = '-';
+        }
+        return (Log_format::append(out, cap, pos, digits + n, sizeof(digits) - n));
+    }
+
+    // renders literal segment I, then argument I (segment N closes the message)
+    template <size_t N, size_t... I, typename... Args>
+    static size_t render(char *out, size_t cap, const char *fmt, const Layout<N> &layout, std::index_sequence<I...>, const Args &...args) {
+        size_t pos = 0;
+
+        ((pos = Log_format::append(out, cap, pos, fmt + layout.start[I], layout.len[I]),
+          pos = Log_format::write(out, cap, pos, args)), ...);
+        return (Log_format::append(out, cap, pos, fmt + layout.start[N], layout.len[N]));
+    }
+};
+
+#endif
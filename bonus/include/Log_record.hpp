@@ -0,0 +1,38 @@
+#ifndef LOG_RECORD_HPP
+#define LOG_RECORD_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+
+// a log record as it travels from Tintin_reporter::log() to the writer thread
+// (fixed size so it can live in a preallocated ring, no dynamic allocation)
+
+struct Log_record {
+    static constexpr size_t MSG_MAX_LEN = 4096;
+    static constexpr uint64_t LAYOUT = 1; // bumped with every change of the fields below (ring files keep records as they are)
+
+    struct timespec time; // when the record was emitted (CLOCK_REALTIME)
+    uint8_t type; // Tintin_reporter::LogType
+    uint32_t len; // payload length (<= MSG_MAX_LEN)
+    char msg[MSG_MAX_LEN]; // payload (not null terminated)
+
+    // on-disk encodings (shared by the daemon and the offline tools)
+    static const char   *typeName(uint8_t type); // "LOG", "INFO" or "ERROR"
+    static size_t       formatText(char *out, size_t cap, const char *timestamp, size_t timestampLen, uint8_t type, const char *msg, size_t len); // "[ts] [ TYPE ] - Matt_daemon: msg.\n" cut to cap - 1 bytes, null terminated
+    static size_t       encodeBinary(char *out, size_t cap, const struct timespec &ts, uint8_t type, const char *msg, size_t len); // header + payload (cut to fit cap) + '\n'
+};
+
+// binary format: one header, the raw payload, then '\n' (a record never ends with a zero byte and text lines can be told apart)
+// integers are in host byte order, the decoder has to run on the same architecture
+struct __attribute__((packed)) Log_binary_header {
+    static constexpr uint8_t MAGIC = 0xB7; // never the first byte of a text line ('[')
+
+    uint8_t magic;
+    uint8_t type;
+    uint16_t len; // payload bytes (the '\n' terminator excluded)
+    uint32_t nsec;
+    int64_t sec;
+};
+
+#endif
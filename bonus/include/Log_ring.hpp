@@ -0,0 +1,64 @@
+#ifndef LOG_RING_HPP
+#define LOG_RING_HPP
+
+// bounded lock-free multi-producer ring of log records (Vyukov's sequence-per-cell queue)
+// the cells are mapped once at construction, pushing and popping never allocates
+// attachFile() moves them into a shared file mapping (tmpfs): a committed record stays there until the writer released
+// it, so the records a crashed process had not written yet can be replayed by the next one (replayFile())
+
+#include "Log_record.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+class Log_ring {
+    public:
+        struct alignas(64) Cell {
+            std::atomic<size_t> seq; // == pos: free, == pos + 1: committed (the commit marker), == pos + capacity: free for the next lap
+            size_t pos; // position claimed by the current owner of the cell (never == seq - 1 unless committed)
+            Log_record record;
+        };
+
+        // first page of a ring file, the cells follow at FILE_HEADER_SIZE
+        struct FileHeader {
+            static constexpr uint64_t MAGIC = 0x4d4154544c4f4731ULL; // "MATTLOG1"
+
+            uint64_t magic;
+            uint64_t capacity;
+            uint64_t cellSize; // sizeof(Cell)
+            uint64_t layout; // Log_record::LAYOUT: another record layout doesn't replay, even if the cells have the same size
+        };
+
+        static constexpr size_t FILE_HEADER_SIZE = 4096;
+        static constexpr size_t MAX_CAPACITY = (size_t)1 << 16; // cells (about 4 KiB each, all touched at startup): 270 MiB
+
+    private:
+        Cell *cells;
+        void *mapping; // cells, or the header page followed by the cells (ring file)
+        size_t mappingSize;
+        size_t capacity; // power of 2
+        size_t mask;
+        alignas(64) std::atomic<size_t> enqueuePos;
+        alignas(64) std::atomic<size_t> dequeuePos;
+
+    public:
+        explicit Log_ring(size_t capacity); // capacity is rounded up to a power of 2 (0 means no ring at all, above MAX_CAPACITY throws)
+        ~Log_ring();
+        Log_ring() = delete;
+        Log_ring(const Log_ring &other) = delete;
+        Log_ring &operator=(const Log_ring &other) = delete;
+
+    public:
+        Cell    *tryAcquire(void); // producer side: claims a free cell (nullptr if the ring is full)
+        void    publish(Cell *cell); // producer side: commits a claimed cell (visible to consumers)
+        Cell    *tryConsume(void); // consumer side: claims the oldest committed cell (nullptr if there is none)
+        void    release(Cell *cell); // consumer side: gives a consumed cell back to the producers
+        bool    empty(void) const; // true if no committed cell is waiting to be consumed
+        size_t  getCapacity(void) const;
+        bool    fileBacked(void) const; // attachFile() succeeded: released records are no longer replayed
+        bool    attachFile(const char *path); // moves the (unused, empty) ring into a shared mapping of path, false (errno set) if it can't
+        static size_t replayFile(const char *path, const std::function<void(const Log_record &)> &replay); // committed records of a ring file, oldest first
+};
+
+#endif
@@ -1,8 +1,15 @@
 #ifndef MATT_DAEMON_HPP
 #define MATT_DAEMON_HPP
 
+#include "Buffer_pool.hpp"
+#include "Reactor.hpp"
+#include "Slot_map.hpp"
+#include "Stall_watchdog.hpp"
+#include "Timer_wheel.hpp"
 #include "Tintin_reporter.hpp"
 #include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include <string>
 #include <vector>
 #include "Shell.hpp"
@@ -12,27 +19,42 @@
 
 // singleton
 class Matt_daemon {
+    public:
+        struct Options {
+            size_t maxClients = 3; // connections served at once (the fd limit is raised to fit)
+            long stallThresholdMs = 250; // an event loop iteration (or a log writer batch) running longer is logged (0: no watchdog)
+            bool stallBacktrace = false; // and the stalled thread logs its backtrace
+        };
+
     private:
         static std::atomic<int> receivedSignal;
         static std::atomic<int> quitRequested;
-        static constexpr int MAX_CLIENTS = 3;
+        static std::atomic<int> reopenRequested; // SIGHUP: the log file has to be rotated/reopened
+        static constexpr size_t RESERVED_FDS = 64; // fds besides the clients (log, lock, epoll, listener, shells...)
+        static constexpr size_t BUFFER_SIZE = 1024; // initial capacity of a client read buffer
+        static constexpr size_t POOLED_BUFFERS_MAX = 4096; // free read buffers kept for the next connections
+        static constexpr size_t POOLED_BUFFER_CAPACITY_MAX = 64 * 1024; // bigger buffers go back to the heap
+        static constexpr long HANDSHAKE_TIMEOUT_MS = 10000; // a client has that long to send its RSA public key
+        static constexpr long TIMER_TICK_MS = 10; // resolution of the timer wheel
         static constexpr const char *PORT = "4242";
         static constexpr const char *lockFile = "/var/lock/matt_daemon.lock";
 
     private:
         struct Client {
             int fd;
+            uint64_t id; // slot map handle (the reactor tokens of the socket and the shell carry it)
             size_t size;
             Shell *shell;
             std::string session_key;
             std::vector<unsigned char> buffer;
             std::string msg;
+            Timer_wheel::Id handshakeTimer; // until the session key is sent (0: done)
 
             private:
                 Client();
 
             public:
-                Client(int fd): fd(fd), size(0), shell(nullptr) {}
+                Client(int fd, std::vector<unsigned char> &&buffer): fd(fd), id(0), size(0), shell(nullptr), buffer(std::move(buffer)), handshakeTimer(0) {}
                 ~Client();
                 
         };
@@ -40,11 +62,15 @@ class Matt_daemon {
     private:
         int lockFd; // lockfile file descriptor (shouldn't be closed as the lock will be released)
         int listenFd; // socket listening for connection requests
-        std::vector<Client> clients; // clients sockets
+        Options options;
+        Slot_map<Client> clients; // the reactor tokens carry the handles
+        Buffer_pool<std::vector<unsigned char> > bufferPool; // read buffers of the closed clients
+        Reactor reactor; // listenFd, the client sockets and their shells (opened by createServer(), in the daemon process)
+        Timer_wheel timers; // key exchange deadlines (CLIENT tokens)
         const Tintin_reporter &tintin_reporter;
 
     private:
-        Matt_daemon(const Tintin_reporter &tintin_reporter);
+        Matt_daemon(const Tintin_reporter &tintin_reporter, const Options &options);
 
     public:
         ~Matt_daemon();
@@ -56,10 +82,12 @@ class Matt_daemon {
         void start(void);
 
     public:
-        static Matt_daemon &getMattDaemon(const Tintin_reporter &tintin_reporter); // returns always the same Matt_daemon instance
+        static Matt_daemon &getMattDaemon(const Tintin_reporter &tintin_reporter); // returns always the same Matt_daemon instance (default options)
+        static Matt_daemon &getMattDaemon(const Tintin_reporter &tintin_reporter, const Options &options); // options are only honored by the first call
 
     private:
         static void signalHandler(int sig);
+        static void reopenHandler(int sig);
         void setupSignals(void) const;
         void createServer(void);
         void cleanup(void);
@@ -67,6 +95,13 @@ class Matt_daemon {
         void createLockFile(void); // should be called before daemonization (as it requires a controlling terminal to report errors before it exits)
         void removeLockFile(void) const; // releases the lock, closes the lockFd and removes the lock file
         void daemonize(void) const;
+        long pollTimeout(void); // until the next deadline or log flush (-1: none)
+        void runTimers(void); // after each batch: closes the clients whose key exchange is overdue
+        void acceptClients(void); // accepts until the backlog is empty (edge-triggered)
+        bool readClient(Client &client); // reads until EAGAIN and handles what arrived (false: the client is gone)
+        void readShell(Client &client); // forwards the shell output until EAGAIN, ends the shell when it exited
+        void watchShell(Client &client); // registers a newly started shell in the reactor
+        void closeClient(Slot_map<Client>::Handle handle); // closes the socket (and the shell), recycles the read buffer, frees the slot
         void handleMessage(Client &client) const;
         void createSecureSessionKey(Client &client, const std::string &rsa_public_key) const;
 };
@@ -0,0 +1,42 @@
+#ifndef MMAP_LOG_HPP
+#define MMAP_LOG_HPP
+
+// appends to a log file through a shared mapping of a preallocated segment
+// (a record is a memcpy plus a CAS on the tail, a syscall is only needed to move to the next segment)
+
+#include <atomic>
+#include <cstddef>
+#include <shared_mutex>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+class Mmap_log {
+    private:
+        int fd; // the log file (opened O_RDWR, owned by the caller)
+        size_t segmentSize; // bytes preallocated and mapped at once (multiple of the page size)
+        char *map; // current segment
+        off_t mapOffset; // file offset of map (page aligned)
+        std::atomic<off_t> tail; // end of the written data (everything after it is preallocated zeros)
+        std::shared_mutex remapLock; // appenders share it, moving to the next segment takes it exclusively
+
+    public:
+        Mmap_log();
+        ~Mmap_log();
+        Mmap_log(const Mmap_log &other) = delete;
+        Mmap_log &operator=(const Mmap_log &other) = delete;
+
+    private:
+        static off_t    findTail(int fd); // end of the real data (skips the zeros a crashed run preallocated)
+        void            mapSegment(off_t from); // preallocates and maps the segment holding from (exclusive lock held)
+
+    public:
+        void    attach(int fd, size_t segmentSize); // recovers the tail and maps the first segment (throws std::runtime_error)
+        void    append(const char *data, size_t len); // thread-safe
+        void    append(const struct iovec *iov, size_t count); // thread-safe (records stay contiguous, not necessarily adjacent)
+        void    reopen(int newFd); // log rotation: truncates the current file, dup2()s newFd over the fd and maps the new file (throws std::runtime_error)
+        void    detach(void); // unmaps and truncates the file to the real length (clean shutdown)
+        bool    attached(void) const;
+        off_t   size(void) const; // bytes of real data in the file
+};
+
+#endif
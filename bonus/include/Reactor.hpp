@@ -0,0 +1,49 @@
+#ifndef REACTOR_HPP
+#define REACTOR_HPP
+
+// edge-triggered epoll: an fd is registered once, a wakeup only reports the fds that became ready
+// (a ready fd has to be drained until EAGAIN, no new event comes before that)
+// every fd carries a token (kind + a 56-bit id, e.g. a Slot_map handle) so the event loop knows what became ready without a search
+// (the io_uring engine tags its requests with the same tokens, the timers carry them too)
+
+#include <cstdint>
+#include <sys/epoll.h>
+
+class Reactor {
+    public:
+        static constexpr int MAX_EVENTS = 256; // events reported per wait()
+        static constexpr uint64_t ID_MASK = ((uint64_t)1 << 56) - 1;
+
+        enum Kind {
+            LISTENER = 1, // listening socket
+            CLIENT, // client socket
+            SHELL, // bonus: pty master of a client's shell (the token's id is the client's)
+            WAKEUP, // eventfd another thread writes to interrupt wait()
+            TIMER // no fd: a periodic task of the event loop in a Timer_wheel (the token's id says which)
+        };
+
+    private:
+        int epollFd; // -1 until open()
+        struct epoll_event ready[MAX_EVENTS];
+
+    public:
+        Reactor();
+        ~Reactor();
+        Reactor(const Reactor &other) = delete;
+        Reactor &operator=(const Reactor &other) = delete;
+
+    public:
+        bool                        open(void); // false (errno set) if epoll can't be created (call it in the process that runs the loop)
+        bool                        watch(int fd, Kind kind, uint64_t id); // readable / peer closed, edge-triggered (id < 2^56)
+        void                        unwatch(int fd); // before closing an fd that may be shared (close() alone is enough otherwise)
+        int                         wait(long timeoutMs); // number of ready fds (-1 and errno on failure, EINTR included), timeoutMs < 0: no timeout
+        const struct epoll_event    &event(int index) const;
+
+        static uint64_t token(Kind kind, uint64_t id);
+        static Kind     kindOf(uint64_t token);
+        static uint64_t idOf(uint64_t token);
+        static Kind     kindOf(const struct epoll_event &event);
+        static uint64_t idOf(const struct epoll_event &event);
+};
+
+#endif
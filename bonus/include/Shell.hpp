@@ -4,6 +4,7 @@ class Shell {
     public:
     int pid;
     int master_fd;
+    bool watched; // master_fd is registered in the daemon's reactor
 
     Shell();
     ~Shell();
@@ -0,0 +1,108 @@
+#ifndef STALL_WATCHDOG_HPP
+#define STALL_WATCHDOG_HPP
+
+// event loop stall detection: each watched thread publishes when its current iteration started (0 while it waits
+// for events, waiting is not stalling) and what it is doing (a phase name, the client fd). a watchdog thread checks
+// them every quarter of the threshold and logs the iterations that run longer, once each, then when they end.
+// the loops only store into their own beat (relaxed stores, no clock read besides the one they already do);
+// optionally the stalled thread is interrupted (pthread_sigqueue, the request numbered) to log where it is stuck
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <pthread.h>
+#include <signal.h>
+#include <thread>
+
+class Tintin_reporter;
+
+class Stall_watchdog {
+    private:
+        static constexpr size_t MAX_BEATS = 64; // watched threads (the others are not watched)
+        static constexpr int MAX_FRAMES = 32; // of a backtrace
+        static constexpr long BACKTRACE_WAIT_MS = 100; // for the stalled thread to run the signal handler
+
+        struct alignas(64) Beat {
+            std::atomic<int64_t> sinceMs{0}; // CLOCK_MONOTONIC(_COARSE) when the iteration started (0: waiting)
+            std::atomic<const char *> phase{""}; // a string literal
+            std::atomic<int> fd{-1}; // the client being served (-1: none)
+            pthread_t thread;
+            bool left = false; // the thread is gone (under mutex: it must not be signaled any more)
+            char name[32];
+        };
+
+        static Beat *beats[MAX_BEATS];
+        static std::atomic<size_t> beatCount;
+        static std::mutex mutex; // registration, leaving, backtraces
+        static std::condition_variable wakeup;
+        static std::thread watchdog;
+        static bool stopping; // under mutex
+        static void *frames[MAX_FRAMES]; // filled by the stalled thread's signal handler
+        static std::atomic<int> frameCount; // -1: not filled yet
+        static std::atomic<uint64_t> request; // number of the backtrace request frames[] is open to, times 2 (+1: being filled, 0: none)
+        static uint64_t requests; // sent so far (watchdog thread only)
+        inline static thread_local Beat *current = nullptr;
+
+    public:
+        Stall_watchdog() = delete;
+
+    public:
+        static bool         start(const Tintin_reporter &reporter, long thresholdMs, bool backtraces); // false: the thread couldn't be created
+        static void         stop(void); // joins the watchdog (the watched threads may keep running)
+        static void         watch(const char *name); // the calling thread's loop is watched from now on (once)
+        static void         leave(void); // the calling thread is about to exit
+        static void         begin(int64_t nowMs); // an iteration starts (nowMs: monotonic, what the loop read after its wait)
+        static void         idle(void); // the iteration is over, waiting for events
+        static const char   *enter(const char *phase, int fd); // the phase (and the client) of the current iteration, returns the previous phase
+        static const char   *enter(const char *phase); // same client
+
+    private:
+        static void         run(const Tintin_reporter *reporter, long thresholdMs, bool backtraces);
+        static void         report(const Tintin_reporter &reporter, Beat &beat, int64_t sinceMs, int64_t nowMs, bool backtraces);
+        static void         logBacktrace(const Tintin_reporter &reporter, Beat &beat);
+        static void         backtraceHandler(int sig, siginfo_t *info, void *context);
+};
+
+inline void Stall_watchdog::begin(int64_t nowMs) {
+    Beat *beat = Stall_watchdog::current;
+
+    if (beat != nullptr) {
+        beat->sinceMs.store(nowMs > 0 ? nowMs : 1, std::memory_order_relaxed);
+    }
+}
+
+inline void Stall_watchdog::idle(void) {
+    Beat *beat = Stall_watchdog::current;
+
+    if (beat != nullptr) {
+        beat->sinceMs.store(0, std::memory_order_relaxed);
+        beat->fd.store(-1, std::memory_order_relaxed);
+    }
+}
+
+inline const char *Stall_watchdog::enter(const char *phase, int fd) {
+    Beat *beat = Stall_watchdog::current;
+
+    if (beat == nullptr) {
+        return ("");
+    }
+    const char *previous = beat->phase.load(std::memory_order_relaxed);
+    beat->phase.store(phase, std::memory_order_relaxed);
+    beat->fd.store(fd, std::memory_order_relaxed);
+    return (previous);
+}
+
+inline const char *Stall_watchdog::enter(const char *phase) {
+    Beat *beat = Stall_watchdog::current;
+
+    if (beat == nullptr) {
+        return ("");
+    }
+    const char *previous = beat->phase.load(std::memory_order_relaxed);
+    beat->phase.store(phase, std::memory_order_relaxed);
+    return (previous);
+}
+
+#endif
@@ -0,0 +1,205 @@
+#include "Log_ring.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+// (*) constructor & destructor
+
+Log_ring::Log_ring(size_t capacity): cells(nullptr), mapping(nullptr), mappingSize(0), capacity(0), mask(0), enqueuePos(0), dequeuePos(0) {
+    if (capacity == 0) {
+        return;
+    }
+    if (capacity > MAX_CAPACITY) {
+        throw std::runtime_error("log ring capacity too large"); // rounding up would never end, the size would overflow
+    }
+
+    this->capacity = 2;
+    while (this->capacity < capacity) {
+        this->capacity <<= 1;
+    }
+    this->mask = this->capacity - 1;
+
+    // mapped once (zero filled pages), the ring never allocates afterwards
+    void *mem = mmap(nullptr, this->capacity * sizeof(Cell), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        throw std::runtime_error("failure to map the log ring");
+    }
+
+    this->mapping = mem;
+    this->mappingSize = this->capacity * sizeof(Cell);
+    this->cells = static_cast<Cell *>(mem);
+    for (size_t i = 0; i < this->capacity; ++i) {
+        this->cells[i].seq.store(i, std::memory_order_relaxed);
+        this->cells[i].pos = i;
+    }
+}
+
+Log_ring::~Log_ring() {
+    if (this->mapping) {
+        munmap(this->mapping, this->mappingSize);
+    }
+}
+
+// (*) producer side
+
+Log_ring::Cell *Log_ring::tryAcquire(void) {
+    size_t pos = this->enqueuePos.load(std::memory_order_relaxed);
+
+    while (true) {
+        Cell *cell = &this->cells[pos & this->mask];
+        size_t seq = cell->seq.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+        if (diff == 0) {
+            // the cell is free for this lap, try to claim it (pos is reloaded on failure)
+            if (this->enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                cell->pos = pos;
+                return (cell);
+            }
+        } else if (diff < 0) {
+            return (nullptr); // the cell still holds a record of the previous lap => full
+        } else {
+            pos = this->enqueuePos.load(std::memory_order_relaxed); // another producer got it first
+        }
+    }
+}
+
+void Log_ring::publish(Cell *cell) {
+    cell->seq.store(cell->pos + 1, std::memory_order_release);
+}
+
+// (*) consumer side
+
+Log_ring::Cell *Log_ring::tryConsume(void) {
+    size_t pos = this->dequeuePos.load(std::memory_order_relaxed);
+
+    while (true) {
+        Cell *cell = &this->cells[pos & this->mask];
+        size_t seq = cell->seq.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+
+        if (diff == 0) {
+            if (this->dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                cell->pos = pos;
+                return (cell);
+            }
+        } else if (diff < 0) {
+            return (nullptr); // not committed yet => empty
+        } else {
+            pos = this->dequeuePos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void Log_ring::release(Cell *cell) {
+    cell->seq.store(cell->pos + this->capacity, std::memory_order_release);
+}
+
+bool Log_ring::empty(void) const {
+    if (this->cells == nullptr) {
+        return (true);
+    }
+
+    size_t pos = this->dequeuePos.load(std::memory_order_acquire);
+    return (this->cells[pos & this->mask].seq.load(std::memory_order_acquire) != pos + 1);
+}
+
+size_t Log_ring::getCapacity(void) const {
+    return (this->capacity);
+}
+
+bool Log_ring::fileBacked(void) const {
+    return (this->cells != nullptr && static_cast<void *>(this->cells) != this->mapping);
+}
+
+// (*) ring file
+
+bool Log_ring::attachFile(const char *path) {
+    if (this->cells == nullptr) {
+        return (true); // no ring, nothing to keep
+    }
+
+    size_t size = FILE_HEADER_SIZE + this->capacity * sizeof(Cell);
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return (false);
+    }
+
+    void *mem = MAP_FAILED;
+    if (ftruncate(fd, 0) == 0 && ftruncate(fd, size) == 0) {
+        mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    int error = errno;
+    close(fd); // the mapping keeps the file
+    if (mem == MAP_FAILED) {
+        errno = error;
+        return (false);
+    }
+
+    Cell *cells = reinterpret_cast<Cell *>(static_cast<char *>(mem) + FILE_HEADER_SIZE);
+    for (size_t i = 0; i < this->capacity; ++i) {
+        cells[i].seq.store(i, std::memory_order_relaxed);
+        cells[i].pos = i;
+    }
+
+    // the header goes last: a file without it is never replayed
+    FileHeader *header = static_cast<FileHeader *>(mem);
+    header->capacity = this->capacity;
+    header->cellSize = sizeof(Cell);
+    header->layout = Log_record::LAYOUT;
+    __atomic_store_n(&header->magic, FileHeader::MAGIC, __ATOMIC_RELEASE);
+
+    munmap(this->mapping, this->mappingSize);
+    this->mapping = mem;
+    this->mappingSize = size;
+    this->cells = cells;
+    this->enqueuePos.store(0);
+    this->dequeuePos.store(0);
+    return (true);
+}
+
+size_t Log_ring::replayFile(const char *path, const std::function<void(const Log_record &)> &replay) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return (0);
+    }
+
+    struct stat st;
+    FileHeader header;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < FILE_HEADER_SIZE || read(fd, &header, sizeof(header)) != (ssize_t)sizeof(header)
+        || header.magic != FileHeader::MAGIC || header.cellSize != sizeof(Cell) || header.layout != Log_record::LAYOUT
+        || header.capacity == 0 || header.capacity > MAX_CAPACITY || (size_t)st.st_size != FILE_HEADER_SIZE + header.capacity * sizeof(Cell)) {
+        close(fd);
+        return (0);
+    }
+
+    void *mem = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) {
+        return (0);
+    }
+
+    // committed and never released: published by a producer, not (known to be) written by the writer
+    const Cell *cells = reinterpret_cast<const Cell *>(static_cast<const char *>(mem) + FILE_HEADER_SIZE);
+    std::vector<const Cell *> pending;
+    for (size_t i = 0; i < header.capacity; ++i) {
+        const Cell &cell = cells[i];
+        if (cell.seq.load(std::memory_order_acquire) == cell.pos + 1 && cell.record.len <= Log_record::MSG_MAX_LEN) {
+            pending.push_back(&cell);
+        }
+    }
+
+    std::sort(pending.begin(), pending.end(), [](const Cell *a, const Cell *b) { return (a->pos < b->pos); });
+    for (const Cell *cell : pending) {
+        replay(cell->record);
+    }
+
+    munmap(mem, st.st_size);
+    return (pending.size());
+}
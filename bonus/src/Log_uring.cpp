@@ -0,0 +1,298 @@
+#include "Log_uring.hpp"
+#include <cerrno>
+#include <cstring>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// io_uring has no glibc wrappers
+
+static int uringSetup(unsigned entries, struct io_uring_params *params) {
+    return ((int)syscall(SYS_io_uring_setup, entries, params));
+}
+
+static int uringEnter(int ringFd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+    return ((int)syscall(SYS_io_uring_enter, ringFd, toSubmit, minComplete, flags, NULL, 0));
+}
+
+static int uringRegister(int ringFd, unsigned opcode, const void *arg, unsigned count) {
+    return ((int)syscall(SYS_io_uring_register, ringFd, opcode, arg, count));
+}
+
+// (*) constructor & destructor
+
+Log_uring::Log_uring():
+    ringFd(-1),
+    fileFd(-1),
+    sqTail(nullptr),
+    sqMask(nullptr),
+    sqArray(nullptr),
+    sqes(nullptr),
+    cqHead(nullptr),
+    cqTail(nullptr),
+    cqMask(nullptr),
+    cqes(nullptr),
+    sqRing(MAP_FAILED),
+    sqRingSize(0),
+    cqRing(MAP_FAILED),
+    cqRingSize(0),
+    sqesSize(0),
+    buffers(nullptr),
+    bufferSize(0),
+    bufferCount(0),
+    current(0),
+    previous(0),
+    shortWrites(false) {
+    memset(this->lengths, 0, sizeof(this->lengths));
+    memset(this->written, 0, sizeof(this->written));
+    memset(this->inFlight, 0, sizeof(this->inFlight));
+}
+
+Log_uring::~Log_uring() {
+    this->drain();
+    this->teardown();
+}
+
+void Log_uring::teardown(void) {
+    if (this->sqes != nullptr) {
+        munmap(this->sqes, this->sqesSize);
+    }
+    if (this->cqRing != MAP_FAILED && this->cqRing != this->sqRing) {
+        munmap(this->cqRing, this->cqRingSize);
+    }
+    if (this->sqRing != MAP_FAILED) {
+        munmap(this->sqRing, this->sqRingSize);
+    }
+    if (this->ringFd >= 0) {
+        close(this->ringFd); // also unregisters the buffers and the file
+    }
+    if (this->buffers != nullptr) {
+        munmap(this->buffers, this->bufferSize * this->bufferCount);
+    }
+
+    this->ringFd = -1;
+    this->sqes = nullptr;
+    this->sqRing = MAP_FAILED;
+    this->cqRing = MAP_FAILED;
+    this->buffers = nullptr;
+}
+
+// (*) setup
+
+bool Log_uring::setup(int fd, size_t bufferSize, size_t bufferCount) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    bufferCount = (bufferCount < 2) ? 2 : (bufferCount > MAX_BUFFERS) ? MAX_BUFFERS : bufferCount;
+    this->ringFd = uringSetup((unsigned)bufferCount, &params);
+    if (this->ringFd < 0) {
+        return (false); // ENOSYS (old kernel), EPERM (kernel.io_uring_disabled), ...
+    }
+
+    // (*) the rings and the submission entries are shared with the kernel
+    this->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    this->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        this->sqRingSize = (this->cqRingSize > this->sqRingSize) ? this->cqRingSize : this->sqRingSize;
+    }
+
+    this->sqRing = mmap(nullptr, this->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->ringFd, IORING_OFF_SQ_RING);
+    if (this->sqRing != MAP_FAILED && (params.features & IORING_FEAT_SINGLE_MMAP)) {
+        this->cqRing = this->sqRing;
+    } else if (this->sqRing != MAP_FAILED) {
+        this->cqRing = mmap(nullptr, this->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->ringFd, IORING_OFF_CQ_RING);
+    }
+    this->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqes = mmap(nullptr, this->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->ringFd, IORING_OFF_SQES);
+    this->sqes = (sqes == MAP_FAILED) ? nullptr : static_cast<struct io_uring_sqe *>(sqes);
+
+    if (this->sqRing == MAP_FAILED || this->cqRing == MAP_FAILED || this->sqes == nullptr) {
+        int error = errno;
+        this->teardown();
+        errno = error;
+        return (false);
+    }
+
+    char *sq = static_cast<char *>(this->sqRing);
+    char *cq = static_cast<char *>(this->cqRing);
+    this->sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    this->sqMask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    this->sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    this->cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    this->cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    this->cqMask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    this->cqes = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+
+    // (*) registered buffers (pinned once, no per-write page walk) and registered file (no per-write fd lookup)
+    void *buffers = mmap(nullptr, bufferSize * bufferCount, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffers == MAP_FAILED) {
+        int error = errno;
+        this->teardown();
+        errno = error;
+        return (false);
+    }
+    this->buffers = static_cast<char *>(buffers);
+    this->bufferSize = bufferSize;
+    this->bufferCount = bufferCount;
+
+    struct iovec iov[MAX_BUFFERS];
+    for (size_t i = 0; i < bufferCount; ++i) {
+        iov[i].iov_base = this->buffers + i * bufferSize;
+        iov[i].iov_len = bufferSize;
+    }
+
+    if (uringRegister(this->ringFd, IORING_REGISTER_BUFFERS, iov, (unsigned)bufferCount) < 0
+        || uringRegister(this->ringFd, IORING_REGISTER_FILES, &fd, 1) < 0) {
+        int error = errno;
+        this->teardown();
+        errno = error;
+        return (false);
+    }
+
+    this->fileFd = fd;
+    this->current = 0;
+    this->previous = 0;
+    return (true);
+}
+
+bool Log_uring::active(void) const {
+    return (this->ringFd >= 0);
+}
+
+// (*) completions
+
+void Log_uring::reapCompletions(void) {
+    unsigned head = *this->cqHead;
+    unsigned tail = __atomic_load_n(this->cqTail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; ++head) {
+        const struct io_uring_cqe &cqe = this->cqes[head & *this->cqMask];
+        size_t index = (size_t)cqe.user_data;
+
+        // a short or failed write is finished before anything else is submitted (nothing was submitted after it)
+        this->written[index] = (cqe.res > 0) ? (size_t)cqe.res : 0;
+        if (this->written[index] < this->lengths[index]) {
+            this->shortWrites = true;
+        }
+        this->inFlight[index] = false;
+    }
+
+    __atomic_store_n(this->cqHead, head, __ATOMIC_RELEASE);
+}
+
+bool Log_uring::waitFor(size_t index) {
+    while (true) {
+        this->reapCompletions();
+        if (!this->inFlight[index]) {
+            return (true);
+        }
+        if (uringEnter(this->ringFd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+            return (false);
+        }
+    }
+}
+
+bool Log_uring::finishShortWrites(void) {
+    if (!this->shortWrites) {
+        return (true);
+    }
+
+    for (size_t i = 0; i < this->bufferCount; ++i) {
+        if (!this->waitFor(i)) {
+            return (false);
+        }
+    }
+
+    // only the last one submitted can be short: the ones before it were finished before it went
+    for (size_t index = 0; index < this->bufferCount; ++index) {
+        while (this->written[index] < this->lengths[index]) {
+            ssize_t ret = write(this->fileFd, this->buffers + index * this->bufferSize + this->written[index],
+                this->lengths[index] - this->written[index]);
+            if (ret <= 0) {
+                if (ret < 0 && errno == EINTR) {
+                    continue;
+                }
+                return (false);
+            }
+            this->written[index] += (size_t)ret;
+        }
+    }
+    this->shortWrites = false;
+    return (true);
+}
+
+// (*) submissions
+
+char *Log_uring::acquire(void) {
+    // free buffers are reclaimed without a syscall, only a buffer still being written is waited for
+    if (!this->waitFor(this->current) || !this->finishShortWrites()) {
+        return (nullptr);
+    }
+    return (this->buffers + this->current * this->bufferSize);
+}
+
+bool Log_uring::submit(size_t len) {
+    // a write submitted behind a running one would land before the rest of it if that one comes back short: it only
+    // goes once the previous write completed (usually already: the batch was being filled meanwhile) and was finished
+    if (!this->waitFor(this->previous) || !this->finishShortWrites()) {
+        return (false);
+    }
+
+    unsigned tail = *this->sqTail;
+    unsigned slot = tail & *this->sqMask;
+    struct io_uring_sqe *sqe = &this->sqes[slot];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITE_FIXED;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->fd = 0; // index in the registered files
+    sqe->off = 0; // the fd is O_APPEND: the kernel appends whatever the offset
+    sqe->addr = (uint64_t)(uintptr_t)(this->buffers + this->current * this->bufferSize);
+    sqe->len = (uint32_t)len;
+    sqe->buf_index = (uint16_t)this->current;
+    sqe->user_data = this->current;
+    this->sqArray[slot] = slot;
+    __atomic_store_n(this->sqTail, tail + 1, __ATOMIC_RELEASE);
+
+    this->lengths[this->current] = len;
+    this->written[this->current] = 0;
+    this->inFlight[this->current] = true;
+    this->previous = this->current;
+    this->current = (this->current + 1) % this->bufferCount;
+
+    while (uringEnter(this->ringFd, 1, 0, 0) < 0) {
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            return (false);
+        }
+        // EAGAIN/EBUSY: the completion ring is full, make room and retry
+        this->reapCompletions();
+    }
+    return (true);
+}
+
+bool Log_uring::drain(void) {
+    if (!this->active()) {
+        return (true);
+    }
+
+    for (size_t i = 0; i < this->bufferCount; ++i) {
+        if (!this->waitFor(i)) {
+            return (false);
+        }
+    }
+    return (this->finishShortWrites());
+}
+
+bool Log_uring::updateFile(void) {
+    if (!this->drain()) {
+        return (false);
+    }
+
+    struct io_uring_files_update update;
+    memset(&update, 0, sizeof(update));
+    update.offset = 0;
+    update.fds = (uint64_t)(uintptr_t)&this->fileFd;
+    return (uringRegister(this->ringFd, IORING_REGISTER_FILES_UPDATE, &update, 1) >= 0);
+}
@@ -6,20 +6,37 @@
 #include <netdb.h>
 #include <cstdio>
 #include <cstdlib>
+#include <ctime>
 #include <sys/socket.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/file.h>
+#include <sys/resource.h>
 #include <algorithm>
 #include <sys/wait.h>
 #include "AES.hpp"
 
 std::atomic<int> Matt_daemon::receivedSignal = 0;
 std::atomic<int> Matt_daemon::quitRequested = 0;
+std::atomic<int> Matt_daemon::reopenRequested = 0;
+
+static int64_t monotonicMs(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    return ((int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000);
+}
 
 // (*) constructor & destructor
 
-Matt_daemon::Matt_daemon(const Tintin_reporter &tintin_reporter): lockFd(-1), listenFd(-1), tintin_reporter(tintin_reporter) {}
+Matt_daemon::Matt_daemon(const Tintin_reporter &tintin_reporter, const Options &options):
+    lockFd(-1),
+    listenFd(-1),
+    options(options),
+    clients(options.maxClients),
+    bufferPool(BUFFER_SIZE, std::min(options.maxClients, POOLED_BUFFERS_MAX), POOLED_BUFFER_CAPACITY_MAX),
+    timers(TIMER_TICK_MS, monotonicMs()),
+    tintin_reporter(tintin_reporter) {}
 
 Matt_daemon::~Matt_daemon() {}
 
@@ -27,7 +44,11 @@ Matt_daemon::~Matt_daemon() {}
 // (*) public interface
 
 Matt_daemon &Matt_daemon::getMattDaemon(const Tintin_reporter &tintin_reporter) {
-    static Matt_daemon matt_daemon(tintin_reporter);
+    return (Matt_daemon::getMattDaemon(tintin_reporter, Options()));
+}
+
+Matt_daemon &Matt_daemon::getMattDaemon(const Tintin_reporter &tintin_reporter, const Options &options) {
+    static Matt_daemon matt_daemon(tintin_reporter, options);
 
     return (matt_daemon);
 }
@@ -38,20 +59,29 @@ Matt_daemon::Client::~Client() {
 
 void Matt_daemon::start(void) {
     this->createLockFile(); // locking the lock file (to ensure we always have only one running daemon)
+    this->tintin_reporter.recoverRing(); // records a crashed run didn't write go first (the lock guarantees the ring file is ours)
     this->tintin_reporter.log(Tintin_reporter::INFO, "Started");
     this->daemonize(); // creating a daemon process (fully detached from terminal)
+    this->tintin_reporter.startBackground(); // the logger threads (if any) must be created by the daemon process itself
     this->setupSignals(); // handling signals
     this->tintin_reporter.log(Tintin_reporter::INFO, "Creating server");
     this->createServer(); // create the server
     this->tintin_reporter.log(Tintin_reporter::INFO, "Server created");
     this->tintin_reporter.log(Tintin_reporter::INFO, "Entering Daemon mode");
 
-    char buffer[32];
-    snprintf(buffer, 32, "started. PID: %d", getpid());
-    this->tintin_reporter.log(Tintin_reporter::INFO, buffer);
+    this->tintin_reporter.log<Tintin_reporter::INFO>(TINTIN_FMT("started. PID: {}"), getpid());
 
+    // the key derivations (PBKDF2) and the shells run on the loop: a slow one holds every client back
+    if (this->options.stallThresholdMs > 0
+        && !Stall_watchdog::start(this->tintin_reporter, this->options.stallThresholdMs, this->options.stallBacktrace)) {
+        this->tintin_reporter.log(Tintin_reporter::ERROR, "failure to start the stall watchdog thread");
+    }
+    Stall_watchdog::watch("event loop");
     this->eventLoop(); // event loop
+    Stall_watchdog::leave();
+    Stall_watchdog::stop();
     this->cleanup(); // cleanup
+    this->tintin_reporter.stopAsync(); // flushes pending records (and reports the writer stats) before the last one
     this->tintin_reporter.log(Tintin_reporter::INFO, "Quitting");
 }
 
@@ -67,7 +97,7 @@ void Matt_daemon::daemonize(void) const {
     }
 
     if (pid > 0) {
-        exit(EXIT_SUCCESS); // parent job done!
+        _exit(EXIT_SUCCESS); // parent job done! (no static destructors: the logger belongs to the daemon now)
     }
 
     // child process is not a process group leader (the parent was) => we can run setsid()
@@ -91,7 +121,7 @@ void Matt_daemon::daemonize(void) const {
     }
 
     if (pid > 0) {
-        exit(EXIT_SUCCESS); // parent job done!
+        _exit(EXIT_SUCCESS); // parent job done! (no static destructors: the logger belongs to the daemon now)
     }
 
     // closing all inherited file descriptors (except 0, 1, 2 and this->lockFd)
@@ -143,6 +173,11 @@ void Matt_daemon::signalHandler(int sig) {
     Matt_daemon::receivedSignal = sig;
 }
 
+void Matt_daemon::reopenHandler(int sig) {
+    (void)sig;
+    Matt_daemon::reopenRequested = 1;
+}
+
 void Matt_daemon::setupSignals() const {
     struct sigaction sa{};
     sa.sa_handler = Matt_daemon::signalHandler;
@@ -151,7 +186,13 @@ void Matt_daemon::setupSignals() const {
 
     sigaction(SIGTERM, &sa, nullptr);
     sigaction(SIGINT,  &sa, nullptr);
-    sigaction(SIGHUP,  &sa, nullptr);
+
+    // SIGHUP rotates (or reopens) the log file instead of quitting
+    struct sigaction hup{};
+    hup.sa_handler = Matt_daemon::reopenHandler;
+    sigemptyset(&hup.sa_mask);
+    hup.sa_flags = 0;
+    sigaction(SIGHUP,  &hup, nullptr);
 
     signal(SIGPIPE, SIG_IGN);
 }
@@ -165,9 +206,9 @@ void Matt_daemon::cleanup(void) {
     }
 
     // closing clients sockets
-    for (const Client &client : clients) {
+    this->clients.forEach([](Slot_map<Client>::Handle, Client &client) {
         close(client.fd);
-    }
+    });
 }
 
 void Matt_daemon::createServer(void) {
@@ -186,8 +227,24 @@ void Matt_daemon::createServer(void) {
         exit(EXIT_FAILURE);
     }
 
-    // creating a TCP socket (to listen on connection requests)
-    this->listenFd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (!this->reactor.open()) {
+        this->tintin_reporter.log(Tintin_reporter::ERROR, "ERROR creating server (epoll failure)");
+        this->tintin_reporter.log(Tintin_reporter::INFO, "Quitting");
+        exit(EXIT_FAILURE);
+    }
+
+    // tens of thousands of clients need as many fds (the soft limit is usually 1024)
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < this->options.maxClients + RESERVED_FDS) {
+        limit.rlim_cur = std::min<rlim_t>(limit.rlim_max, this->options.maxClients + RESERVED_FDS);
+        if (setrlimit(RLIMIT_NOFILE, &limit) < 0 || limit.rlim_cur < this->options.maxClients + RESERVED_FDS) {
+            this->tintin_reporter.log<Tintin_reporter::ERROR>(TINTIN_FMT("fd limit too low for {} clients (RLIMIT_NOFILE {})"),
+                this->options.maxClients, (uint64_t)limit.rlim_cur);
+        }
+    }
+
+    // creating a TCP socket (to listen on connection requests), non-blocking: acceptClients() accepts until EAGAIN
+    this->listenFd = socket(res->ai_family, res->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, res->ai_protocol);
 
     if (this->listenFd < 0) {
         this->tintin_reporter.log(Tintin_reporter::ERROR, "ERROR creating server (socket creation failure)");
@@ -205,169 +262,264 @@ void Matt_daemon::createServer(void) {
         exit(EXIT_FAILURE);
     }
 
-    if (listen(this->listenFd, Matt_daemon::MAX_CLIENTS) < 0) {
+    // the connection limit is enforced by acceptClients(), the backlog only absorbs bursts
+    if (listen(this->listenFd, SOMAXCONN) < 0) {
         this->tintin_reporter.log(Tintin_reporter::ERROR, "ERROR creating server (listen failure)");
         this->tintin_reporter.log(Tintin_reporter::INFO, "Quitting");
         exit(EXIT_FAILURE);
     }
 
+    if (!this->reactor.watch(this->listenFd, Reactor::LISTENER, this->listenFd)) {
+        this->tintin_reporter.log(Tintin_reporter::ERROR, "ERROR creating server (epoll registration failure)");
+        this->tintin_reporter.log(Tintin_reporter::INFO, "Quitting");
+        exit(EXIT_FAILURE);
+    }
+
     freeaddrinfo(res);
 }
 
 void Matt_daemon::eventLoop(void) {
     while (Matt_daemon::receivedSignal == 0 && Matt_daemon::quitRequested == 0) {
-        fd_set readfds;
-        FD_ZERO(&readfds);
+        if (Matt_daemon::reopenRequested.exchange(0)) {
+            Stall_watchdog::enter("reopen", -1);
+            this->tintin_reporter.reopen();
+        }
 
-        FD_SET(listenFd, &readfds);
-        int maxFd = listenFd;
+        long timeout = this->pollTimeout();
+        Stall_watchdog::idle();
+        int ready = this->reactor.wait(timeout);
+        Stall_watchdog::begin(monotonicMs());
 
-        for (const Client &client : clients) {
-            FD_SET(client.fd, &readfds);
-            if (client.fd > maxFd) {
-                maxFd = client.fd;
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue;
             }
-            if (client.shell) {
-                FD_SET(client.shell->master_fd, &readfds);
-                if (client.shell->master_fd > maxFd) {
-                    maxFd = client.shell->master_fd;
+
+            // if epoll_wait failed and it wasn't interrupted we report the error and break the event loop
+            this->tintin_reporter.log(Tintin_reporter::ERROR, "epoll_wait failure");
+            break;
+        }
+
+        // only the fds that became ready, whatever the number of connected clients
+        for (int i = 0; i < ready && Matt_daemon::receivedSignal == 0 && Matt_daemon::quitRequested == 0; ++i) {
+            const struct epoll_event &event = this->reactor.event(i);
+
+            if (Reactor::kindOf(event) == Reactor::LISTENER) {
+                Stall_watchdog::enter("accept", -1);
+                this->acceptClients();
+                continue;
+            }
+
+            // a stale handle (the client was closed earlier in this batch) finds nothing, even if its slot was reused
+            Client *client = this->clients.get(Reactor::idOf(event));
+            if (client == nullptr) {
+                continue;
+            }
+
+            Stall_watchdog::enter(Reactor::kindOf(event) == Reactor::SHELL ? "shell output" : "client", client->fd);
+            if (Reactor::kindOf(event) == Reactor::SHELL) {
+                if (client->shell != nullptr) {
+                    this->readShell(*client);
                 }
+            } else if (!this->readClient(*client)) {
+                this->closeClient(client->id);
+                continue;
             }
+            this->watchShell(*client);
+        }
+        Stall_watchdog::enter("timers", -1);
+        this->runTimers();
+    }
+
+    // reporting daemon exit reason
+
+    if (Matt_daemon::quitRequested) {
+        this->tintin_reporter.log(Tintin_reporter::INFO, "Request quit");
+    } else if (Matt_daemon::receivedSignal) {
+        this->tintin_reporter.log(Tintin_reporter::INFO, "Signal handler");
+    }
+}
+
+long Matt_daemon::pollTimeout(void) {
+    // a pending "last message repeated" count bounds how long we may sleep, so does the next deadline
+    long repeats = this->tintin_reporter.flushRepeats();
+    long timers = this->timers.nextTimeout(monotonicMs());
+
+    if (repeats < 0 || timers < 0) {
+        return (std::max(repeats, timers));
+    }
+    return (std::min(repeats, timers));
+}
+
+void Matt_daemon::runTimers(void) {
+    Timer_wheel::Expired expired;
+    int64_t nowMs = monotonicMs();
+
+    while (this->timers.expireNext(nowMs, &expired)) {
+        // a half-open or silent connection would hold its slot forever
+        Client *client = this->clients.get(Reactor::idOf(expired.data));
+        if (client != nullptr && client->session_key.empty()) {
+            client->handshakeTimer = 0;
+            this->tintin_reporter.log<Tintin_reporter::INFO>(TINTIN_FMT("client disconnected: no key exchange within {} s"),
+                HANDSHAKE_TIMEOUT_MS / 1000);
+            this->closeClient(client->id);
         }
+    }
+}
 
-        int ready = select(maxFd + 1, &readfds, NULL, NULL, NULL);
+void Matt_daemon::acceptClients(void) {
+    while (true) {
+        int clientFd = accept4(this->listenFd, NULL, NULL, SOCK_CLOEXEC);
 
-        if (ready <= 0) {
-            if (ready == 0 || errno == EINTR) {
+        if (clientFd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
                 continue;
             }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                this->tintin_reporter.log(Tintin_reporter::ERROR, "accept failure");
+            }
+            return;
+        }
 
-            // if select failed and it wasn't interrupted we report the error and break the event loop
-            this->tintin_reporter.log(Tintin_reporter::ERROR, "select failure");
-            break;
+        Slot_map<Client>::Handle handle = this->clients.insert(clientFd, this->bufferPool.acquire());
+        if (handle == 0) {
+            close(clientFd); // connection limit reached
+            continue;
         }
 
-        // checking new connection requests
-        if (FD_ISSET(this->listenFd, &readfds)) {
-            int clientFd = accept(this->listenFd, NULL, NULL);
+        this->clients.get(handle)->id = handle;
+        this->clients.get(handle)->handshakeTimer = this->timers.arm(monotonicMs(), HANDSHAKE_TIMEOUT_MS, Reactor::token(Reactor::CLIENT, handle));
+        if (!this->reactor.watch(clientFd, Reactor::CLIENT, handle)) {
+            this->closeClient(handle);
+        }
+    }
+}
 
-            if (clientFd < 0) {
-                if (errno != EINTR) {
-                    this->tintin_reporter.log(Tintin_reporter::ERROR, "accept failure");
-                }
-            }
+bool Matt_daemon::readClient(Client &client) {
+    // edge-triggered: the socket has to be drained, what is left behind wouldn't be reported again
+    while (Matt_daemon::receivedSignal == 0 && Matt_daemon::quitRequested == 0) {
+        char buffer[1024];
+        ssize_t bytes = recv(client.fd, buffer, sizeof(buffer), MSG_DONTWAIT); // the socket stays blocking for the responses
 
-            if (this->clients.size() >= MAX_CLIENTS) {
-                close(clientFd);
-            } else if (clientFd >= 0) {
-                this->clients.emplace_back(clientFd);
+        if (bytes < 0) {
+            if (errno == EINTR) {
+                continue;
             }
+            return (errno == EAGAIN || errno == EWOULDBLOCK);
         }
 
-        // handle clients activity
-        for (size_t i = 0; i < this->clients.size(); ) {
-            Client &client = this->clients[i];
-            
-            if (FD_ISSET(client.fd, &readfds)) {
-                char buffer[1024];
-                ssize_t bytes = read(client.fd, buffer, sizeof(buffer));
-
-                // if read was interrupted break 
-                if (bytes < 0 && errno == EINTR) {
-                    break;
-                }
-
-                // if client was diconnected or read failed, close client socket and erase client from clients vector
-                if (bytes <= 0) {
-                    close(client.fd);
-                    this->clients.erase(this->clients.begin() + i);
-                    continue;
-                }
+        // the client disconnected
+        if (bytes == 0) {
+            return (false);
+        }
 
-                // append received bytes to the client's buffer, then extract and process each line
-                client.buffer.insert(client.buffer.end(), buffer, buffer + bytes);
-
-                    
-                // get the RSA public key from the client to establish a secure session
-                if (client.session_key.empty()) {
-                    // we expect a string not row bytes so it is safe to convert buffer to string
-                    std::string string_buffer(buffer, bytes);
-                    size_t pos = string_buffer.find("-----END PUBLIC KEY-----");
-                    if (pos != std::string::npos) {
-                        std::string rsa_public_key = string_buffer.substr(0, pos + strlen("-----END PUBLIC KEY-----"));
-                        client.buffer.clear();
-    
-                        this->createSecureSessionKey(client, rsa_public_key);
-                    }
-                } else {
-                    // session is established
-
-                    // read size header
-                    if (client.size == 0) {
-                        std::string string_buffer((char *)client.buffer.data(), client.buffer.size());
-
-                        size_t pos = string_buffer.find('\n');
-                        if (pos != std::string::npos) {
-                            std::string line = string_buffer.substr(0, pos);
-                            client.size = std::stoul(line);
-
-                            // remove the size header from the client buffer, the rest is the remaining bytes consumed by read
-                            client.buffer.erase(client.buffer.begin(), client.buffer.begin() + pos + 1);
-                            bytes -= pos + 1;
-                        }
-                    }
-                    
-                    // continue reading if size != 0
-                    if (client.size != 0 and client.buffer.size() >= client.size) {
-                        this->handleMessage(client);
-                        client.buffer.erase(client.buffer.begin(), client.buffer.begin() + client.size);
-                        client.size = 0;
-                    }
-                }
-                // }
+        // append received bytes to the client's buffer, then extract and process each line
+        client.buffer.insert(client.buffer.end(), buffer, buffer + bytes);
+
+        // get the RSA public key from the client to establish a secure session
+        if (client.session_key.empty()) {
+            // we expect a string not row bytes so it is safe to convert buffer to string
+            std::string string_buffer(buffer, bytes);
+            size_t pos = string_buffer.find("-----END PUBLIC KEY-----");
+            if (pos != std::string::npos) {
+                std::string rsa_public_key = string_buffer.substr(0, pos + strlen("-----END PUBLIC KEY-----"));
+                client.buffer.clear();
+
+                this->createSecureSessionKey(client, rsa_public_key);
+                this->timers.cancel(client.handshakeTimer);
+                client.handshakeTimer = 0;
             }
+        } else {
+            // session is established
+
+            // read size header
+            if (client.size == 0) {
+                std::string string_buffer((char *)client.buffer.data(), client.buffer.size());
+
+                size_t pos = string_buffer.find('\n');
+                if (pos != std::string::npos) {
+                    std::string line = string_buffer.substr(0, pos);
+                    client.size = std::stoul(line);
 
-            if (client.shell && FD_ISSET(client.shell->master_fd, &readfds)) {
-                char buffer[1024];
-                ssize_t bytes = read(client.shell->master_fd, buffer, sizeof(buffer));
-                if (bytes <= 0) {
-
-                    auto shell_start = aes::encrypt(std::string("__SHELL_END__"), client.session_key);
-                    std::string size = std::to_string(shell_start.size()) + "\n";
-                    send(client.fd, size.c_str(), size.size(), 0);
-                    send(client.fd, shell_start.data(), shell_start.size(), 0);
-
-                    delete client.shell;
-                    client.shell = nullptr;
-                } else {
-                    auto res = aes::encrypt(std::string(buffer, bytes), client.session_key);
-                    
-                    //Send data = size header + data
-                    std::string size = std::to_string(res.size()) + "\n";
-                    send(client.fd, size.c_str(), size.size(), 0);
-                    send(client.fd, res.data(), res.size(), 0);
+                    // remove the size header from the client buffer, the rest is the remaining bytes consumed by read
+                    client.buffer.erase(client.buffer.begin(), client.buffer.begin() + pos + 1);
                 }
             }
-            if (Matt_daemon::receivedSignal || Matt_daemon::quitRequested) {
-                break;
+
+            // continue reading if size != 0
+            if (client.size != 0 and client.buffer.size() >= client.size) {
+                this->handleMessage(client);
+                client.buffer.erase(client.buffer.begin(), client.buffer.begin() + client.size);
+                client.size = 0;
             }
+        }
+    }
+    return (true);
+}
+
+void Matt_daemon::readShell(Client &client) {
+    while (true) {
+        char buffer[1024];
+        ssize_t bytes = read(client.shell->master_fd, buffer, sizeof(buffer));
+
+        if (bytes < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+
+        if (bytes <= 0) {
+            auto shell_start = aes::encrypt(std::string("__SHELL_END__"), client.session_key);
+            std::string size = std::to_string(shell_start.size()) + "\n";
+            send(client.fd, size.c_str(), size.size(), 0);
+            send(client.fd, shell_start.data(), shell_start.size(), 0);
 
-            i += 1;
+            delete client.shell; // closing master_fd also removes it from the epoll set
+            client.shell = nullptr;
+            return;
         }
+
+        const char *phase = Stall_watchdog::enter("encrypt");
+        auto res = aes::encrypt(std::string(buffer, bytes), client.session_key);
+        Stall_watchdog::enter(phase);
+
+        //Send data = size header + data
+        std::string size = std::to_string(res.size()) + "\n";
+        send(client.fd, size.c_str(), size.size(), 0);
+        send(client.fd, res.data(), res.size(), 0);
     }
+}
 
-    // reporting daemon exit reason
+void Matt_daemon::watchShell(Client &client) {
+    if (client.shell == nullptr || client.shell->watched) {
+        return;
+    }
 
-    if (Matt_daemon::quitRequested) {
-        this->tintin_reporter.log(Tintin_reporter::INFO, "Request quit");
-    } else if (Matt_daemon::receivedSignal) {
-        this->tintin_reporter.log(Tintin_reporter::INFO, "Signal handler");
+    // non-blocking so readShell() can drain it, its events carry the client's fd
+    fcntl(client.shell->master_fd, F_SETFL, fcntl(client.shell->master_fd, F_GETFL) | O_NONBLOCK);
+    if (!this->reactor.watch(client.shell->master_fd, Reactor::SHELL, client.id)) {
+        this->tintin_reporter.log(Tintin_reporter::ERROR, "failure to watch the shell output");
+    }
+    client.shell->watched = true;
+}
+
+void Matt_daemon::closeClient(Slot_map<Client>::Handle handle) {
+    Client *client = this->clients.get(handle);
+
+    close(client->fd); // also removes it from the epoll set (the shell's master_fd is closed by the Client destructor)
+    if (client->handshakeTimer != 0) {
+        this->timers.cancel(client->handshakeTimer);
     }
+    this->bufferPool.release(std::move(client->buffer));
+    this->clients.remove(handle);
 }
 
 void Matt_daemon::handleMessage(Client &client) const {
     std::vector<unsigned char> send_data(client.buffer.begin(), client.buffer.begin() + client.size);
+    const char *phase = Stall_watchdog::enter("decrypt"); // PBKDF2: 100k iterations per message
     send_data = aes::decrypt(send_data, client.session_key);
+    Stall_watchdog::enter(phase);
 
     //! Assuming that the client always send data that has non zero bytes
     std::string line = std::string(send_data.begin(), send_data.end());
@@ -377,7 +529,9 @@ void Matt_daemon::handleMessage(Client &client) const {
         
         
         int status;
+        Stall_watchdog::enter("waitpid");
         pid_t result = waitpid(client.shell->pid, &status, WNOHANG);
+        Stall_watchdog::enter(phase);
     
         if (result == client.shell->pid)
         {
@@ -417,8 +571,7 @@ void Matt_daemon::handleMessage(Client &client) const {
                 client.msg.clear();
                 return;
             } else {
-                std::string userMessage = "User input: " + msg;
-                this->tintin_reporter.log(Tintin_reporter::LOG, userMessage.c_str());
+                this->tintin_reporter.log<Tintin_reporter::LOG>(TINTIN_FMT("User input: {}"), msg);
 
             }
             client.msg.erase(0, pos + 1);
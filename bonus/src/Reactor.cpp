@@ -0,0 +1,61 @@
+#include "Reactor.hpp"
+#include <unistd.h>
+
+// (*) constructor & destructor
+
+Reactor::Reactor(): epollFd(-1) {}
+
+Reactor::~Reactor() {
+    if (this->epollFd >= 0) {
+        close(this->epollFd);
+    }
+}
+
+// (*) public interface
+
+bool Reactor::open(void) {
+    if (this->epollFd < 0) {
+        this->epollFd = epoll_create1(EPOLL_CLOEXEC);
+    }
+    return (this->epollFd >= 0);
+}
+
+bool Reactor::watch(int fd, Kind kind, uint64_t id) {
+    struct epoll_event event;
+
+    event.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+    event.data.u64 = Reactor::token(kind, id);
+    return (epoll_ctl(this->epollFd, EPOLL_CTL_ADD, fd, &event) == 0);
+}
+
+void Reactor::unwatch(int fd) {
+    epoll_ctl(this->epollFd, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+int Reactor::wait(long timeoutMs) {
+    return (epoll_wait(this->epollFd, this->ready, MAX_EVENTS, (timeoutMs < 0) ? -1 : (int)timeoutMs));
+}
+
+const struct epoll_event &Reactor::event(int index) const {
+    return (this->ready[index]);
+}
+
+uint64_t Reactor::token(Kind kind, uint64_t id) {
+    return (((uint64_t)kind << 56) | (id & ID_MASK));
+}
+
+Reactor::Kind Reactor::kindOf(uint64_t token) {
+    return ((Kind)(token >> 56));
+}
+
+uint64_t Reactor::idOf(uint64_t token) {
+    return (token & ID_MASK);
+}
+
+Reactor::Kind Reactor::kindOf(const struct epoll_event &event) {
+    return (Reactor::kindOf(event.data.u64));
+}
+
+uint64_t Reactor::idOf(const struct epoll_event &event) {
+    return (Reactor::idOf(event.data.u64));
+}
@@ -11,7 +11,7 @@
 # define MARKER "__END__"
 
 
-Shell::Shell() {
+Shell::Shell(): watched(false) {
     signal(SIGPIPE, SIG_IGN);
 
     pid = forkpty(&master_fd, nullptr, nullptr, nullptr);
@@ -0,0 +1,81 @@
+#include "Timestamp_cache.hpp"
+#include <cstring>
+
+// (*) constructor
+
+Timestamp_cache::Timestamp_cache(): seq(0), second(-1) {
+    for (size_t i = 0; i < WORDS; ++i) {
+        this->words[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+// (*) private helpers
+
+size_t Timestamp_cache::formatSeconds(char *out, time_t t) {
+    struct tm tmp;
+
+    localtime_r(&t, &tmp);
+
+    return (strftime(out, MAX_LEN, FORMAT, &tmp)); // guarantees buffer null termination if size > 0
+}
+
+// (*) public interface
+
+void Timestamp_cache::now(struct timespec *ts) {
+    clock_gettime(CLOCK_REALTIME_COARSE, ts);
+}
+
+size_t Timestamp_cache::format(char *out, const struct timespec &ts, Precision precision) {
+    uint64_t local[WORDS];
+    size_t len = 0;
+
+    // (*) fast path: the slot already holds this second (retry only if a writer was in the middle of an update)
+    for (int attempt = 0; attempt < 2 && len == 0; ++attempt) {
+        uint32_t before = this->seq.load(std::memory_order_acquire);
+        if ((before & 1) != 0 || this->second.load(std::memory_order_relaxed) != (int64_t)ts.tv_sec) {
+            break;
+        }
+        for (size_t i = 0; i < WORDS; ++i) {
+            local[i] = this->words[i].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (this->seq.load(std::memory_order_relaxed) == before) {
+            memcpy(out, local, SECONDS_LEN);
+            len = SECONDS_LEN;
+        }
+    }
+
+    // (*) slow path: format it, then publish it unless another writer holds the slot or it's an older second
+    if (len == 0) {
+        len = Timestamp_cache::formatSeconds(out, ts.tv_sec);
+
+        uint32_t current = this->seq.load(std::memory_order_relaxed);
+        if (len == SECONDS_LEN && (current & 1) == 0 && (int64_t)ts.tv_sec > this->second.load(std::memory_order_relaxed)
+            && this->seq.compare_exchange_strong(current, current + 1, std::memory_order_acquire)) {
+            memset(local, 0, sizeof(local));
+            memcpy(local, out, SECONDS_LEN);
+            std::atomic_thread_fence(std::memory_order_release);
+            this->second.store(ts.tv_sec, std::memory_order_relaxed);
+            for (size_t i = 0; i < WORDS; ++i) {
+                this->words[i].store(local[i], std::memory_order_relaxed);
+            }
+            this->seq.store(current + 2, std::memory_order_release);
+        }
+    }
+
+    // (*) sub-second field (integer formatting only)
+    if (precision != SECONDS) {
+        long fraction = (precision == MILLISECONDS) ? ts.tv_nsec / 1000000 : ts.tv_nsec / 1000;
+        size_t digits = (precision == MILLISECONDS) ? 3 : 6;
+
+        out[len++] = '.';
+        for (size_t i = digits; i > 0; --i) {
+            out[len + i - 1] = (char)('0' + fraction % 10);
+            fraction /= 10;
+        }
+        len += digits;
+    }
+
+    out[len] = '\0';
+    return (len);
+}
@@ -1,4 +1,6 @@
 #include "Tintin_reporter.hpp"
+#include "Stall_watchdog.hpp"
+#include <algorithm>
 #include <cerrno>
 #include <cstdio>
 #include <cstdlib>
@@ -10,25 +12,93 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <libgen.h> 
+#include <chrono>
+#include <climits>
+#include <system_error>
 
 // (*) constructor & destructor
-Tintin_reporter::Tintin_reporter(const char *logFilePath) {
+Tintin_reporter::Tintin_reporter(const char *logFilePath, const Options &options):
+    options(options),
+    ring(options.async ? options.ringCapacity : 0),
+    writerRunning(false),
+    writerStopping(false),
+    writerIdle(false),
+    dropped(0),
+    droppedReported(0),
+    fileGeneration(0),
+    uringGeneration(0),
+    lastSuppressReportMs(Tintin_reporter::nowMs()),
+    lastHash(0),
+    repeats(0),
+    repeatsSinceMs(0),
+    recordsWritten(0),
+    writeCalls(0),
+    syncCalls(0),
+    unsynced(false),
+    lastSyncMs(Tintin_reporter::nowMs()),
+    fileBytes(0),
+    lastRotation(time(NULL)),
+    rotateRetry(0),
+    rotationArmed(false) {
     ensureDirExists(logFilePath);
+    snprintf(this->logFilePath, sizeof(this->logFilePath), "%s", logFilePath);
 
-    this->fd = open(logFilePath, O_WRONLY | O_CREAT | O_APPEND, 0644); // O_APPEND gives write atomicity (in multithreading)
+    for (int type = LOG; type <= ERROR; ++type) {
+        this->filterStates[type].tat = 0;
+        this->filterStates[type].sampleCounter = 0;
+        this->filterStates[type].suppressed = 0;
+        this->setFilter((LogType)type, this->options.filters[type]);
+    }
+
+    if (this->options.async) {
+        size_t batchMax = this->options.batchMaxRecords;
+        batchMax = (batchMax == 0) ? 1 : (batchMax > IOV_MAX) ? IOV_MAX : batchMax;
+        this->batchBuffer.resize(batchMax * LOG_MAX_LEN);
+        this->batchIov.resize(batchMax);
+        this->batchCells.resize(batchMax);
+    }
+
+    this->fd = this->openLogFile();
 
     if (this->fd < 0) {
         printf("cannot open lock file!\n");
         throw std::runtime_error("failure to open the log file"); 
     }
+
+    if (this->options.sink == SINK_MMAP) {
+        try {
+            this->mmapLog.attach(this->fd, this->options.segmentSize);
+        } catch (const std::runtime_error &e) {
+            printf("cannot map the log file: %s\n", e.what());
+            close(this->fd);
+            throw;
+        }
+        this->fileBytes = this->mmapLog.size();
+    } else {
+        struct stat st;
+        this->fileBytes = (fstat(this->fd, &st) == 0) ? st.st_size : 0;
+    }
 }
 
 Tintin_reporter::~Tintin_reporter() {
+    if (this->writer.joinable() && this->writer.get_id() == std::this_thread::get_id()) {
+        this->writer.detach(); // exit() called from the writer itself (write failure), it can't join itself
+    } else {
+        this->stopAsync();
+    }
+    this->mmapLog.detach(); // no-op unless SINK_MMAP
     close(this->fd);
 }
 
 // (*) private helpers
 
+int Tintin_reporter::openLogFile(void) const {
+    if (this->options.sink == SINK_MMAP) {
+        return (open(this->logFilePath, O_RDWR | O_CREAT, 0644)); // shared mappings need read access, Mmap_log serializes the appends itself
+    }
+    return (open(this->logFilePath, O_WRONLY | O_CREAT | O_APPEND, 0644)); // O_APPEND gives write atomicity (in multithreading)
+}
+
 void Tintin_reporter::ensureDirExists(const char *path) {
     char *pathCopy = strdup(path);
     const char *dir = dirname(pathCopy);
@@ -49,17 +119,17 @@ void Tintin_reporter::ensureDirExists(const char *path) {
     free(pathCopy);
 }
 
-void Tintin_reporter::getTimestamp(char *buff) {
-    time_t t;
-    struct tm tmp;
-
-    t = time(NULL);
-    localtime_r(&t, &tmp);
+void Tintin_reporter::logger(const char *log, size_t len) const {
+    this->maybeRotate(len);
+    this->fileBytes.fetch_add(len, std::memory_order_relaxed);
 
-    strftime(buff, TIMESTAMP_MAX_LEN, TIMESTAMP_FORMAT, &tmp); // guarantees buffer null termination if size > 0
-}
+    if (this->options.sink == SINK_MMAP) {
+        this->mmapLog.append(log, len);
+        this->recordsWritten.fetch_add(1, std::memory_order_relaxed);
+        this->unsynced.store(true, std::memory_order_relaxed);
+        return;
+    }
 
-void Tintin_reporter::logger(const char *log, size_t len) const {
     size_t totalWritten = 0;
 
     // ensure the whole message is written into the log file
@@ -72,27 +142,572 @@ void Tintin_reporter::logger(const char *log, size_t len) const {
             }
             exit(EXIT_FAILURE);
         }
+        this->writeCalls.fetch_add(1, std::memory_order_relaxed);
         totalWritten += ret;
     }
+    this->recordsWritten.fetch_add(1, std::memory_order_relaxed);
+    this->unsynced.store(true, std::memory_order_relaxed);
 }
 
-const char  *Tintin_reporter::getLogTypeStr(LogType type) {
-    switch (type) {
-        case LOG:
-            return "LOG";
-        case ERROR:
-            return "ERROR";
+void Tintin_reporter::writeBatch(struct iovec *iov, size_t count) const {
+    size_t records = count;
+    size_t bytes = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        bytes += iov[i].iov_len;
+    }
+    this->maybeRotate(bytes);
+    this->fileBytes.fetch_add(bytes, std::memory_order_relaxed);
+
+    if (this->options.sink == SINK_MMAP) {
+        this->mmapLog.append(iov, count);
+        count = 0;
+    } else if (this->uring.active()) {
+        this->submitBatch(iov, count);
+        count = 0;
+    }
+
+    // one writev() per batch, a short write only resumes from where the kernel stopped
+    while (count > 0) {
+        ssize_t ret = writev(this->fd, iov, (int)count);
+        if (ret <= 0) {
+            if (ret < 0 && errno == EINTR) {
+                continue;
+            }
+            exit(EXIT_FAILURE);
+        }
+        this->writeCalls.fetch_add(1, std::memory_order_relaxed);
+
+        size_t written = (size_t)ret;
+        while (count > 0 && written >= iov->iov_len) {
+            written -= iov->iov_len;
+            ++iov;
+            --count;
+        }
+        if (count > 0) {
+            iov->iov_base = static_cast<char *>(iov->iov_base) + written;
+            iov->iov_len -= written;
+        }
+    }
+    this->recordsWritten.fetch_add(records, std::memory_order_relaxed);
+    this->unsynced.store(true, std::memory_order_relaxed);
+}
+
+void Tintin_reporter::submitBatch(const struct iovec *iov, size_t count) const {
+    // the file was rotated since the last batch: what is in flight finishes in the old file, the rest goes to the new one
+    uint64_t generation = this->fileGeneration.load(std::memory_order_acquire);
+    if (generation != this->uringGeneration) {
+        if (!this->uring.updateFile()) {
+            exit(EXIT_FAILURE);
+        }
+        this->uringGeneration = generation;
+    }
+
+    char *buffer = this->uring.acquire();
+    if (buffer == nullptr) {
+        exit(EXIT_FAILURE); // same as a failed write()
+    }
+
+    // a batch holds LOG_MAX_LEN bytes per record at most, the buffers are sized for a full batch
+    size_t len = 0;
+    for (size_t i = 0; i < count; ++i) {
+        memcpy(buffer + len, iov[i].iov_base, iov[i].iov_len);
+        len += iov[i].iov_len;
+    }
+
+    if (!this->uring.submit(len)) {
+        exit(EXIT_FAILURE);
+    }
+    this->writeCalls.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Tintin_reporter::syncIfDue(bool wrote) const {
+    switch (this->options.durability) {
+        case SYNC_BATCH:
+            if (wrote) {
+                this->dataSync();
+            }
+            return;
+        case SYNC_INTERVAL:
+            if (this->unsynced.load(std::memory_order_relaxed)
+                && Tintin_reporter::nowMs() - this->lastSyncMs.load(std::memory_order_relaxed) >= this->options.syncIntervalMs) {
+                this->dataSync();
+            }
+            return;
         default:
-            return "INFO";
+            return;
+    }
+}
+
+void Tintin_reporter::dataSync(void) const {
+    // SINK_URING: only what completed can be synced
+    if (!this->uring.drain()) {
+        exit(EXIT_FAILURE);
+    }
+    this->unsynced.store(false, std::memory_order_relaxed);
+    fdatasync(this->fd);
+    this->syncCalls.fetch_add(1, std::memory_order_relaxed);
+    this->lastSyncMs.store(Tintin_reporter::nowMs(), std::memory_order_relaxed);
+}
+
+int64_t Tintin_reporter::nowMs(void) {
+    return (std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+const char  *Tintin_reporter::getLogTypeStr(LogType type) {
+    return (Log_record::typeName((uint8_t)type));
+}
+
+size_t Tintin_reporter::format(char *out, const struct timespec &ts, LogType type, const char *msg, size_t len) const {
+    if (this->options.format == FORMAT_BINARY) {
+        return (Log_record::encodeBinary(out, LOG_MAX_LEN, ts, (uint8_t)type, msg, len)); // no timestamp formatting at all, tintin_decode does it offline
+    }
+
+    char timestamp[Timestamp_cache::MAX_LEN];
+    size_t timestampLen = this->timestamps.format(timestamp, ts, this->options.timestampPrecision);
+
+    return (Log_record::formatText(out, LOG_MAX_LEN, timestamp, timestampLen, (uint8_t)type, msg, len));
+}
+
+void Tintin_reporter::emit(LogType type, const char *msg, size_t len) const {
+    if (this->writerRunning.load(std::memory_order_acquire)) {
+        Log_ring::Cell *cell = this->acquireCell(type);
+        if (cell != nullptr) {
+            cell->record.len = len;
+            memcpy(cell->record.msg, msg, len);
+            this->commitCell(cell, type);
+        }
+        return;
+    }
+
+    this->logNow(type, msg, len);
+}
+
+void Tintin_reporter::logNow(LogType type, const char *msg, size_t len) const {
+    struct timespec now;
+    Timestamp_cache::now(&now);
+
+    char log[LOG_MAX_LEN];
+    len = this->format(log, now, type, msg, len);
+
+    // the caller's loop (if watched) blocks on the file meanwhile
+    const char *phase = Stall_watchdog::enter("log write");
+    this->logger(log, len);
+    this->syncIfDue(true);
+    Stall_watchdog::enter(phase);
+}
+
+// (*) async mode
+
+Log_ring::Cell *Tintin_reporter::acquireCell(LogType type) const {
+    // only client traffic is sheddable, INFO and ERROR records (daemon lifecycle) always wait for room
+    OverflowPolicy policy = (type == LOG) ? this->options.overflowPolicy : BLOCK;
+    Log_ring::Cell *cell;
+
+    while ((cell = this->ring.tryAcquire()) == nullptr) {
+        if (policy == DROP) {
+            this->dropped.fetch_add(1, std::memory_order_relaxed);
+            return (nullptr);
+        }
+
+        if (policy == DROP_OLDEST) {
+            Log_ring::Cell *oldest = this->ring.tryConsume();
+            this->dropped.fetch_add(1, std::memory_order_relaxed);
+
+            // nothing committed to evict (every cell is being filled or written) => the new record is the one dropped
+            if (oldest == nullptr) {
+                return (nullptr);
+            }
+            this->ring.release(oldest);
+            continue;
+        }
+
+        // BLOCK: let the writer catch up
+        this->wakeWriter();
+        std::this_thread::yield();
     }
+
+    return (cell);
+}
+
+void Tintin_reporter::commitCell(Log_ring::Cell *cell, LogType type) const {
+    Log_record &record = cell->record;
+    Timestamp_cache::now(&record.time);
+    record.type = (uint8_t)type;
+    this->ring.publish(cell);
+
+    // pairs with the fence in writerLoop(): either the writer sees the record or we see it idle
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (this->writerIdle.load(std::memory_order_relaxed)) {
+        this->wakeWriter();
+    }
+}
+
+void Tintin_reporter::wakeWriter(void) const {
+    std::lock_guard<std::mutex> lock(this->writerMutex);
+    this->writerWakeup.notify_one();
+}
+
+void Tintin_reporter::writerLoop(void) const {
+    const size_t batchMax = this->batchIov.size();
+
+    Stall_watchdog::watch("log writer");
+    Tintin_reporter::onWriter = true;
+
+    while (true) {
+        size_t count = 0;
+        int64_t batchStart = 0;
+
+        // (*) collecting: until the batch is full, its oldest record waited batchMaxLatencyMs, or we are stopping
+        while (count < batchMax) {
+            Log_ring::Cell *cell = this->ring.tryConsume();
+
+            if (cell != nullptr) {
+                const Log_record &record = cell->record;
+                char *line = &this->batchBuffer[count * LOG_MAX_LEN];
+
+                this->batchIov[count].iov_base = line;
+                this->batchIov[count].iov_len = this->format(line, record.time, (LogType)record.type, record.msg, record.len);
+                this->batchCells[count] = cell;
+                if (count++ == 0) {
+                    batchStart = Tintin_reporter::nowMs();
+                }
+                continue;
+            }
+
+            if (this->writerStopping.load()) {
+                break;
+            }
+
+            if (count == 0) {
+                // idle: the interval durability policy still has to sync what the last batch left behind
+                this->reportDropped();
+                this->reportSuppressed(false);
+                Stall_watchdog::begin(Tintin_reporter::nowMs());
+                Stall_watchdog::enter("sync");
+                this->syncIfDue(false);
+                Stall_watchdog::idle();
+                bool syncPending = this->options.durability == SYNC_INTERVAL && this->unsynced.load(std::memory_order_relaxed);
+                this->waitForRecords(syncPending ? std::min(WRITER_IDLE_WAIT_MS, this->options.syncIntervalMs) : WRITER_IDLE_WAIT_MS);
+                continue;
+            }
+
+            int64_t waited = Tintin_reporter::nowMs() - batchStart;
+            if (waited >= this->options.batchMaxLatencyMs) {
+                break;
+            }
+            this->waitForRecords(this->options.batchMaxLatencyMs - waited);
+        }
+
+        // (*) flushing
+        if (count > 0) {
+            Stall_watchdog::begin(Tintin_reporter::nowMs());
+            Stall_watchdog::enter("write");
+            this->writeBatch(this->batchIov.data(), count);
+            // a submitted io_uring batch may not be in the file yet: a ring file keeps its records until it is
+            if (this->ring.fileBacked() && !this->uring.drain()) {
+                exit(EXIT_FAILURE);
+            }
+            for (size_t i = 0; i < count; ++i) {
+                this->ring.release(this->batchCells[i]); // written: a crash from now on doesn't replay them
+            }
+            Stall_watchdog::enter("sync");
+            this->syncIfDue(true);
+            Stall_watchdog::idle();
+        }
+        this->reportDropped();
+        this->reportSuppressed(false);
+
+        if (this->writerStopping.load() && this->ring.empty()) {
+            break;
+        }
+    }
+
+    // stopAsync() writes what is left synchronously, after the last batches
+    Stall_watchdog::leave();
+    if (!this->uring.drain()) {
+        exit(EXIT_FAILURE);
+    }
+}
+
+void Tintin_reporter::waitForRecords(long timeoutMs) const {
+    std::unique_lock<std::mutex> lock(this->writerMutex);
+
+    this->writerIdle.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (this->ring.empty() && !this->writerStopping.load()) {
+        this->writerWakeup.wait_for(lock, std::chrono::milliseconds(timeoutMs));
+    }
+    this->writerIdle.store(false, std::memory_order_relaxed);
+}
+
+void Tintin_reporter::reportDropped(void) const {
+    uint64_t total = this->dropped.load(std::memory_order_relaxed);
+
+    if (total == this->droppedReported) {
+        return;
+    }
+
+    char msg[64];
+    snprintf(msg, sizeof(msg), "%llu records dropped (log ring full)", (unsigned long long)(total - this->droppedReported));
+    this->droppedReported = total;
+
+    this->writeNotice(Tintin_reporter::ERROR, msg);
+}
+
+void Tintin_reporter::writeNotice(LogType type, const char *msg) const {
+    // another thread (an event loop reopening the file, rotating, ...): behind what is queued, without touching the
+    // file the writer owns. emit() writes it synchronously when there is no writer
+    if (!Tintin_reporter::onWriter) {
+        this->emit(type, msg, strlen(msg));
+        return;
+    }
+
+    // the writer itself: after the batches still in flight (SINK_URING), they'd land after it otherwise
+    if (!this->uring.drain()) {
+        exit(EXIT_FAILURE);
+    }
+    struct timespec now;
+    Timestamp_cache::now(&now);
+
+    char line[LOG_MAX_LEN];
+    this->logger(line, this->format(line, now, type, msg, strlen(msg)));
+}
+
+// (*) filtering
+
+bool Tintin_reporter::admitLimited(LogType type) const {
+    FilterState &state = this->filterStates[type];
+    int64_t emission = state.emissionNs.load(std::memory_order_relaxed);
+    bool admitted = true;
+
+    // token bucket (GCRA form, a single CAS): a record conforms unless the bucket is more than tolerance ahead of now
+    if (emission > 0) {
+        int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        int64_t tolerance = state.toleranceNs.load(std::memory_order_relaxed);
+        int64_t tat = state.tat.load(std::memory_order_relaxed);
+
+        while (true) {
+            int64_t base = std::max(tat, now);
+            if (base - now > tolerance) {
+                admitted = false;
+                break;
+            }
+            if (state.tat.compare_exchange_weak(tat, base + emission, std::memory_order_relaxed)) {
+                break;
+            }
+        }
+    }
+
+    // sampling applies to what the rate limit let through
+    uint32_t every = state.sampleEvery.load(std::memory_order_relaxed);
+    if (admitted && every > 1 && state.sampleCounter.fetch_add(1, std::memory_order_relaxed) % every != 0) {
+        admitted = false;
+    }
+
+    if (!admitted) {
+        state.suppressed.fetch_add(1, std::memory_order_relaxed);
+    }
+    this->reportSuppressed(false);
+    return (admitted);
+}
+
+void Tintin_reporter::reportSuppressed(bool force) const {
+    long period = this->options.suppressReportSec;
+
+    // the writer reports after its batches: a log() caller only counts, it never waits on the file
+    if (period <= 0 || (!force && !Tintin_reporter::onWriter && this->writerRunning.load(std::memory_order_relaxed))) {
+        return;
+    }
+
+    int64_t now = Tintin_reporter::nowMs();
+    int64_t last = this->lastSuppressReportMs.load(std::memory_order_relaxed);
+    if (!force && now - last < period * 1000) {
+        return;
+    }
+    // one reporter per window, the others keep counting
+    if (!this->lastSuppressReportMs.compare_exchange_strong(last, now)) {
+        return;
+    }
+
+    for (int type = LOG; type <= ERROR; ++type) {
+        uint64_t count = this->filterStates[type].suppressed.exchange(0, std::memory_order_relaxed);
+        if (count == 0) {
+            continue;
+        }
+
+        char msg[96];
+        snprintf(msg, sizeof(msg), "%s: %llu records suppressed in last %llds", Tintin_reporter::getLogTypeStr((LogType)type),
+            (unsigned long long)count, (long long)((now - last + 500) / 1000));
+        this->writeNotice(Tintin_reporter::INFO, msg);
+    }
+}
+
+// (*) coalescing
+
+uint64_t Tintin_reporter::hashMessage(const char *msg, size_t len) {
+    // 8 bytes per multiply-xorshift round, a line is hashed in a few ns
+    uint64_t hash = 0x9E3779B97F4A7C15ULL ^ len;
+    size_t i = 0;
+
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, msg + i, 8);
+        hash = (hash ^ word) * 0xFF51AFD7ED558CCDULL;
+        hash ^= hash >> 32;
+    }
+
+    uint64_t tail = 0;
+    memcpy(&tail, msg + i, len - i);
+    hash = (hash ^ tail) * 0xC4CEB9FE1A85EC53ULL;
+    hash ^= hash >> 29;
+    return (hash);
+}
+
+void Tintin_reporter::emitCoalesced(LogType type, const char *msg, size_t len) const {
+    // one step for every producer: otherwise a count could be taken for another record than the one compared, or be
+    // written after a record of the next run (the emits are inside: the count has to land right before the new record)
+    uint64_t hash = (Tintin_reporter::hashMessage(msg, len) & ~(uint64_t)3) | (uint64_t)type;
+    std::lock_guard<std::mutex> lock(this->coalesceMutex);
+    uint64_t previous = this->lastHash;
+
+    if (previous == hash) {
+        if (this->repeats.fetch_add(1, std::memory_order_relaxed) == 0) {
+            this->repeatsSinceMs.store(Tintin_reporter::nowMs(), std::memory_order_relaxed);
+        }
+        return;
+    }
+
+    // the run of repeats ended: its count goes before the new record
+    this->lastHash = hash;
+    uint64_t count = this->repeats.exchange(0, std::memory_order_relaxed);
+    if (count > 0) {
+        this->reportRepeats(previous, count);
+    }
+    this->emit(type, msg, len);
+}
+
+void Tintin_reporter::reportRepeats(uint64_t hash, uint64_t count) const {
+    char msg[64];
+    int len = snprintf(msg, sizeof(msg), "last message repeated %llu times", (unsigned long long)count);
+
+    this->emit((LogType)(hash & 3), msg, len);
+}
+
+long Tintin_reporter::flushRepeats(void) const {
+    if (this->options.coalesceMs <= 0 || this->repeats.load(std::memory_order_relaxed) == 0) {
+        return (-1);
+    }
+
+    int64_t waited = Tintin_reporter::nowMs() - this->repeatsSinceMs.load(std::memory_order_relaxed);
+    if (waited < this->options.coalesceMs) {
+        return (this->options.coalesceMs - waited);
+    }
+
+    std::lock_guard<std::mutex> lock(this->coalesceMutex);
+    uint64_t count = this->repeats.exchange(0, std::memory_order_relaxed);
+    if (count > 0) {
+        this->reportRepeats(this->lastHash, count);
+    }
+    return (-1);
+}
+
+// (*) log rotation
+
+void Tintin_reporter::switchFile(int newFd) const {
+    if (this->options.sink == SINK_MMAP) {
+        try {
+            this->mmapLog.reopen(newFd);
+        } catch (const std::runtime_error &e) {
+            exit(EXIT_FAILURE); // same as a failed write()
+        }
+    } else if (dup2(newFd, this->fd) < 0) {
+        exit(EXIT_FAILURE);
+    }
+    // writers racing with dup2() land either in the old file or in the new one, never on a closed fd
+    close(newFd);
+    this->fileGeneration.fetch_add(1, std::memory_order_release);
+}
+
+void Tintin_reporter::maybeRotate(size_t incoming) const {
+    if (!this->rotationArmed.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    uint64_t size = this->fileBytes.load(std::memory_order_relaxed);
+    bool bySize = this->options.rotateSize > 0 && size > 0 && size + incoming > this->options.rotateSize;
+    bool byTime = this->options.rotateIntervalSec > 0 && size > 0
+        && time(NULL) - this->lastRotation.load(std::memory_order_relaxed) >= this->options.rotateIntervalSec;
+
+    // a failed rotation isn't retried on every record (the size stays over the limit)
+    if ((bySize || byTime) && time(NULL) >= this->rotateRetry.load(std::memory_order_relaxed)) {
+        this->rotate();
+    }
+}
+
+void Tintin_reporter::rotate(void) const {
+    std::unique_lock<std::mutex> lock(this->rotateMutex, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        return; // another thread is rotating, its fresh file takes our record
+    }
+
+    // <log>.<YYYYmmdd-HHMMSS>[-N]
+    time_t now = time(NULL);
+    struct tm tmp;
+    char suffix[32];
+    char rotatedPath[PATH_MAX + 48];
+    localtime_r(&now, &tmp);
+    strftime(suffix, sizeof(suffix), "%Y%m%d-%H%M%S", &tmp);
+    char gzPath[PATH_MAX + 64];
+    snprintf(rotatedPath, sizeof(rotatedPath), "%s.%s", this->logFilePath, suffix);
+    snprintf(gzPath, sizeof(gzPath), "%s.gz", rotatedPath);
+    for (int n = 1; access(rotatedPath, F_OK) == 0 || access(gzPath, F_OK) == 0; ++n) {
+        snprintf(rotatedPath, sizeof(rotatedPath), "%s.%s-%d", this->logFilePath, suffix, n);
+        snprintf(gzPath, sizeof(gzPath), "%s.gz", rotatedPath);
+    }
+
+    // the notices are logged once the lock is released: logging one may rotate again
+    if (rename(this->logFilePath, rotatedPath) < 0) {
+        this->rotateRetry = now + ROTATE_RETRY_SEC;
+        lock.unlock();
+        this->writeNotice(Tintin_reporter::ERROR, "log rotation failure (rename)");
+        return;
+    }
+
+    // until switchFile() returns, records keep going to the renamed file: nothing is lost in between
+    int newFd = this->openLogFile();
+    if (newFd < 0) {
+        rename(rotatedPath, this->logFilePath);
+        this->rotateRetry = now + ROTATE_RETRY_SEC;
+        lock.unlock();
+        this->writeNotice(Tintin_reporter::ERROR, "log rotation failure (open)");
+        return;
+    }
+    this->switchFile(newFd);
+    this->fileBytes = 0;
+    this->lastRotation = now;
+    this->rotateRetry = 0;
+
+    char msg[PATH_MAX + 128];
+    if (this->options.compressRotated && !this->compressor.submit(rotatedPath)) {
+        snprintf(msg, sizeof(msg), "Log rotated to %s (left uncompressed)", rotatedPath);
+    } else {
+        snprintf(msg, sizeof(msg), "Log rotated to %s", rotatedPath);
+    }
+    lock.unlock();
+    this->writeNotice(Tintin_reporter::INFO, msg);
 }
 
 
 // (*) public interface
 
 const Tintin_reporter &Tintin_reporter::getLoggerInstance(const char *logFilePath) {
+    return (Tintin_reporter::getLoggerInstance(logFilePath, Options()));
+}
+
+const Tintin_reporter &Tintin_reporter::getLoggerInstance(const char *logFilePath, const Options &options) {
     try {
-        static Tintin_reporter logger(logFilePath);
+        static Tintin_reporter logger(logFilePath, options);
 
         return (logger);
     } catch (std::runtime_error &e) {
@@ -101,20 +716,154 @@ const Tintin_reporter &Tintin_reporter::getLoggerInstance(const char *logFilePat
 }
 
 void Tintin_reporter::log(LogType type, const char *msg) const {
-    char timestamp[TIMESTAMP_MAX_LEN];
-    Tintin_reporter::getTimestamp(timestamp);
-    const char *logTypeStr = Tintin_reporter::getLogTypeStr(type);
+    if (this->suppressed(type)) {
+        return;
+    }
 
-    char log[LOG_MAX_LEN];
-    int written = snprintf(log, LOG_MAX_LEN, "[%s] [ %s ] - Matt_daemon: %s.\n", timestamp, logTypeStr, msg);
+    size_t len = strnlen(msg, Log_record::MSG_MAX_LEN);
+    if (this->options.coalesceMs > 0) {
+        this->emitCoalesced(type, msg, len);
+        return;
+    }
+    this->emit(type, msg, len);
+}
+
+size_t Tintin_reporter::recoverRing(void) const {
+    const char *path = this->options.ringFile;
+    if (path == nullptr || *path == '\0') {
+        return (0);
+    }
+
+    // the previous run's records keep their own timestamps and skip the filters (they passed them already)
+    char line[LOG_MAX_LEN];
+    size_t replayed = Log_ring::replayFile(path, [this, &line](const Log_record &record) {
+        this->logger(line, this->format(line, record.time, (LogType)record.type, record.msg, record.len));
+    });
+
+    if (replayed > 0) {
+        char msg[128];
+        snprintf(msg, sizeof(msg), "Recovered %zu log records left in %s by the previous run", replayed, path);
+        this->log(Tintin_reporter::INFO, msg);
+    }
+
+    if (!this->options.async) {
+        unlink(path);
+    } else if (!this->ring.attachFile(path)) {
+        char msg[PATH_MAX + 128];
+        snprintf(msg, sizeof(msg), "cannot map the log ring to %s (%s), pending records won't survive a crash", path, strerror(errno));
+        this->log(Tintin_reporter::ERROR, msg);
+    }
+    return (replayed);
+}
+
+void Tintin_reporter::startBackground(void) const {
+    // rotation may start the compressor thread, so it waits for the daemon process as well
+    this->rotationArmed = true;
 
-    if (written < 0) {
+    if (!this->options.async || this->writerRunning.load()) {
         return;
     }
 
-    size_t finalLen = ((size_t)written >= LOG_MAX_LEN) ? LOG_MAX_LEN - 1 : (size_t)written; 
+    if (this->options.sink == SINK_URING && !this->uring.setup(this->fd, this->batchIov.size() * LOG_MAX_LEN, URING_BUFFERS)) {
+        char msg[128];
+        snprintf(msg, sizeof(msg), "io_uring unavailable (%s), the log writer falls back to writev()", strerror(errno));
+        this->log(Tintin_reporter::INFO, msg);
+    }
+
+    this->writerStopping = false;
+    try {
+        this->writer = std::thread(&Tintin_reporter::writerLoop, this);
+    } catch (const std::system_error &e) {
+        this->log(Tintin_reporter::ERROR, "failure to start the log writer thread (logging synchronously)");
+        return;
+    }
+    this->writerRunning.store(true, std::memory_order_release);
+}
+
+void Tintin_reporter::stopAsync(void) const {
+    std::unique_lock<std::mutex> lock(this->coalesceMutex);
+    uint64_t count = this->repeats.exchange(0, std::memory_order_relaxed);
+    if (count > 0) {
+        this->reportRepeats(this->lastHash, count);
+    }
+    lock.unlock();
+
+    if (!this->writerRunning.exchange(false)) {
+        this->reportSuppressed(true);
+        return;
+    }
+
+    this->writerStopping = true;
+    this->wakeWriter();
+    this->writer.join();
+
+    // records published while the writer was leaving are written from here
+    char line[LOG_MAX_LEN];
+    Log_ring::Cell *cell;
+    while ((cell = this->ring.tryConsume()) != nullptr) {
+        const Log_record &record = cell->record;
+        this->logger(line, this->format(line, record.time, (LogType)record.type, record.msg, record.len));
+        this->ring.release(cell);
+    }
+    this->reportDropped();
+    this->reportSuppressed(true);
+    if (this->options.durability != SYNC_NONE && this->unsynced.load()) {
+        this->dataSync();
+    }
+
+    WriteStats stats = this->getWriteStats();
+    char msg[128];
+    snprintf(msg, sizeof(msg), "Log writer: %llu records in %llu write calls (%.2f records/syscall), %llu fdatasync calls",
+        (unsigned long long)stats.records, (unsigned long long)stats.writeCalls,
+        stats.writeCalls ? (double)stats.records / (double)stats.writeCalls : 0.0, (unsigned long long)stats.syncCalls);
+    this->log(Tintin_reporter::INFO, msg);
+}
+
+void Tintin_reporter::setFilter(LogType type, const Filter &filter) const {
+    FilterState &state = this->filterStates[type];
+    uint32_t burst = filter.burst ? filter.burst : std::max(filter.ratePerSec, 1u);
+    int64_t emission = filter.ratePerSec ? 1000000000LL / filter.ratePerSec : 0;
+
+    state.emissionNs.store(emission, std::memory_order_relaxed);
+    state.toleranceNs.store(emission * (burst - 1), std::memory_order_relaxed);
+    state.sampleEvery.store(filter.sampleEvery ? filter.sampleEvery : 1, std::memory_order_relaxed);
+
+    uint8_t mode = !filter.enabled ? FILTER_OFF : (filter.ratePerSec || filter.sampleEvery > 1) ? FILTER_LIMITED : FILTER_PASS;
+    state.mode.store(mode, std::memory_order_release);
+}
+
+void Tintin_reporter::reopen(void) const {
+    if (this->options.rotateSize > 0 || this->options.rotateIntervalSec > 0) {
+        this->rotate();
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(this->rotateMutex);
+    int newFd = this->openLogFile();
+    if (newFd < 0) {
+        lock.unlock();
+        this->writeNotice(Tintin_reporter::ERROR, "failure to reopen the log file");
+        return;
+    }
+    this->switchFile(newFd);
+
+    struct stat st;
+    this->fileBytes = (this->options.sink == SINK_MMAP) ? this->mmapLog.size() : (fstat(this->fd, &st) == 0) ? st.st_size : 0;
+    lock.unlock();
+    this->writeNotice(Tintin_reporter::INFO, "Log file reopened");
+}
+
+uint64_t Tintin_reporter::getDroppedCount(void) const {
+    return (this->dropped.load(std::memory_order_relaxed));
+}
+
+Tintin_reporter::WriteStats Tintin_reporter::getWriteStats(void) const {
+    WriteStats stats;
 
-    this->logger(log, finalLen);
+    stats.records = this->recordsWritten.load(std::memory_order_relaxed);
+    stats.writeCalls = this->writeCalls.load(std::memory_order_relaxed);
+    stats.syncCalls = this->syncCalls.load(std::memory_order_relaxed);
+    return (stats);
 }
 
 int Tintin_reporter::getLogFileFd(void) const {
@@ -0,0 +1,65 @@
+#ifndef ADMISSION_HPP
+#define ADMISSION_HPP
+
+// admission control shared by the workers: who gets in (connection limit, pressure), the "busy" reply of the ones who
+// don't, the memory budget (bytes of partial lines buffered by all the clients) and a counter for every decision.
+// lock-free (relaxed atomics): a decision may be off by a connection or two under contention, never by more
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+class Admission {
+    public:
+        enum Decision {
+            ADMIT, // a client slot was reserved (release() it when the client leaves)
+            BUSY_LIMIT, // the connection limit is reached
+            BUSY_PRESSURE // the memory or cpu budget is exceeded
+        };
+
+        enum Shed {
+            SHED_MEMORY, // the client held the most buffered bytes while over the memory budget
+            SHED_CPU // the worker was over its cpu budget, the client was its newest
+        };
+
+        struct Counters {
+            uint64_t accepted;
+            uint64_t busyLimit;
+            uint64_t busyPressure;
+            uint64_t shedMemory;
+            uint64_t shedCpu;
+            uint64_t acceptFailures;
+        };
+
+    private:
+        size_t maxClients;
+        long retryAfterMs;
+        size_t memoryBudget; // 0: none
+        std::atomic<size_t> clients;
+        std::atomic<int64_t> buffered; // bytes of partial lines, all clients
+
+        std::atomic<uint64_t> accepted;
+        std::atomic<uint64_t> busyLimit;
+        std::atomic<uint64_t> busyPressure;
+        std::atomic<uint64_t> shedMemory;
+        std::atomic<uint64_t> shedCpu;
+        std::atomic<uint64_t> acceptFailures;
+
+    public:
+        Admission(size_t maxClients, long retryAfterMs, size_t memoryBudget);
+        Admission(const Admission &other) = delete;
+        Admission &operator=(const Admission &other) = delete;
+
+    public:
+        Decision    admit(bool pressure); // pressure: the accepting worker is over its cpu budget
+        void        refuse(int fd); // "busy, retry after N ms" (best effort, never blocks), then closes fd
+        void        release(void); // an admitted client left
+        void        shed(Shed reason); // counts a client closed to relieve pressure (the caller closes it)
+        void        acceptFailed(void);
+
+        void        addBuffered(int64_t delta); // a client's partial line grew (> 0) or was consumed (< 0)
+        int64_t     overMemoryBudget(void) const; // bytes above the memory budget (<= 0: within it)
+        Counters    counters(void) const;
+};
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef FD_CLOSER_HPP
+#define FD_CLOSER_HPP
+
+// closes every fd from a number on (but a few kept ones) without walking up to RLIMIT_NOFILE: close_range() (linux 5.9)
+// over the gaps between the kept fds (16 of them at most), else the fds listed in /proc/self/fd, else the loop to the limit.
+// async-signal-safe (raw syscalls, no allocation): usable between fork() and exec() in a threaded process
+
+#include <cstddef>
+
+class Fd_closer {
+    public:
+        Fd_closer() = delete;
+
+    public:
+        static void closeFrom(int first, const int *keep, size_t keepCount); // keep: negative entries are ignored
+
+    private:
+        static bool closeRange(unsigned first, unsigned last); // false: close_range() isn't available
+        static bool closeListed(int first, const int *keep, size_t keepCount); // false: /proc isn't mounted
+        static bool kept(int fd, const int *keep, size_t keepCount);
+};
+
+#endif
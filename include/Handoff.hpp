@@ -0,0 +1,51 @@
+#ifndef HANDOFF_HPP
+#define HANDOFF_HPP
+
+// hot restart: the running daemon (predecessor) forks and execs its binary again (successor), and once the successor
+// says it's up, passes it the lock fd, the listening sockets and every client socket with its unhandled bytes over an
+// AF_UNIX seqpacket socket (SCM_RIGHTS, one fd per message). the flock belongs to the open file description, which
+// never closes: the lock changes hands without ever being free. the successor only opens the log file once the
+// predecessor is gone (it is the predecessor's child: reparented once it exited), so the two never write the log file
+// or the ring file at the same time
+
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+class Handoff {
+    public:
+        static constexpr const char *ENV = "MATT_DAEMON_HANDOFF"; // successor: the fd of its end of the socket
+        static constexpr long TIMEOUT_MS = 5000; // each side waits that long for the other at most
+        static constexpr long EXIT_TIMEOUT_MS = 60000; // successor: for the predecessor to exit once it sent everything (it writes its last records)
+
+        struct Client {
+            int fd;
+            std::string pending; // received, not handled yet (the partial line, and whatever followed it)
+        };
+
+        struct State {
+            pid_t predecessor = 0;
+            int lockFd = -1;
+            int unixFd = -1; // --unix listener (-1: none)
+            std::vector<int> listenFds; // TCP listeners, one per worker
+            std::vector<Client> clients;
+            bool complete = false; // successor: everything was received
+            bool predecessorGone = false; // successor: the predecessor exited (false: it may still write the log and the ring file)
+        };
+
+    public:
+        Handoff() = delete;
+
+    public:
+        // predecessor side
+        static bool spawn(const std::string &executable, const std::vector<std::string> &arguments, int *sock, pid_t *pid); // fork + exec, *sock: our end
+        static bool awaitReady(int sock, pid_t pid); // false: the successor died or hung (it's killed and reaped then)
+        static bool send(int sock, const State &state); // the fds stay open, the successor has its own copies
+
+        // successor side
+        static int  inheritedSocket(void); // -1: not started by a hot restart
+        static bool receive(int sock, State *state); // says it's up, takes the state, then waits for the predecessor to exit (EXIT_TIMEOUT_MS at most)
+        static void release(State &state); // closes whatever was received
+};
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef LATENCY_HISTOGRAM_HPP
+#define LATENCY_HISTOGRAM_HPP
+
+// log-linear latency histogram (HdrHistogram's layout): 32 linear buckets per power of two, so a bucket is at most
+// ~3% wide relative to its values, from 1 ns to 2^36 ns (68 s, longer ones land in the last bucket) in 1024 counters.
+// one thread records (relaxed load + store, nothing locked), any thread adds it into a Snapshot with relaxed loads:
+// a snapshot taken while it records may miss the latest values, never mixes up buckets
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class Latency_histogram {
+    public:
+        static constexpr unsigned SUB_BITS = 5;
+        static constexpr size_t SUB_BUCKETS = (size_t)1 << SUB_BITS;
+        static constexpr unsigned MAX_BITS = 36; // values up to 2^36 - 1 ns are bucketed exactly
+        static constexpr size_t BUCKETS = (MAX_BITS - SUB_BITS + 1) * SUB_BUCKETS;
+
+        struct Summary {
+            uint64_t count;
+            int64_t p50; // ns (the highest value of the percentile's bucket, within ~3%)
+            int64_t p99;
+            int64_t p999;
+            int64_t max; // ns, exact
+        };
+
+        // merged counts of several histograms (or the difference between two merges)
+        struct Snapshot {
+            std::vector<uint64_t> counts;
+            int64_t max = 0;
+
+            Snapshot(): counts(BUCKETS, 0) {}
+            Summary summarize(void) const;
+            Snapshot since(const Snapshot &earlier) const; // what was recorded in between (max: bounded by the last bucket)
+        };
+
+    private:
+        std::atomic<uint64_t> counts[BUCKETS];
+        std::atomic<int64_t> max;
+
+    public:
+        Latency_histogram();
+        Latency_histogram(const Latency_histogram &other) = delete;
+        Latency_histogram &operator=(const Latency_histogram &other) = delete;
+
+    public:
+        void            record(int64_t ns); // the owner thread only
+        void            recordShared(int64_t ns); // any thread (atomic read-modify-writes)
+        void            addTo(Snapshot *snapshot) const;
+        static size_t   bucketOf(uint64_t ns);
+        static uint64_t highestOf(size_t bucket); // the highest value that falls in bucket
+};
+
+inline size_t Latency_histogram::bucketOf(uint64_t ns) {
+    if (ns < SUB_BUCKETS) {
+        return ((size_t)ns);
+    }
+    if (ns >> MAX_BITS) {
+        return (BUCKETS - 1);
+    }
+    unsigned shift = (unsigned)(63 - __builtin_clzll(ns)) - SUB_BITS;
+    return ((size_t)(shift + 1) * SUB_BUCKETS + (size_t)((ns >> shift) - SUB_BUCKETS));
+}
+
+inline void Latency_histogram::record(int64_t ns) {
+    std::atomic<uint64_t> &count = this->counts[Latency_histogram::bucketOf(ns > 0 ? (uint64_t)ns : 0)];
+
+    count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    if (ns > this->max.load(std::memory_order_relaxed)) {
+        this->max.store(ns, std::memory_order_relaxed);
+    }
+}
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef LATENCY_STATS_HPP
+#define LATENCY_STATS_HPP
+
+// latency of the message pipeline, per stage: each thread that attached records into its own histograms (no
+// contention, no locked instruction), the ones that didn't share a set (atomic adds). summaries merge them all on
+// demand, from any thread, without stopping the recorders. a clock read costs about as much as handling a short
+// line, so only a random sample of the lines and records is timed (sample(): one in N, per thread xorshift)
+
+#include "Latency_histogram.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+class Latency_stats {
+    public:
+        enum Stage {
+            READ_TO_LINE, // recv() (or the io_uring completion) to the line split out of the client's buffer
+            HANDLE, // handleMessage()
+            LOG_DURABLE, // log() to the record written (and fdatasync'ed when the durability policy syncs right away)
+            STAGES
+        };
+
+    private:
+        static constexpr size_t MAX_THREADS = 64; // attached ones, the others record into the shared set
+
+        struct Set {
+            Latency_histogram stages[STAGES];
+        };
+
+        static Set shared;
+        static std::atomic<Set *> sets[MAX_THREADS];
+        static std::atomic<size_t> setCount;
+        static std::atomic<uint32_t> sampleMask; // N - 1 (N a power of two)
+        inline static thread_local Set *current = nullptr;
+        inline static thread_local uint32_t random = 2463534242u; // xorshift32 state
+
+    public:
+        Latency_stats() = delete;
+
+    public:
+        static void                         attach(void); // the calling thread gets histograms of its own (once)
+        static void                         setSampling(size_t every); // one in every (rounded up to a power of two, 1: all), before the threads start
+        static bool                         sample(void); // should the caller time this one?
+        static void                         record(Stage stage, int64_t ns);
+        static Latency_histogram::Snapshot  snapshot(Stage stage); // every thread's histograms of the stage, merged
+        static const char                   *stageName(Stage stage);
+};
+
+inline bool Latency_stats::sample(void) {
+    uint32_t x = Latency_stats::random;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    Latency_stats::random = x;
+    return ((x & Latency_stats::sampleMask.load(std::memory_order_relaxed)) == 0);
+}
+
+inline void Latency_stats::record(Stage stage, int64_t ns) {
+    Set *set = Latency_stats::current;
+
+    if (set != nullptr) {
+        set->stages[stage].record(ns);
+        return;
+    }
+    Latency_stats::shared.stages[stage].recordShared(ns);
+}
+
+#endif
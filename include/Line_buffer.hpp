@@ -0,0 +1,58 @@
+#ifndef LINE_BUFFER_HPP
+#define LINE_BUFFER_HPP
+
+// contiguous receive buffer with a read cursor: recv() writes at the end, complete lines are handed out as
+// string_views into the buffer (no copy, no allocation), consumed bytes are only moved when the free room runs low.
+// newlines are located by Newline_scanner, a batch of line offsets per pass over the received bytes.
+// the capacity is fixed (longest line + 1 + read size), a line longer than the limit is reported as OVERLONG
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+
+class Line_buffer {
+    public:
+        enum Status {
+            LINE, // a complete line (without its '\n')
+            PARTIAL, // no complete line buffered, recv() more
+            OVERLONG // the line is longer than maxLength: the view holds its first maxLength bytes, the rest is dropped
+        };
+
+        static constexpr size_t LINE_BATCH = 128; // newline offsets kept per scan
+
+    private:
+        std::unique_ptr<char[]> data; // allocated by reserve() (untouched pages until data comes)
+        size_t size; // capacity
+        size_t start; // first byte not consumed yet
+        size_t end; // one past the last byte received
+        size_t scanned; // [scanned, end) wasn't scanned yet (a partial line isn't scanned twice)
+        bool discarding; // the rest of an overlong line is dropped up to the next '\n'
+        uint32_t lines[LINE_BATCH]; // newlines found by the last scan (absolute offsets)
+        size_t lineCount;
+        size_t lineIndex; // next one to hand out
+
+    public:
+        Line_buffer();
+        Line_buffer(Line_buffer &&other) noexcept;
+        Line_buffer &operator=(Line_buffer &&other) noexcept;
+        Line_buffer(const Line_buffer &other) = delete;
+        Line_buffer &operator=(const Line_buffer &other) = delete;
+
+    public:
+        // Buffer_pool interface
+        void    reserve(size_t capacity); // allocates the storage (once: the capacity never changes after that)
+        void    clear(void); // forgets the buffered bytes, keeps the storage
+        size_t  capacity(void) const;
+        size_t  pending(void) const; // bytes buffered and not handed out as lines yet (the partial line)
+        std::string_view unhandled(void) const; // those bytes (hot restart: they go to the successor)
+
+        char    *tail(size_t *room); // where the next bytes go (*room > 0 as long as the capacity exceeds maxLength + 1)
+        void    commit(size_t bytes); // bytes were written at tail()
+        Status  nextLine(std::string_view *line, size_t maxLength); // the view is valid until the next tail()/clear()
+
+    private:
+        bool    scan(void); // next batch of newline offsets (false: none left in the buffer)
+};
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef LOG_URING_HPP
+#define LOG_URING_HPP
+
+// appends whole log batches through io_uring (raw syscalls, no liburing)
+// the batch buffers and the log fd are registered once, a batch is one IORING_OP_WRITE_FIXED.
+// one write is in flight at a time: a batch is submitted once the previous one completed and a short or failed one was
+// finished with write(), so the file keeps the submission order (a link chain can't span two io_uring_enter calls, the
+// batches come one by one). the next batch is filled while the previous one is written.
+// completions are reaped from the shared completion ring, a syscall is only spent waiting for a write that's still running
+// owned by a single thread (the async log writer)
+
+#include <cstddef>
+#include <cstdint>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+class Log_uring {
+    public:
+        static constexpr size_t MAX_BUFFERS = 8;
+
+    private:
+        int ringFd; // -1: not set up
+        int fileFd; // the registered log fd (also used for the synchronous completion of short writes)
+
+        // submission queue
+        unsigned *sqTail;
+        unsigned *sqMask;
+        unsigned *sqArray;
+        struct io_uring_sqe *sqes;
+
+        // completion queue
+        unsigned *cqHead;
+        unsigned *cqTail;
+        unsigned *cqMask;
+        struct io_uring_cqe *cqes;
+
+        void *sqRing;
+        size_t sqRingSize;
+        void *cqRing; // == sqRing with IORING_FEAT_SINGLE_MMAP
+        size_t cqRingSize;
+        size_t sqesSize;
+
+        // registered buffers, used round robin
+        char *buffers;
+        size_t bufferSize;
+        size_t bufferCount;
+        size_t current; // next buffer to fill
+        size_t lengths[MAX_BUFFERS]; // bytes submitted from each buffer
+        size_t written[MAX_BUFFERS]; // bytes io_uring wrote from each buffer (< lengths: the rest is still to write)
+        bool inFlight[MAX_BUFFERS];
+        size_t previous; // the buffer submitted last
+        bool shortWrites; // some completed buffer has bytes left to write
+
+    public:
+        Log_uring();
+        ~Log_uring();
+        Log_uring(const Log_uring &other) = delete;
+        Log_uring &operator=(const Log_uring &other) = delete;
+
+    private:
+        void reapCompletions(void); // consumes the available completions
+        bool waitFor(size_t index); // until buffer index is no longer in flight
+        bool finishShortWrites(void); // waits for every buffer, then writes what io_uring left (false: a write failed for good)
+        void teardown(void);
+
+    public:
+        bool    setup(int fd, size_t bufferSize, size_t bufferCount); // false (errno set) when io_uring is unavailable, nothing is kept then
+        bool    active(void) const;
+        char    *acquire(void); // the next buffer to fill (bufferSize bytes), nullptr if a write failed
+        bool    submit(size_t len); // after the previous write completed: the acquired buffer's first len bytes (one io_uring_enter)
+        bool    drain(void); // waits for every submitted write
+        bool    updateFile(void); // the log fd now refers to another file (rotation): drains, then registers it again
+};
+
+#endif
@@ -1,41 +1,173 @@
 #ifndef MATT_DAEMON_HPP
 #define MATT_DAEMON_HPP
 
+#include "Admission.hpp"
+#include "Buffer_pool.hpp"
+#include "Handoff.hpp"
+#include "Latency_stats.hpp"
+#include "Line_buffer.hpp"
+#include "Net_uring.hpp"
+#include "Reactor.hpp"
+#include "Slot_map.hpp"
+#include "Stall_watchdog.hpp"
+#include "Timer_wheel.hpp"
 #include "Tintin_reporter.hpp"
+#include <algorithm>
 #include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <vector>
+#include <netdb.h>
+#include <sys/socket.h>
 
 // singleton
 
 class Matt_daemon {
+    public:
+        enum LongLinePolicy {
+            TRUNCATE, // the first maxLineLength bytes are handled, the rest of the line is dropped
+            DISCONNECT // the client is closed
+        };
+
+        enum Engine {
+            ENGINE_EPOLL, // readiness: epoll_wait, then recv() until EAGAIN
+            ENGINE_URING // completions: multishot accept/recv into provided buffers (falls back to epoll before linux 6.0)
+        };
+
+        struct Options {
+            size_t maxClients = 3; // connections served at once, all workers together (the fd limit is raised to fit)
+            size_t workers = 1; // event loop threads, each with its own SO_REUSEPORT listener, reactor and clients
+            size_t maxLineLength = 4096; // bytes (the log records hold 4096 bytes of message)
+            LongLinePolicy longLines = TRUNCATE;
+            size_t readSize = 16384; // bytes a recv() may return (a client buffer is maxLineLength + 1 + readSize bytes)
+            Engine engine = ENGINE_EPOLL;
+            int backlog = SOMAXCONN; // pending connections per listening socket
+            long retryAfterMs = 1000; // suggested to the refused clients ("busy, retry after N ms")
+            size_t memoryBudget = 0; // bytes of partial lines buffered by all the clients (0: no budget)
+            unsigned cpuBudget = 0; // percent of a worker's time spent handling events (0: no budget)
+            long idleTimeoutSec = 0; // clients silent for that long are disconnected (0: never)
+            size_t latencySampleEvery = 16; // one line (and log record) in N is timed for the latency histograms (rounded up to a power of two)
+            bool answerLatency = false; // a "latency" line is answered with the percentiles since startup and not logged
+            long latencyReportSec = 60; // the latency percentiles of the last period are logged this often (0: never, idle periods: nothing)
+            long stallThresholdMs = 250; // an event loop iteration (or a log writer batch) running longer is logged (0: no watchdog)
+            bool stallBacktrace = false; // and the stalled thread logs its backtrace
+            bool ipv6 = false; // the TCP listener is [::]:4242, dual stack (IPv4 clients arrive as v4-mapped addresses)
+            std::string unixPath; // also listen on this AF_UNIX stream socket ("@name": abstract namespace, empty: none)
+            bool answerPing = false; // a "ping" line is answered "pong" and not logged (the benchmarks' round trip probe)
+            bool waitReady = false; // the launching command only returns once the server is created (exit status 1: it failed)
+            std::string statsPath = "/run/matt_daemon.stats"; // counters mapped for matt_stat (empty: none)
+            std::string executable; // hot restart (SIGUSR2): the binary the successor runs (main resolves it at startup)
+            std::vector<std::string> arguments; // and its argv (ours)
+        };
+
     private:
         static std::atomic<int> receivedSignal;
         static std::atomic<int> quitRequested;
-        static constexpr int MAX_CLIENTS = 3;
+        static std::atomic<int> reopenRequested; // SIGHUP: the log file has to be rotated/reopened
+        static std::atomic<int> restartRequested; // SIGUSR2: hot restart, the sockets go to a new process
+        static constexpr size_t RESERVED_FDS = 64; // fds besides the clients (log, lock, epoll, listener, ...), per worker
+        static constexpr size_t POOLED_BUFFERS_MAX = 4096; // free read buffers kept for the next connections
+        static constexpr unsigned URING_ENTRIES = 256; // submission queue of a worker's ring (the completion queue is 16 times larger)
+        static constexpr unsigned URING_BUFFERS = 256; // provided buffers of readSize bytes per worker
+        static constexpr int READS_PER_TURN = 16; // a client's reads (io_uring: received chunks) per loop turn (a fast sender can't starve the others)
+        static constexpr long PRESSURE_WINDOW_MS = 1000; // cpu usage of a worker is measured over such windows
+        static constexpr long TIMER_TICK_MS = 10; // resolution of the workers' timer wheels
+        static constexpr long HANDOFF_DRAIN_MS = 1000; // hot restart: how long a ring's cancelled requests may take to complete
+
+        enum Endpoint {
+            TCP_ENDPOINT, // the worker's own listener on PORT
+            UNIX_ENDPOINT // --unix: one listener, every worker watches it
+        };
+
+        enum Task {
+            CPU_WINDOW = 1, // --cpu-budget: end of a cpu measurement window
+            LATENCY_REPORT // --latency-report: summary of the latency histograms (first worker only)
+        };
         static constexpr const char *PORT = "4242";
         static constexpr const char *lockFile = "/var/lock/matt_daemon.lock";
 
     private:
         struct Client {
             int fd;
-            std::string buffer; 
+            Line_buffer buffer; // received bytes, lines are handled in place
+            bool receiving; // io_uring engine: the multishot recv is still armed (it has to be cancelled before closing)
+            bool unfinished; // its read budget ran out (epoll: socket not drained, io_uring: chunks kept in received), it's in the worker's unfinished list
+            uint64_t admitted; // admission order in its worker (the newest client is shed first under cpu pressure)
+            size_t buffered; // bytes of its partial line counted in the memory budget
+            int64_t lastActiveMs; // when it last sent something (monotonic clock)
+            Timer_wheel::Id idleTimer; // --idle-timeout (0: none armed)
+            std::string received; // io_uring engine: chunks past its read budget, handled in a later turn (hot restart: handed off with the rest)
+            uint64_t turn; // io_uring engine: the worker turn turnReads counts
+            int turnReads; // io_uring engine: chunks handled in that turn
 
             private:
                 Client();
 
             public:
-                Client(int fd): fd(fd) {}
+                Client(int fd, Line_buffer &&buffer, uint64_t admitted):
+                    fd(fd), buffer(std::move(buffer)), receiving(false), unfinished(false), admitted(admitted), buffered(0), lastActiveMs(0), idleTimer(0), turn(0), turnReads(0) {}
+        };
+
+        // one event loop: the kernel spreads the connections over the workers' listening sockets (SO_REUSEPORT),
+        // a client is only ever touched by the worker that accepted it
+        struct Worker {
+            int listenFd; // TCP socket listening for connection requests (the unix one is shared: unixFd)
+            Slot_map<Client> clients; // the reactor tokens carry the handles
+            Buffer_pool<Line_buffer> bufferPool; // read buffers of the closed clients
+            Reactor reactor; // listenFd, the wakeup eventfd and the client sockets (opened by createServer(), in the daemon process)
+            std::vector<Slot_map<Client>::Handle> unfinished; // clients whose read budget ran out before their socket was drained
+            std::vector<Slot_map<Client>::Handle> revisited; // the unfinished list being served (kept to reuse its storage)
+            Net_uring uring; // --engine=uring: replaces the reactor when it could be set up
+            std::thread thread; // not started for the first worker: it runs on the main thread (the one signals are delivered to)
+            uint64_t admissions; // clients admitted so far
+            int64_t windowStartNs; // start of the current cpu measurement window (monotonic clock)
+            int64_t windowCpuNs; // cpu time of the worker's thread when the window started
+            bool pressure; // the last window was over the cpu budget: newcomers are refused, the newest client is shed
+            Timer_wheel timers; // idle timeouts (CLIENT tokens) and periodic tasks (TIMER tokens)
+            int64_t nowMs; // monotonic clock, read after each wait
+            uint64_t turns; // io_uring engine: loop turns so far (the clients' read budgets are per turn)
+
+            Worker(size_t maxClients, size_t bufferCapacity, int64_t nowMs):
+                listenFd(-1),
+                clients(maxClients),
+                bufferPool(bufferCapacity, std::min(maxClients, POOLED_BUFFERS_MAX), bufferCapacity),
+                admissions(0),
+                windowStartNs(0),
+                windowCpuNs(0),
+                pressure(false),
+                timers(TIMER_TICK_MS, nowMs),
+                nowMs(nowMs),
+                turns(0) {}
         };
 
     private:
         int lockFd; // lockfile file descriptor (shouldn't be closed as the lock will be released)
-        int listenFd; // socket listening for connection requests
-        std::vector<Client> clients; // clients sockets
+        int wakeFd; // eventfd watched by every worker, written once to stop them all
+        int unixFd; // --unix listener (-1: none), shared by the workers
+        int readyFd; // --wait-ready: write end of the pipe the launching parent reads (-1: none, or notified)
+        Options options;
+        std::vector<std::unique_ptr<Worker> > workers; // created with the server
+        Admission admission; // connection limit and budgets of all the workers
+        std::atomic<bool> stopping; // a worker left its loop (quit, signal, epoll failure), the others follow
+        std::atomic<int> successorFd; // hot restart: our end of the handoff socket, the successor is up (-1: none)
+        pid_t successorPid;
+        std::mutex handoffMutex; // hot restart: the worker threads wait there while the first worker hands off
+        std::condition_variable handoffChanged;
+        size_t parkedWorkers; // under handoffMutex: worker threads waiting for the handoff's outcome
+        uint64_t handoffRound; // under handoffMutex: handoffs decided so far (the parked threads wait for the next one)
+        bool resumeServing; // under handoffMutex: the last handoff failed, the workers serve again
+        bool lockHandedOff; // the lock fd went (or may have gone) to a successor: never unlocked nor unlinked by us
+        bool handedOff; // the successor took everything over
+        Latency_histogram::Snapshot latencyReported[Latency_stats::STAGES]; // merged histograms at the last periodic summary
         const Tintin_reporter &tintin_reporter;
 
     private:
-        Matt_daemon(const Tintin_reporter &tintin_reporter);
+        Matt_daemon(const Tintin_reporter &tintin_reporter, const Options &options);
 
     public:
         ~Matt_daemon();
@@ -44,21 +176,59 @@ class Matt_daemon {
         Matt_daemon &operator=(const Matt_daemon &other) = delete; // no copy assignment
 
     public:
-        void start(void);
+        void start(Handoff::State *inherited = nullptr); // inherited: started by a hot restart (the sockets and the lock are taken over)
 
     public:
-        static Matt_daemon &getMattDaemon(const Tintin_reporter &tintin_reporter); // returns always the same Matt_daemon instance
+        static Matt_daemon &getMattDaemon(const Tintin_reporter &tintin_reporter); // returns always the same Matt_daemon instance (default options)
+        static Matt_daemon &getMattDaemon(const Tintin_reporter &tintin_reporter, const Options &options); // options are only honored by the first call
 
     private:
         static void signalHandler(int sig);
+        static void reopenHandler(int sig);
+        static void restartHandler(int sig);
         void setupSignals(void) const;
-        void createServer(void);
+        void createServer(Handoff::State *inherited); // the inherited listeners are reused, the missing ones created
+        void createListener(Worker &worker, const struct addrinfo *res); // bound and listening
+        void watchListeners(Worker &worker); // opens the worker's reactor, watches its listener, the unix one and the wakeup eventfd
+        void adoptClients(std::vector<Handoff::Client> &clients); // hot restart: spread over the workers, their pending bytes handled first
+        void createUnixListener(void); // --unix: bound and listening (the workers watch it)
+        int  listenerFd(const Worker &worker, uint64_t endpoint) const;
         void cleanup(void);
-        void eventLoop(void);
+        void startWorkers(void); // runs every worker but the first one in its own thread (and the stall watchdog)
+        void stopWorkers(void); // wakes every worker up so they leave their loops
+        void joinWorkers(void);
+        bool running(void) const; // no quit request, no signal, no worker stopped
+        void runWorker(Worker &worker); // the worker's event loop, with its engine
+        bool awaitHandoff(Worker &worker); // after the loop: true if a failed handoff sends the worker back to serving
+        void resumeAfterHandoff(void); // the handoff failed: the successor is killed, the workers are made to serve again
+        void eventLoop(Worker &worker);
+        void uringLoop(Worker &worker);
         void createLockFile(void); // should be called before daemonization (as it requires a controlling terminal to report errors before it exits)
-        void removeLockFile(void) const; // releases the lock, closes the lockFd and removes the lock file
-        void daemonize(void) const;
-        void handleMessage(const std::string &line) const;
+        void removeLockFile(void) const; // releases the lock, closes the lockFd and removes the lock file (only closes it once handed off)
+        void daemonize(void); // forks twice, closes the inherited fds, stdio on /dev/null
+        void notifyReady(void); // --wait-ready: one byte to the launching parent
+        void spawnSuccessor(void); // hot restart: starts the new process, stops the workers once it's up
+        void drainUring(Worker &worker); // hot restart: cancels the multishot requests, keeps what they still completed with
+        bool handOff(void); // hot restart: sends the lock, the listeners and the clients, then closes our copies (false: we keep them)
+        void acceptClients(Worker &worker, int listenFd); // accepts until the backlog is empty (edge-triggered)
+        Slot_map<Client>::Handle addClient(Worker &worker, int clientFd); // 0: refused (connection limit, pressure), the fd is closed
+        void startTimers(Worker &worker); // arms the periodic tasks, from the worker's thread
+        long pollTimeout(Worker &worker); // until the next timer or log flush (0: unfinished clients, -1: none)
+        void runTimers(Worker &worker); // after each batch: the expired timers
+        void expireIdle(Worker &worker, Slot_map<Client>::Handle handle); // idle timer of a client: closes it or rearms for the rest
+        void reportLatency(void); // --latency-report: percentiles of what every stage recorded since the last report
+        void checkCpu(Worker &worker); // every PRESSURE_WINDOW_MS: cpu share of the window, sheds the newest client
+        void checkMemory(Worker &worker); // after each batch: sheds its biggest holders while the daemon is over the memory budget
+        void accountBuffered(Client &client); // its partial line's size changed (memory budget)
+        void serveClient(Worker &worker, Slot_map<Client>::Handle handle); // epoll engine: reads it, closes it if it's gone
+        bool readClient(Client &client, bool *drained); // reads until EAGAIN (*drained) or READS_PER_TURN reads, handles every complete line (false: the client is gone)
+        bool receiveClient(Client &client, const char *data, size_t len, size_t *taken); // io_uring engine: a chunk received in a provided buffer (*taken: less than len if stopping)
+        void deferChunk(Worker &worker, Slot_map<Client>::Handle handle, Client &client, const char *data, size_t len); // io_uring engine: over the read budget, kept for a later turn
+        bool resumeClient(Worker &worker, Slot_map<Client>::Handle handle, Client &client); // io_uring engine: a turn's worth of its kept chunks (false: the client is gone)
+        bool handleLines(Client &client, int64_t readNs); // every complete line buffered (readNs: when its bytes came in; false: the client has to be closed)
+        void closeClient(Worker &worker, Slot_map<Client>::Handle handle); // closes the socket, recycles the read buffer, frees the slot
+        void handleMessage(Client &client, std::string_view line) const;
+        void replyLatency(Client &client) const; // the "latency" command: p50/p99/p999/max per stage
 };
 
 #endif
@@ -0,0 +1,83 @@
+#ifndef NET_URING_HPP
+#define NET_URING_HPP
+
+// completion-based network engine over io_uring (raw syscalls, no liburing), one per worker
+// a listening socket is armed once with a multishot accept, each client once with a multishot recv: the kernel picks
+// a buffer from a provided buffer ring for every chunk it receives, and one io_uring_enter() both submits the new
+// requests and waits for a whole batch of completions (accepted fds, received chunks) => far less than a syscall per line.
+// needs linux >= 6.0 (multishot recv), setup() fails on older kernels and the caller keeps using epoll.
+// the ring starts disabled and is bound to the thread that calls enable() (IORING_SETUP_SINGLE_ISSUER)
+
+#include <cstddef>
+#include <cstdint>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
+
+class Net_uring {
+    public:
+        struct Completion {
+            uint64_t tag; // user data of the request (0: a cancellation)
+            int32_t res; // accepted fd, bytes received, -errno
+            uint32_t flags; // IORING_CQE_F_*
+        };
+
+    private:
+        int ringFd; // -1: not set up
+        unsigned toSubmit; // queued entries io_uring_enter() hasn't consumed yet
+
+        // submission queue
+        unsigned *sqHead;
+        unsigned *sqTail;
+        unsigned *sqMask;
+        unsigned *sqArray;
+        unsigned sqEntries;
+        struct io_uring_sqe *sqes;
+
+        // completion queue
+        unsigned *cqHead;
+        unsigned *cqTail;
+        unsigned *cqMask;
+        struct io_uring_cqe *cqes;
+
+        void *sqRing;
+        size_t sqRingSize;
+        void *cqRing; // == sqRing with IORING_FEAT_SINGLE_MMAP
+        size_t cqRingSize;
+        size_t sqesSize;
+
+        // provided buffers (group 0): the kernel takes them from the ring, recycle() puts them back
+        struct io_uring_buf_ring *bufRing;
+        size_t bufRingSize;
+        char *buffers;
+        size_t bufferSize;
+        unsigned bufferCount; // power of 2
+
+    public:
+        Net_uring();
+        ~Net_uring();
+        Net_uring(const Net_uring &other) = delete;
+        Net_uring &operator=(const Net_uring &other) = delete;
+
+    private:
+        struct io_uring_sqe *nextSqe(void); // nullptr if the queue is full and can't be flushed
+        void                teardown(void);
+
+    public:
+        bool        setup(unsigned entries, size_t bufferSize, unsigned bufferCount); // false (errno set) if the kernel can't, nothing is kept then
+        bool        enable(void); // from the thread that will submit (the ring starts disabled)
+        bool        active(void) const;
+
+        bool        acceptMultishot(int listenFd, uint64_t tag); // one completion per accepted connection (SOCK_NONBLOCK | SOCK_CLOEXEC fds)
+        bool        recvMultishot(int fd, uint64_t tag); // one completion per chunk, in a provided buffer
+        bool        pollMultishot(int fd, uint64_t tag); // one completion whenever fd becomes readable
+        bool        cancel(uint64_t tag); // the request tagged tag (its last completion has -ECANCELED)
+
+        int         wait(long timeoutMs); // submits the queued requests, waits for a completion (-1 and errno on failure, EINTR included), timeoutMs < 0: no timeout
+        bool        next(Completion *completion); // pops the next completion (false: none left)
+        const char  *buffer(uint16_t id) const; // the provided buffer of a completion (id: flags >> IORING_CQE_BUFFER_SHIFT)
+        void        recycle(uint16_t id); // hands the buffer back to the kernel
+};
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef NEWLINE_SCANNER_HPP
+#define NEWLINE_SCANNER_HPP
+
+// finds every '\n' of a chunk in one pass: 16 (SSE2) or 32 (AVX2) bytes compared at once, the match mask is turned
+// into offsets bit by bit. the implementation is picked once at runtime (AVX2 when the cpu has it), scalar elsewhere
+
+#include <cstddef>
+#include <cstdint>
+
+class Newline_scanner {
+    public:
+        // offsets of the newlines of data[0, len) (relative to data), maxOffsets at most; *scanned: bytes covered
+        // (len, or one past the last offset returned when the array filled up: scan again from there)
+        typedef size_t (*ScanFn)(const char *data, size_t len, uint32_t *offsets, size_t maxOffsets, size_t *scanned);
+
+    public:
+        Newline_scanner() = delete;
+
+    public:
+        static size_t      scan(const char *data, size_t len, uint32_t *offsets, size_t maxOffsets, size_t *scanned); // best available
+        static const char  *implementation(void); // "avx2", "sse2" or "scalar"
+
+        static size_t      scanScalar(const char *data, size_t len, uint32_t *offsets, size_t maxOffsets, size_t *scanned);
+#if defined(__x86_64__) || defined(__i386__)
+        static size_t      scanSse2(const char *data, size_t len, uint32_t *offsets, size_t maxOffsets, size_t *scanned);
+        static size_t      scanAvx2(const char *data, size_t len, uint32_t *offsets, size_t maxOffsets, size_t *scanned); // the cpu must support it
+#endif
+
+    private:
+        static ScanFn      resolve(void);
+};
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef SLOT_MAP_HPP
+#define SLOT_MAP_HPP
+
+// fixed capacity slot map: O(1) insert, lookup and remove, values never move (slots are allocated once)
+// a handle is (generation << 32 | index), the generation changes whenever a slot is freed,
+// so a handle kept by someone else (an epoll event of the same batch, a timer...) can't reach the slot's next owner.
+// the slots are handed out from a high-water mark before the free list is used: construction doesn't touch the
+// storage, only the slots ever used get their pages (a map sized for 100k clients costs nothing until they come)
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+template <typename T>
+class Slot_map {
+    public:
+        typedef uint64_t Handle; // 0 is never a valid handle
+        static constexpr uint32_t GENERATION_MASK = 0xFFFFFF; // 24 bits: handles fit in 56 bits (room for a tag above)
+
+    private:
+        struct Slot {
+            alignas(T) unsigned char storage[sizeof(T)];
+            uint32_t generation; // odd: used, even: free
+        };
+
+        std::unique_ptr<Slot[]> slots; // allocated once, never reallocated (left uninitialized)
+        size_t slotCount; // capacity
+        size_t used; // [0, used) were handed out at least once (their generation is valid)
+        std::vector<uint32_t> freeSlots; // stack of freed indices below used
+        size_t count;
+
+    public:
+        explicit Slot_map(size_t capacity): slots(new Slot[capacity]), slotCount(capacity), used(0), count(0) {
+            this->freeSlots.reserve(capacity);
+        }
+
+        ~Slot_map() {
+            for (size_t i = 0; i < this->used; ++i) {
+                if (this->slots[i].generation & 1) {
+                    reinterpret_cast<T *>(this->slots[i].storage)->~T();
+                }
+            }
+        }
+
+        Slot_map(const Slot_map &other) = delete;
+        Slot_map &operator=(const Slot_map &other) = delete;
+
+    public:
+        // constructs a value in a free slot, returns its handle (0 if the map is full)
+        template <typename... Args>
+        Handle insert(Args &&...args) {
+            uint32_t index;
+            if (!this->freeSlots.empty()) {
+                index = this->freeSlots.back();
+            } else if (this->used < this->slotCount) {
+                index = (uint32_t)this->used;
+                this->slots[index].generation = 0;
+            } else {
+                return (0);
+            }
+
+            Slot &slot = this->slots[index];
+            new (slot.storage) T(std::forward<Args>(args)...);
+            if (index == this->used) {
+                this->used += 1;
+            } else {
+                this->freeSlots.pop_back();
+            }
+            slot.generation = (slot.generation + 1) & GENERATION_MASK;
+            this->count += 1;
+            return (((Handle)slot.generation << 32) | index);
+        }
+
+        // nullptr if the handle is stale (its slot was freed since)
+        T *get(Handle handle) {
+            uint32_t index = (uint32_t)handle;
+            if (index >= this->used || this->slots[index].generation != (uint32_t)(handle >> 32) || !(this->slots[index].generation & 1)) {
+                return (nullptr);
+            }
+            return (reinterpret_cast<T *>(this->slots[index].storage));
+        }
+
+        bool remove(Handle handle) {
+            T *value = this->get(handle);
+            if (value == nullptr) {
+                return (false);
+            }
+
+            uint32_t index = (uint32_t)handle;
+            value->~T();
+            this->slots[index].generation = (this->slots[index].generation + 1) & GENERATION_MASK;
+            this->freeSlots.push_back(index);
+            this->count -= 1;
+            return (true);
+        }
+
+        // calls fn(handle, value) for every live value (fn must not insert or remove)
+        template <typename Fn>
+        void forEach(Fn fn) {
+            for (size_t i = 0; i < this->used; ++i) {
+                if (this->slots[i].generation & 1) {
+                    fn(((Handle)this->slots[i].generation << 32) | i, *reinterpret_cast<T *>(this->slots[i].storage));
+                }
+            }
+        }
+
+        size_t size(void) const {
+            return (this->count);
+        }
+
+        size_t capacity(void) const {
+            return (this->slotCount);
+        }
+};
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef STATS_PAGE_HPP
+#define STATS_PAGE_HPP
+
+// counters shared with matt_stat through a file mapped by both (under /run: tmpfs, never written back to a disk).
+// the daemon only ever stores into the mapping and the tool only loads from it: reading them costs the daemon nothing,
+// not even a syscall. one slot (cache line aligned) per thread that attached, which only that thread writes (relaxed
+// load + store, no locked instruction), and a shared slot for the others (relaxed fetch_add). the header is a seqlock:
+// a reader retries while a thread registers its slot (its name and the number of slots in use change together)
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+
+class Stats_page {
+    public:
+        enum Counter {
+            ACCEPTED, // connections admitted
+            REFUSED, // connections told "busy" (limit, pressure, no slot)
+            CLOSED, // connections closed (disconnected, shed, timed out)
+            READS, // recv() calls (or io_uring completions) that returned bytes
+            BYTES, // bytes received from the clients
+            LINES, // complete lines handled
+            LOG_RECORDS, // records that went past the logger's filters
+            LOG_DROPPED, // records lost to the overflow policy
+            LOG_WRITTEN, // records written to the log file
+            LOG_BATCHED, // records the async writer took out of the ring
+            LOG_QUEUE_US, // sum of their time from log() to written (coarse clock: avg = LOG_QUEUE_US / LOG_BATCHED)
+            COUNTERS
+        };
+
+        static constexpr uint64_t MAGIC = 0x5354415453444d4dULL; // "MMDSTATS"
+        static constexpr uint32_t VERSION = 1;
+        static constexpr size_t NAME_WORDS = 2; // a slot name is 16 bytes (atomics, so readers never race a writer)
+
+        struct alignas(64) Slot {
+            std::atomic<uint64_t> name[NAME_WORDS]; // null padded, all zero: free
+            std::atomic<uint64_t> values[COUNTERS];
+        };
+
+        // the fields before sequence never change once the file is in place
+        struct alignas(64) Header {
+            uint64_t magic;
+            uint32_t version;
+            uint32_t slotSize; // sizeof(Slot): a tool built against another layout refuses the page
+            uint32_t slotCount;
+            uint32_t counterCount;
+            int64_t pid;
+            int64_t startedAt; // realtime, seconds
+            std::atomic<uint32_t> sequence; // odd while a slot is being registered
+            std::atomic<uint32_t> slotsUsed;
+        };
+
+    private:
+        static Header *header;
+        static Slot *slots; // slots[0] is the shared one
+        static std::string path;
+        static dev_t device; // of the file we created: close() leaves a successor's page alone
+        static ino_t inode;
+        static std::mutex attachMutex;
+        static std::atomic<Slot *> shared; // the threads without a slot of their own count there
+        inline static thread_local Slot *current = nullptr; // the calling thread's own slot
+
+    public:
+        Stats_page() = delete;
+
+    public:
+        static bool open(const std::string &path, size_t threads); // a fresh page with room for that many threads (false: errno says why)
+        static void attach(const char *name); // gives the calling thread a slot (the shared one once they're all taken)
+        static void close(void); // removes the file if it's still ours (the mapping stays: the threads count until we exit)
+        static void add(Counter counter, uint64_t count = 1); // hot path
+        static const char *counterName(Counter counter);
+        static size_t pageSize(size_t slots); // bytes of a page with that many slots
+};
+
+inline void Stats_page::add(Counter counter, uint64_t count) {
+    Slot *slot = Stats_page::current;
+
+    // single writer: a plain add, nobody else stores into this slot
+    if (slot != nullptr) {
+        slot->values[counter].store(slot->values[counter].load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+        return;
+    }
+    slot = Stats_page::shared.load(std::memory_order_acquire);
+    if (slot != nullptr) {
+        slot->values[counter].fetch_add(count, std::memory_order_relaxed);
+    }
+}
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef TIMER_WHEEL_HPP
+#define TIMER_WHEEL_HPP
+
+// hierarchical timer wheel (4 levels of 64 slots, like the kernel's old cascading timers): O(1) arm, rearm and cancel,
+// expiry walks the ticks that elapsed and a level > 0 slot is only redistributed (cascaded) to the lower levels when
+// the level below wraps around. a timer is a 64-bit datum for the owner (e.g. a Reactor token) and may be periodic.
+// nextTimeout() reads the slot bitmaps: the event loop sleeps until the next tick that has work (an expiry or a cascade).
+// not thread safe: each event loop owns its wheel
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class Timer_wheel {
+    public:
+        typedef uint64_t Id; // (generation << 32 | index), 0 is never a valid timer
+
+        struct Expired {
+            Id id; // still armed if the timer is periodic
+            uint64_t data;
+        };
+
+    private:
+        static constexpr unsigned LEVEL_BITS = 6;
+        static constexpr unsigned SLOTS = 1 << LEVEL_BITS; // per level
+        static constexpr unsigned LEVELS = 4; // delays up to 64^4 ticks, longer ones are parked in the last level
+        static constexpr uint64_t MAX_DELTA = ((uint64_t)1 << (LEVEL_BITS * LEVELS)) - 1;
+        static constexpr uint32_t NIL = UINT32_MAX;
+        static constexpr uint16_t DUE = LEVELS * SLOTS; // list of the timers expiring at the last processed tick
+        static constexpr uint16_t UNARMED = UINT16_MAX;
+
+        struct Node {
+            uint64_t expiry; // tick
+            uint64_t periodTicks; // 0: one shot
+            uint64_t data;
+            uint32_t prev; // NIL: first of its list
+            uint32_t next; // slot list, or free list
+            uint32_t generation; // odd: armed, even: free
+            uint16_t list; // level * SLOTS + slot, DUE or UNARMED
+        };
+
+        long tickMs;
+        int64_t originMs; // time of tick 0
+        uint64_t current; // next tick to process (the ones before it have expired)
+        std::vector<Node> nodes;
+        uint32_t freeHead;
+        size_t armedCount;
+        uint32_t heads[LEVELS * SLOTS + 1]; // + DUE
+        uint64_t occupied[LEVELS]; // bit per non-empty slot
+
+    public:
+        Timer_wheel(long tickMs, int64_t originMs);
+        Timer_wheel(const Timer_wheel &other) = delete;
+        Timer_wheel &operator=(const Timer_wheel &other) = delete;
+
+    private:
+        Node        *find(Id id);
+        uint64_t    tickAt(int64_t nowMs, bool roundUp) const;
+        void        place(uint32_t index); // in the slot its expiry falls in, relative to current
+        void        link(uint32_t index, uint16_t list);
+        void        unlink(uint32_t index);
+        void        cascade(unsigned level); // redistributes the slot of current at that level
+        void        processTick(void); // cascades, then moves the level 0 slot of current to DUE
+
+    public:
+        Id          arm(int64_t nowMs, long delayMs, uint64_t data, long periodMs = 0); // 0: out of memory
+        bool        rearm(Id id, int64_t nowMs, long delayMs); // keeps the id, data and period (false: not armed)
+        bool        cancel(Id id); // false: already expired (one shot) or cancelled
+        bool        expireNext(int64_t nowMs, Expired *expired); // pops the next timer due by nowMs (false: none left); periodic ones are rearmed first
+        long        nextTimeout(int64_t nowMs) const; // ms until the next tick with work, -1: nothing armed
+        size_t      armed(void) const;
+};
+
+#endif
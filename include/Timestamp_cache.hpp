@@ -0,0 +1,44 @@
+#ifndef TIMESTAMP_CACHE_HPP
+#define TIMESTAMP_CACHE_HPP
+
+// formats "dd/mm/YYYY-HH:MM:SS" once per second and shares it between threads through a seqlock
+// (localtime_r() and strftime() only run when the second changes)
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+
+class Timestamp_cache {
+    public:
+        enum Precision {
+            SECONDS, // dd/mm/YYYY-HH:MM:SS (the historical format)
+            MILLISECONDS, // dd/mm/YYYY-HH:MM:SS.mmm
+            MICROSECONDS // dd/mm/YYYY-HH:MM:SS.uuuuuu
+        };
+
+        static constexpr size_t MAX_LEN = 32; // enough for the longest precision (null terminator included)
+
+    private:
+        static constexpr const char *FORMAT = "%d/%m/%Y-%H:%M:%S";
+        static constexpr size_t SECONDS_LEN = 19; // strlen("dd/mm/YYYY-HH:MM:SS")
+        static constexpr size_t WORDS = 3; // the cached text as 8 byte words (atomics, so readers never race a writer)
+
+        std::atomic<uint32_t> seq; // odd while a writer updates the slot
+        std::atomic<int64_t> second; // the second the slot holds (-1: nothing yet)
+        std::atomic<uint64_t> words[WORDS];
+
+    public:
+        Timestamp_cache();
+        Timestamp_cache(const Timestamp_cache &other) = delete;
+        Timestamp_cache &operator=(const Timestamp_cache &other) = delete;
+
+    public:
+        size_t      format(char *out, const struct timespec &ts, Precision precision); // writes the timestamp into out (MAX_LEN bytes), returns its length
+        static void now(struct timespec *ts); // CLOCK_REALTIME_COARSE: a vDSO read, resolution is one kernel tick
+
+    private:
+        static size_t   formatSeconds(char *out, time_t t); // the slow path (localtime_r + strftime)
+};
+
+#endif
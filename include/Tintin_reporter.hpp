@@ -1,9 +1,26 @@
 #ifndef TINTIN_REPORTER_HPP
 #define TINTIN_REPORTER_HPP
 
-// singleton + thread-safety 
+// singleton + thread-safety
 
+#include "Latency_stats.hpp"
+#include "Log_compressor.hpp"
+#include "Log_format.hpp"
+#include "Log_ring.hpp"
+#include "Log_uring.hpp"
+#include "Mmap_log.hpp"
+#include "Stats_page.hpp"
+#include "Timestamp_cache.hpp"
+#include <atomic>
+#include <condition_variable>
 #include <cstddef>
+#include <cstdint>
+#include <climits>
+#include <ctime>
+#include <mutex>
+#include <sys/uio.h>
+#include <thread>
+#include <vector>
 
 class Tintin_reporter {
     public:
@@ -13,35 +30,248 @@ class Tintin_reporter {
             ERROR
         };
 
+        enum OverflowPolicy {
+            BLOCK, // log() waits for the writer to free a cell
+            DROP, // the new record is dropped (and counted)
+            DROP_OLDEST // the oldest pending record is dropped (and counted) to make room
+        };
+
+        enum Durability {
+            SYNC_NONE, // the page cache is trusted (no fdatasync)
+            SYNC_INTERVAL, // fdatasync at most every syncIntervalMs while there is unsynced data
+            SYNC_BATCH // fdatasync after every write batch (every record in sync mode)
+        };
+
+        enum Sink {
+            SINK_WRITE, // write()/writev() on an O_APPEND fd
+            SINK_MMAP, // memcpy into a preallocated, mapped segment of the log file
+            SINK_URING // async mode: each batch is one io_uring write (registered buffers and file), SINK_WRITE when io_uring is missing
+        };
+
+        enum Format {
+            FORMAT_TEXT, // "[dd/mm/YYYY-HH:MM:SS] [ TYPE ] - Matt_daemon: msg."
+            FORMAT_BINARY // Log_binary_header + payload + '\n', rendered offline by tintin_decode
+        };
+
+        // per LogType admission (checked by log() before anything is copied or formatted)
+        struct Filter {
+            bool enabled = true; // false: every record of this type is suppressed
+            uint32_t ratePerSec = 0; // token bucket refill rate (0: unlimited)
+            uint32_t burst = 0; // token bucket size (0: one second worth of ratePerSec)
+            uint32_t sampleEvery = 1; // keep one record in sampleEvery (1: keep all)
+        };
+
+        struct Options {
+            bool async = false; // log() only enqueues, a background thread formats and writes
+            size_t ringCapacity = 512; // number of preallocated records in the async ring
+            const char *ringFile = "/dev/shm/matt_daemon.ring"; // async mode: the ring lives in this shared file so a crash loses nothing (nullptr: anonymous memory)
+            OverflowPolicy overflowPolicy = BLOCK; // applies to LOG records, INFO and ERROR records always block
+            size_t batchMaxRecords = 64; // async mode: records per writev() at most (capped to IOV_MAX)
+            long batchMaxLatencyMs = 5; // async mode: how long a partial batch may wait for more records
+            Durability durability = SYNC_NONE;
+            long syncIntervalMs = 1000; // SYNC_INTERVAL period
+            Timestamp_cache::Precision timestampPrecision = Timestamp_cache::SECONDS; // optional sub-second field (FORMAT_TEXT)
+            Format format = FORMAT_TEXT;
+            Sink sink = SINK_WRITE;
+            size_t segmentSize = 4 * 1024 * 1024; // SINK_MMAP: bytes preallocated and mapped at once
+            uint64_t rotateSize = 0; // rotate once the file would grow past this many bytes (0: never)
+            long rotateIntervalSec = 0; // rotate when this much wall clock time passed since the last rotation (0: never)
+            bool compressRotated = true; // gzip rotated files from a low priority background thread
+            Filter filters[3]; // indexed by LogType
+            long suppressReportSec = 10; // how often "TYPE: N records suppressed in last Ms" is logged (0: never)
+            long coalesceMs = 0; // fold identical consecutive records into "last message repeated N times", flushed at least this often (0: off)
+        };
+
+        struct WriteStats {
+            uint64_t records; // records written to the log file
+            uint64_t writeCalls; // write()/writev() syscalls it took (SINK_MMAP appends don't take any)
+            uint64_t syncCalls; // fdatasync() syscalls
+        };
+
     private:
-        int fd; // file descriptor to the open log file
-        static constexpr size_t TIMESTAMP_MAX_LEN = 256;
+        int fd; // file descriptor to the open log file (the number never changes, rotation dup2()s the new file over it)
+        char logFilePath[PATH_MAX];
+        Options options;
+        mutable Timestamp_cache timestamps; // the formatted second, shared by every thread that formats records
+        mutable Mmap_log mmapLog; // SINK_MMAP only
         static constexpr size_t LOG_MAX_LEN = 4096;
-        static constexpr const char *TIMESTAMP_FORMAT = "%d/%m/%Y-%H:%M:%S";
+        static constexpr long WRITER_IDLE_WAIT_MS = 100; // the writer rechecks the ring at least this often
+        static constexpr size_t URING_BUFFERS = 4; // SINK_URING: registered batch buffers (one written, the next ones filled)
+        static constexpr time_t ROTATE_RETRY_SEC = 60; // after a failed rotation, the next attempt waits that long
 
+    // async mode (the state is mutable since logging through a const reference is the whole interface)
+    private:
+        mutable Log_ring ring; // pending records (empty when not in async mode)
+        mutable std::thread writer; // drains the ring into the log file
+        mutable std::atomic<bool> writerRunning;
+        mutable std::atomic<bool> writerStopping;
+        mutable std::atomic<bool> writerIdle; // the writer is (about to be) waiting on writerWakeup
+        inline static thread_local bool onWriter = false; // the calling thread is the writer
+        mutable std::mutex writerMutex;
+        mutable std::condition_variable writerWakeup;
+        mutable std::atomic<uint64_t> dropped; // records lost to the overflow policy (since startup)
+        mutable uint64_t droppedReported; // writer side: dropped records already reported in the log
+        mutable std::vector<char> batchBuffer; // writer side: LOG_MAX_LEN bytes per batched record (allocated once)
+        mutable std::vector<struct iovec> batchIov; // writer side: one iovec per batched record
+        mutable std::vector<Log_ring::Cell *> batchCells; // writer side: the cells are only released once their batch was written
+        mutable std::vector<int64_t> batchQueuedNs; // writer side: when the sampled records of the batch were logged (kept past their release)
+        mutable Log_uring uring; // writer side, SINK_URING only (inactive when io_uring is unavailable)
+        mutable std::atomic<uint64_t> fileGeneration; // bumped by every switchFile(), tells the writer to register the file again
+        mutable uint64_t uringGeneration; // writer side: the file generation registered in the uring
 
+    // filtering, rate limiting and sampling (the fast path of log() is one relaxed load of FilterState::mode)
     private:
-        explicit Tintin_reporter(const char *logFilePath);
+        enum FilterMode {
+            FILTER_PASS, // nothing to check
+            FILTER_OFF, // suppress everything
+            FILTER_LIMITED // rate limit and/or sampling
+        };
+
+        struct FilterState {
+            std::atomic<uint8_t> mode;
+            std::atomic<int64_t> emissionNs; // token bucket as GCRA: ns one record costs
+            std::atomic<int64_t> toleranceNs; // ns of credit the bucket can hold (burst - 1 records)
+            std::atomic<int64_t> tat; // theoretical arrival time of the next conforming record (steady clock ns)
+            std::atomic<uint32_t> sampleEvery;
+            std::atomic<uint64_t> sampleCounter;
+            std::atomic<uint64_t> suppressed; // since the last suppression report
+        };
+
+        mutable FilterState filterStates[3]; // indexed by LogType
+        mutable std::atomic<int64_t> lastSuppressReportMs;
+
+    // coalescing of identical consecutive records (compared by a 64-bit hash, the LogType in its two low bits)
+    private:
+        mutable std::mutex coalesceMutex; // the comparison, the count and the records they decide on, as one step
+        mutable uint64_t lastHash; // last record that went through (0: none)
+        mutable std::atomic<uint64_t> repeats; // records equal to it that were folded since (read without the lock: nothing pending)
+        mutable std::atomic<int64_t> repeatsSinceMs; // steady clock time of the first of them
+
+    // write accounting and durability
+    private:
+        mutable std::atomic<uint64_t> recordsWritten;
+        mutable std::atomic<uint64_t> writeCalls;
+        mutable std::atomic<uint64_t> syncCalls;
+        mutable std::atomic<bool> unsynced; // data was written since the last fdatasync
+        mutable std::atomic<int64_t> lastSyncMs; // steady clock time of the last fdatasync
+
+    // log rotation
+    private:
+        mutable std::atomic<uint64_t> fileBytes; // size of the current log file
+        mutable std::atomic<time_t> lastRotation; // wall clock time the current file was started
+        mutable std::atomic<time_t> rotateRetry; // a rotation failed: none is attempted before then (0: none failed)
+        mutable std::atomic<bool> rotationArmed; // size/interval rotation only starts in the daemon process (see startBackground)
+        mutable std::mutex rotateMutex;
+        mutable Log_compressor compressor;
+
+    private:
+        Tintin_reporter(const char *logFilePath, const Options &options);
 
     public:
         Tintin_reporter() = delete; // no default construction
         Tintin_reporter(const Tintin_reporter &other) = delete; // no copy
         Tintin_reporter &operator=(const Tintin_reporter &other) = delete; // no copy assignment
 
-        ~Tintin_reporter(); // destructor to cleanup resources acquired during construction
+        ~Tintin_reporter(); // destructor to cleanup resources acquired during construction (drains and joins the writer)
 
     // helpers
     private:
         void                logger(const char *msg, size_t len) const; // logs the message directly into the logFile
-        static void         getTimestamp(char *buff); // stores the timestamp in char *buff (thread-safe)
+        void                writeBatch(struct iovec *iov, size_t count) const; // writes a batch of records with as few writev() calls as possible
+        void                submitBatch(const struct iovec *iov, size_t count) const; // SINK_URING: packs the batch into a registered buffer and submits it
+        void                syncIfDue(bool wrote) const; // applies the durability policy (wrote: a record or a batch was just written)
+        void                dataSync(void) const;
+        static int64_t      nowMs(void); // steady clock, in milliseconds
+        static int64_t      nowNs(void); // steady clock (CLOCK_MONOTONIC), in nanoseconds
         static const char   *getLogTypeStr(LogType type); // returns the corresponding string (ERROR, INGO, LOG) to the type (returns a char *literal)
         static void         ensureDirExists(const char *path); // ensures the directory of the path exists (if it doesn't exists, it attemts to create it)
+        size_t              format(char *out, const struct timespec &ts, LogType type, const char *msg, size_t len) const; // encodes a record into out (LOG_MAX_LEN bytes, text or binary), returns its length
+        void                emit(LogType type, const char *msg, size_t len) const; // past the filters: into the ring (async mode) or the file
+        void                logNow(LogType type, const char *msg, size_t len) const; // sync mode: formats and writes the record from the calling thread
+        Log_ring::Cell      *acquireCell(LogType type) const; // async mode: a ring cell to fill, nullptr if the overflow policy dropped the record
+        void                commitCell(Log_ring::Cell *cell, LogType type) const; // async mode: stamps and publishes a filled cell (never formats, never writes)
+        void                wakeWriter(void) const;
+        void                writerLoop(void) const; // body of the writer thread
+        void                waitForRecords(long timeoutMs) const; // writer side: sleeps until a record is published (or timeout)
+        void                reportDropped(void) const; // writer side: logs how many records the overflow policy dropped
+        void                writeNotice(LogType type, const char *msg) const; // the logger's own record: through the ring while the writer runs, written right away by the writer itself (or without one)
+        bool                suppressed(LogType type) const; // the cheap check in front of every log() call
+        bool                admitLimited(LogType type) const; // FILTER_LIMITED: token bucket, then sampling (counts what it suppresses)
+        void                reportSuppressed(bool force) const; // logs the suppression counters once per suppressReportSec (force: now; the writer does it while it runs)
+        static uint64_t     hashMessage(const char *msg, size_t len);
+        void                emitCoalesced(LogType type, const char *msg, size_t len) const; // counts a repeat of the previous record, or emits the pending count then the record
+        void                reportRepeats(uint64_t hash, uint64_t count) const; // "last message repeated N times", as a record of the repeated type
+        int                 openLogFile(void) const; // opens logFilePath with the flags the sink needs
+        void                switchFile(int newFd) const; // atomically replaces the open log file by newFd (closes newFd)
+        void                maybeRotate(size_t incoming) const; // rotates if writing incoming more bytes crosses a limit
+        void                rotate(void) const; // renames the current file away, continues in a fresh one, queues the old one for compression
 
     // interface
     public:
         int getLogFileFd(void) const; // returns the log file fd
         void log(LogType type, const char *msg) const; // logs a log
-        static const Tintin_reporter &getLoggerInstance(const char *logFilePath);
+        template <LogType Type, typename Fmt, typename... Args>
+        void log(Fmt fmt, const Args &...args) const; // log<INFO>(TINTIN_FMT("pid {}"), pid): checked at compile time, rendered straight into the record
+        size_t recoverRing(void) const; // replays what a crashed run left in the ring file, then backs the async ring with it (call it once the lock is held)
+        void startBackground(void) const; // starts the writer thread (async mode) and arms rotation (call it after daemonizing, threads don't survive fork)
+        void stopAsync(void) const; // drains the ring, joins the writer thread and logs its write stats
+        void setFilter(LogType type, const Filter &filter) const; // can be changed at runtime, from any thread
+        long flushRepeats(void) const; // writes the pending repeat count once coalesceMs has passed, returns ms until the next check is due (-1: nothing pending)
+        void reopen(void) const; // SIGHUP: rotates if rotation is configured, otherwise reopens the path (the file was moved by someone else)
+        uint64_t getDroppedCount(void) const; // records dropped by the overflow policy since startup
+        WriteStats getWriteStats(void) const; // records written and syscalls spent (records per syscall = records / writeCalls)
+        static const Tintin_reporter &getLoggerInstance(const char *logFilePath); // default options
+        static const Tintin_reporter &getLoggerInstance(const char *logFilePath, const Options &options); // options are only honored by the first call
 };
 
+inline bool Tintin_reporter::suppressed(LogType type) const {
+    uint8_t mode = this->filterStates[type].mode.load(std::memory_order_relaxed);
+
+    if (mode == FILTER_PASS) {
+        return (false);
+    }
+    if (mode == FILTER_OFF) {
+        this->filterStates[type].suppressed.fetch_add(1, std::memory_order_relaxed);
+        this->reportSuppressed(false);
+        return (true);
+    }
+    return (!this->admitLimited(type));
+}
+
+template <Tintin_reporter::LogType Type, typename Fmt, typename... Args>
+void Tintin_reporter::log(Fmt, const Args &...args) const {
+    constexpr int placeholders = Log_format::count(Fmt::value());
+    static_assert(placeholders >= 0, "log format: '{' and '}' are only allowed as \"{}\" placeholders");
+    static_assert(placeholders == (int)sizeof...(Args), "log format: the number of \"{}\" placeholders doesn't match the number of arguments");
+
+    if (this->suppressed(Type)) {
+        return;
+    }
+    Stats_page::add(Stats_page::LOG_RECORDS);
+
+    static constexpr Log_format::Layout<sizeof...(Args)> layout = Log_format::layout<sizeof...(Args)>(Fmt::value());
+    const std::index_sequence_for<Args...> indices;
+
+    // coalescing needs the rendered message before deciding whether it is written at all
+    if (this->options.coalesceMs > 0) {
+        char msg[Log_record::MSG_MAX_LEN];
+        size_t len = Log_format::render(msg, sizeof(msg), Fmt::value(), layout, indices, args...);
+        this->emitCoalesced(Type, msg, len);
+        return;
+    }
+
+    if (this->writerRunning.load(std::memory_order_acquire)) {
+        Log_ring::Cell *cell = this->acquireCell(Type);
+        if (cell != nullptr) {
+            cell->record.len = Log_format::render(cell->record.msg, Log_record::MSG_MAX_LEN, Fmt::value(), layout, indices, args...);
+            this->commitCell(cell, Type);
+        }
+        return;
+    }
+
+    char msg[Log_record::MSG_MAX_LEN];
+    size_t len = Log_format::render(msg, sizeof(msg), Fmt::value(), layout, indices, args...);
+    this->logNow(Type, msg, len);
+}
+
 #endif
@@ -0,0 +1,86 @@
+#include "Admission.hpp"
+#include <cstdio>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// (*) constructor
+
+Admission::Admission(size_t maxClients, long retryAfterMs, size_t memoryBudget):
+    maxClients(maxClients),
+    retryAfterMs(retryAfterMs),
+    memoryBudget(memoryBudget),
+    clients(0),
+    buffered(0),
+    accepted(0),
+    busyLimit(0),
+    busyPressure(0),
+    shedMemory(0),
+    shedCpu(0),
+    acceptFailures(0) {}
+
+// (*) public interface
+
+Admission::Decision Admission::admit(bool pressure) {
+    if (pressure || this->overMemoryBudget() > 0) {
+        this->busyPressure.fetch_add(1, std::memory_order_relaxed);
+        return (BUSY_PRESSURE);
+    }
+
+    if (this->clients.fetch_add(1, std::memory_order_relaxed) >= this->maxClients) {
+        this->clients.fetch_sub(1, std::memory_order_relaxed);
+        this->busyLimit.fetch_add(1, std::memory_order_relaxed);
+        return (BUSY_LIMIT);
+    }
+
+    this->accepted.fetch_add(1, std::memory_order_relaxed);
+    return (ADMIT);
+}
+
+void Admission::refuse(int fd) {
+    char reply[64];
+    int len = snprintf(reply, sizeof(reply), "busy, retry after %ld ms\n", this->retryAfterMs);
+
+    // a fresh socket's send buffer is empty: the reply fits, a peer that's already gone only costs an error
+    ssize_t ret = send(fd, reply, (size_t)len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    (void)ret;
+    close(fd);
+}
+
+void Admission::release(void) {
+    this->clients.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void Admission::shed(Shed reason) {
+    if (reason == SHED_MEMORY) {
+        this->shedMemory.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        this->shedCpu.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void Admission::acceptFailed(void) {
+    this->acceptFailures.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Admission::addBuffered(int64_t delta) {
+    this->buffered.fetch_add(delta, std::memory_order_relaxed);
+}
+
+int64_t Admission::overMemoryBudget(void) const {
+    if (this->memoryBudget == 0) {
+        return (0);
+    }
+    return (this->buffered.load(std::memory_order_relaxed) - (int64_t)this->memoryBudget);
+}
+
+Admission::Counters Admission::counters(void) const {
+    Counters counters;
+
+    counters.accepted = this->accepted.load(std::memory_order_relaxed);
+    counters.busyLimit = this->busyLimit.load(std::memory_order_relaxed);
+    counters.busyPressure = this->busyPressure.load(std::memory_order_relaxed);
+    counters.shedMemory = this->shedMemory.load(std::memory_order_relaxed);
+    counters.shedCpu = this->shedCpu.load(std::memory_order_relaxed);
+    counters.acceptFailures = this->acceptFailures.load(std::memory_order_relaxed);
+    return (counters);
+}
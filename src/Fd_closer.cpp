@@ -0,0 +1,110 @@
+#include "Fd_closer.hpp"
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// (*) public interface
+
+void Fd_closer::closeFrom(int first, const int *keep, size_t keepCount) {
+    static constexpr size_t MAX_KEPT = 16;
+    int sorted[MAX_KEPT];
+    size_t count = 0;
+    bool ranged = true;
+
+    // the kept fds in order (insertion sort: a handful at most), the ranges between them are closed.
+    // more of them than fit: no ranges at all (they'd close the ones left out), the listing keeps every one
+    for (size_t i = 0; i < keepCount; ++i) {
+        if (keep[i] < first) {
+            continue;
+        }
+        if (count == MAX_KEPT) {
+            ranged = false;
+            break;
+        }
+        size_t j = count++;
+        for (; j > 0 && sorted[j - 1] > keep[i]; --j) {
+            sorted[j] = sorted[j - 1];
+        }
+        sorted[j] = keep[i];
+    }
+
+    unsigned from = (unsigned)first;
+    for (size_t i = 0; i <= count && ranged; ++i) {
+        unsigned to = (i < count) ? (unsigned)sorted[i] : 0;
+        if (i < count && to < from) {
+            continue; // a duplicate
+        }
+        if (i == count || to > from) {
+            ranged = Fd_closer::closeRange(from, (i < count) ? to - 1 : UINT_MAX);
+        }
+        from = to + 1;
+    }
+    if (ranged || Fd_closer::closeListed(first, keep, keepCount)) {
+        return;
+    }
+
+    struct rlimit limit;
+    int maxfd = (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < (rlim_t)INT_MAX) ? (int)limit.rlim_cur : INT_MAX;
+    for (int fd = first; fd < maxfd; ++fd) {
+        if (!Fd_closer::kept(fd, keep, keepCount)) {
+            close(fd);
+        }
+    }
+}
+
+// (*) private helpers
+
+bool Fd_closer::closeRange(unsigned first, unsigned last) {
+#ifdef SYS_close_range
+    return (syscall(SYS_close_range, first, last, 0) == 0 || errno != ENOSYS);
+#else
+    (void)first;
+    (void)last;
+    return (false);
+#endif
+}
+
+bool Fd_closer::closeListed(int first, const int *keep, size_t keepCount) {
+    int dir = open("/proc/self/fd", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir < 0) {
+        return (false);
+    }
+
+    // raw getdents64 (opendir() allocates): the entries are the open fds, closing them while listing is fine
+    // (the directory is read by fd number)
+    alignas(8) char buffer[4096];
+    long bytes;
+    while ((bytes = syscall(SYS_getdents64, dir, buffer, sizeof(buffer))) > 0) {
+        for (long offset = 0; offset < bytes;) {
+            const char *entry = buffer + offset;
+            unsigned short recordLen = *(const unsigned short *)(entry + 16); // d_reclen, after d_ino and d_off
+            const char *name = entry + 19; // d_name, after d_type
+
+            int fd = 0;
+            bool number = (*name != '\0');
+            for (; *name != '\0'; ++name) {
+                number = number && (*name >= '0' && *name <= '9');
+                fd = fd * 10 + (*name - '0');
+            }
+            if (number && fd >= first && fd != dir && !Fd_closer::kept(fd, keep, keepCount)) {
+                close(fd);
+            }
+            offset += recordLen;
+        }
+    }
+    close(dir);
+    return (bytes == 0);
+}
+
+bool Fd_closer::kept(int fd, const int *keep, size_t keepCount) {
+    for (size_t i = 0; i < keepCount; ++i) {
+        if (keep[i] == fd) {
+            return (true);
+        }
+    }
+    return (false);
+}
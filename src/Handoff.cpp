@@ -0,0 +1,301 @@
+#include "Handoff.hpp"
+#include "Fd_closer.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+// one message per fd (a seqpacket keeps the boundaries, and an fd can't get separated from its record)
+enum Kind {
+    READY = 1, // successor => predecessor: exec'd, options parsed, waiting for the state
+    LOCK, // fd: the lock file (pid: the predecessor's)
+    LISTENER, // fd: a TCP listener, in worker order
+    UNIX_LISTENER, // fd: the --unix listener
+    CLIENT, // fd: a client socket, payload: the first chunk of its pending bytes
+    DATA, // payload: more pending bytes of the last client
+    END
+};
+
+struct Header {
+    uint32_t magic;
+    uint32_t kind;
+    uint32_t len; // payload bytes after the header
+    int32_t pid; // sender
+};
+
+static constexpr uint32_t MAGIC = 0x4d444831; // "MDH1"
+static constexpr size_t CHUNK = 32768; // payload bytes per message (well under the socket's send buffer)
+static constexpr int SUCCESSOR_FD = 3; // where the successor finds its end of the socket
+
+static bool sendMessage(int sock, Kind kind, int fd, const char *data, size_t len) {
+    Header header = { MAGIC, (uint32_t)kind, (uint32_t)len, (int32_t)getpid() };
+    struct iovec iov[2] = { { &header, sizeof(header) }, { (void *)data, len } };
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = (len > 0) ? 2 : 1;
+    if (fd >= 0) {
+        memset(&control, 0, sizeof(control));
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+
+    ssize_t sent;
+    while ((sent = sendmsg(sock, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR) {
+    }
+    return (sent == (ssize_t)(sizeof(header) + len));
+}
+
+// 1: a message (*fd: -1 if it carried none), 0: EOF, -1: failure, timeout or garbage
+static int recvMessage(int sock, Header *header, int *fd, std::string *data) {
+    static char payload[CHUNK];
+    struct iovec iov[2] = { { header, sizeof(*header) }, { payload, sizeof(payload) } };
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg;
+
+    *fd = -1;
+    struct pollfd pfd = { sock, POLLIN, 0 };
+    int ready;
+    while ((ready = poll(&pfd, 1, Handoff::TIMEOUT_MS)) < 0 && errno == EINTR) {
+    }
+    if (ready <= 0) {
+        return (-1);
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    ssize_t received;
+    while ((received = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR) {
+    }
+    if (received <= 0) {
+        return ((int)received);
+    }
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS && cmsg->cmsg_len == CMSG_LEN(sizeof(int))) {
+            memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+        }
+    }
+    if ((msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) || (size_t)received < sizeof(*header) || header->magic != MAGIC
+        || header->len != (size_t)received - sizeof(*header)) {
+        if (*fd >= 0) {
+            close(*fd);
+            *fd = -1;
+        }
+        return (-1);
+    }
+    data->assign(payload, header->len);
+    return (1);
+}
+
+// (*) predecessor side
+
+bool Handoff::spawn(const std::string &executable, const std::vector<std::string> &arguments, int *sock, pid_t *pid) {
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, pair) < 0) {
+        return (false);
+    }
+
+    // everything exec needs is built before fork: a threaded process' child may only make async-signal-safe calls
+    std::vector<char *> argv;
+    for (const std::string &argument : arguments) {
+        argv.push_back(const_cast<char *>(argument.c_str()));
+    }
+    argv.push_back(nullptr);
+
+    std::string variable = std::string(ENV) + "=" + std::to_string(SUCCESSOR_FD);
+    std::vector<char *> envp;
+    for (char **entry = environ; *entry != nullptr; ++entry) {
+        if (strncmp(*entry, variable.c_str(), strlen(ENV) + 1) != 0) {
+            envp.push_back(*entry);
+        }
+    }
+    envp.push_back(const_cast<char *>(variable.c_str()));
+    envp.push_back(nullptr);
+
+    sigset_t none;
+    sigemptyset(&none);
+
+    *pid = fork();
+    if (*pid < 0) {
+        close(pair[0]);
+        close(pair[1]);
+        return (false);
+    }
+
+    if (*pid == 0) {
+        // the spawning thread may be a worker (handled signals blocked): the mask would survive exec
+        sigprocmask(SIG_SETMASK, &none, nullptr);
+        if (pair[1] == SUCCESSOR_FD) {
+            fcntl(SUCCESSOR_FD, F_SETFD, 0);
+        } else {
+            dup2(pair[1], SUCCESSOR_FD); // the copy doesn't have FD_CLOEXEC
+        }
+        // nothing else leaks into the successor (the lock fd included: it comes back over the socket)
+        Fd_closer::closeFrom(SUCCESSOR_FD + 1, nullptr, 0);
+        execve(executable.c_str(), argv.data(), envp.data());
+        _exit(127);
+    }
+
+    close(pair[1]);
+    *sock = pair[0];
+    return (true);
+}
+
+bool Handoff::awaitReady(int sock, pid_t pid) {
+    Header header;
+    int fd;
+    std::string data;
+
+    bool ready = (recvMessage(sock, &header, &fd, &data) == 1 && header.kind == READY);
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (!ready) {
+        kill(pid, SIGKILL); // exec failed (it exited already), bad options, or hung
+        waitpid(pid, nullptr, 0);
+    }
+    return (ready);
+}
+
+bool Handoff::send(int sock, const State &state) {
+    if (!sendMessage(sock, LOCK, state.lockFd, nullptr, 0)) {
+        return (false);
+    }
+    for (int fd : state.listenFds) {
+        if (!sendMessage(sock, LISTENER, fd, nullptr, 0)) {
+            return (false);
+        }
+    }
+    if (state.unixFd >= 0 && !sendMessage(sock, UNIX_LISTENER, state.unixFd, nullptr, 0)) {
+        return (false);
+    }
+
+    for (const Client &client : state.clients) {
+        size_t len = std::min(client.pending.size(), CHUNK);
+        if (!sendMessage(sock, CLIENT, client.fd, client.pending.data(), len)) {
+            return (false);
+        }
+        for (size_t offset = len; offset < client.pending.size(); offset += len) {
+            len = std::min(client.pending.size() - offset, CHUNK);
+            if (!sendMessage(sock, DATA, -1, client.pending.data() + offset, len)) {
+                return (false);
+            }
+        }
+    }
+    return (sendMessage(sock, END, -1, nullptr, 0));
+}
+
+// (*) successor side
+
+int Handoff::inheritedSocket(void) {
+    const char *value = getenv(ENV);
+    if (value == nullptr) {
+        return (-1);
+    }
+
+    char *end = nullptr;
+    long fd = strtol(value, &end, 10);
+    bool valid = (*value != '\0' && *end == '\0' && fd >= 0 && fd <= INT32_MAX && fcntl((int)fd, F_SETFD, FD_CLOEXEC) == 0);
+    unsetenv(ENV); // our own successor gets a fresh one
+    return (valid ? (int)fd : -1);
+}
+
+bool Handoff::receive(int sock, State *state) {
+    Header header;
+    int fd;
+    std::string data;
+    int status = sendMessage(sock, READY, -1, nullptr, 0) ? 1 : -1;
+
+    while (status == 1 && !state->complete && (status = recvMessage(sock, &header, &fd, &data)) == 1) {
+        bool expected = (fd >= 0) == (header.kind >= LOCK && header.kind <= CLIENT);
+
+        if (!expected || (header.kind == DATA && state->clients.empty())) {
+            status = -1;
+        } else if (header.kind == LOCK) {
+            state->predecessor = header.pid;
+            state->lockFd = fd;
+            fd = -1;
+        } else if (header.kind == LISTENER) {
+            state->listenFds.push_back(fd);
+            fd = -1;
+        } else if (header.kind == UNIX_LISTENER) {
+            state->unixFd = fd;
+            fd = -1;
+        } else if (header.kind == CLIENT) {
+            state->clients.push_back(Client{ fd, data });
+            fd = -1;
+        } else if (header.kind == DATA) {
+            state->clients.back().pending.append(data);
+        } else if (header.kind == END) {
+            state->complete = (state->lockFd >= 0);
+        } else {
+            status = -1;
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    // the predecessor still writes its last log records: EOF comes when it closed the socket (usually at exit)
+    while (status != 0 && recvMessage(sock, &header, &fd, &data) == 1) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+    close(sock);
+
+    // and the exit itself, however long its last records take: we're its child, reparented once it exited (its files
+    // are closed by then; kill(pid, 0) would still see it as a zombie until init reaps it)
+    for (long waited = 0; state->complete && waited < EXIT_TIMEOUT_MS; waited += 10) {
+        if (getppid() != state->predecessor) {
+            state->predecessorGone = true;
+            break;
+        }
+        usleep(10000);
+    }
+    return (state->complete);
+}
+
+void Handoff::release(State &state) {
+    int *single[] = { &state.lockFd, &state.unixFd };
+    for (int *fd : single) {
+        if (*fd >= 0) {
+            close(*fd);
+            *fd = -1;
+        }
+    }
+    for (int fd : state.listenFds) {
+        close(fd);
+    }
+    for (const Client &client : state.clients) {
+        close(client.fd);
+    }
+    state.listenFds.clear();
+    state.clients.clear();
+}
@@ -0,0 +1,75 @@
+#include "Latency_histogram.hpp"
+#include <algorithm>
+
+// (*) constructor
+
+Latency_histogram::Latency_histogram(): max(0) {
+    for (size_t i = 0; i < BUCKETS; ++i) {
+        this->counts[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+// (*) public interface
+
+uint64_t Latency_histogram::highestOf(size_t bucket) {
+    if (bucket < SUB_BUCKETS) {
+        return ((uint64_t)bucket);
+    }
+    unsigned shift = (unsigned)(bucket / SUB_BUCKETS) - 1;
+    uint64_t lowest = (uint64_t)(SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+    return (lowest + ((uint64_t)1 << shift) - 1);
+}
+
+void Latency_histogram::recordShared(int64_t ns) {
+    this->counts[Latency_histogram::bucketOf(ns > 0 ? (uint64_t)ns : 0)].fetch_add(1, std::memory_order_relaxed);
+
+    int64_t current = this->max.load(std::memory_order_relaxed);
+    while (ns > current && !this->max.compare_exchange_weak(current, ns, std::memory_order_relaxed)) {
+    }
+}
+
+void Latency_histogram::addTo(Snapshot *snapshot) const {
+    for (size_t i = 0; i < BUCKETS; ++i) {
+        snapshot->counts[i] += this->counts[i].load(std::memory_order_relaxed);
+    }
+    snapshot->max = std::max(snapshot->max, this->max.load(std::memory_order_relaxed));
+}
+
+// (*) snapshots
+
+Latency_histogram::Summary Latency_histogram::Snapshot::summarize(void) const {
+    Summary summary = { 0, 0, 0, 0, this->max };
+
+    for (uint64_t count : this->counts) {
+        summary.count += count;
+    }
+    if (summary.count == 0) {
+        return (summary);
+    }
+
+    // the rank of each percentile (rounded up), found in one walk over the buckets
+    const double quantiles[] = { 0.5, 0.99, 0.999 };
+    int64_t *values[] = { &summary.p50, &summary.p99, &summary.p999 };
+    uint64_t seen = 0;
+    size_t next = 0;
+    for (size_t bucket = 0; bucket < BUCKETS && next < 3; ++bucket) {
+        seen += this->counts[bucket];
+        while (next < 3 && (double)seen >= quantiles[next] * (double)summary.count) {
+            *values[next++] = std::min((int64_t)Latency_histogram::highestOf(bucket), this->max);
+        }
+    }
+    return (summary);
+}
+
+Latency_histogram::Snapshot Latency_histogram::Snapshot::since(const Snapshot &earlier) const {
+    Snapshot difference;
+    size_t highest = 0;
+
+    for (size_t i = 0; i < BUCKETS; ++i) {
+        difference.counts[i] = this->counts[i] - std::min(this->counts[i], earlier.counts[i]);
+        highest = (difference.counts[i] > 0) ? i : highest;
+    }
+    // the exact max is only known since the start: the interval's is its highest bucket's top (or the max, if lower)
+    difference.max = std::min((int64_t)Latency_histogram::highestOf(highest), this->max);
+    return (difference);
+}
@@ -0,0 +1,54 @@
+#include "Latency_stats.hpp"
+#include <algorithm>
+
+Latency_stats::Set Latency_stats::shared;
+std::atomic<Latency_stats::Set *> Latency_stats::sets[MAX_THREADS];
+std::atomic<size_t> Latency_stats::setCount(0);
+std::atomic<uint32_t> Latency_stats::sampleMask(15);
+
+// (*) public interface
+
+void Latency_stats::attach(void) {
+    if (Latency_stats::current != nullptr) {
+        return;
+    }
+
+    // published with release: a merge that sees the pointer sees zeroed histograms. never freed (the threads that
+    // recorded may have left, their counts still belong to the totals)
+    size_t index = Latency_stats::setCount.fetch_add(1, std::memory_order_relaxed);
+    if (index >= MAX_THREADS) {
+        return;
+    }
+    Set *set = new Set();
+    Latency_stats::sets[index].store(set, std::memory_order_release);
+    Latency_stats::current = set;
+}
+
+void Latency_stats::setSampling(size_t every) {
+    uint32_t rounded = 1;
+
+    while (rounded < every && rounded < ((uint32_t)1 << 31)) {
+        rounded <<= 1;
+    }
+    Latency_stats::sampleMask.store(rounded - 1, std::memory_order_relaxed);
+}
+
+Latency_histogram::Snapshot Latency_stats::snapshot(Stage stage) {
+    Latency_histogram::Snapshot merged;
+    size_t count = std::min(Latency_stats::setCount.load(std::memory_order_relaxed), MAX_THREADS);
+
+    Latency_stats::shared.stages[stage].addTo(&merged);
+    for (size_t i = 0; i < count; ++i) {
+        Set *set = Latency_stats::sets[i].load(std::memory_order_acquire);
+        if (set != nullptr) { // claimed, not published yet
+            set->stages[stage].addTo(&merged);
+        }
+    }
+    return (merged);
+}
+
+const char *Latency_stats::stageName(Stage stage) {
+    static const char *names[STAGES] = { "read_to_line", "handle", "log_durable" };
+
+    return (stage < STAGES ? names[stage] : "?");
+}
@@ -0,0 +1,131 @@
+#include "Line_buffer.hpp"
+#include "Newline_scanner.hpp"
+#include <cstring>
+#include <utility>
+
+// (*) constructors
+
+Line_buffer::Line_buffer(): size(0), start(0), end(0), scanned(0), discarding(false), lineCount(0), lineIndex(0) {}
+
+Line_buffer::Line_buffer(Line_buffer &&other) noexcept: Line_buffer() {
+    *this = std::move(other);
+}
+
+Line_buffer &Line_buffer::operator=(Line_buffer &&other) noexcept {
+    if (this != &other) {
+        this->data = std::move(other.data);
+        this->size = other.size;
+        this->start = other.start;
+        this->end = other.end;
+        this->scanned = other.scanned;
+        this->discarding = other.discarding;
+        this->lineCount = other.lineCount;
+        this->lineIndex = other.lineIndex;
+        memcpy(this->lines, other.lines, other.lineCount * sizeof(uint32_t));
+        other.size = 0;
+        other.clear();
+    }
+    return (*this);
+}
+
+// (*) Buffer_pool interface
+
+void Line_buffer::reserve(size_t capacity) {
+    if (capacity > this->size) {
+        this->data.reset(new char[capacity]);
+        this->size = capacity;
+        this->clear();
+    }
+}
+
+void Line_buffer::clear(void) {
+    this->start = 0;
+    this->end = 0;
+    this->scanned = 0;
+    this->discarding = false;
+    this->lineCount = 0;
+    this->lineIndex = 0;
+}
+
+size_t Line_buffer::capacity(void) const {
+    return (this->size);
+}
+
+size_t Line_buffer::pending(void) const {
+    return (this->end - this->start);
+}
+
+std::string_view Line_buffer::unhandled(void) const {
+    return (std::string_view(this->data.get() + this->start, this->end - this->start));
+}
+
+// (*) reading
+
+char *Line_buffer::tail(size_t *room) {
+    if (this->start == this->end) {
+        this->start = 0; // everything was consumed: rewinding is free
+        this->end = 0;
+        this->scanned = 0;
+        this->lineCount = 0;
+        this->lineIndex = 0;
+    } else if (this->start > 0 && this->size - this->end < this->size / 4) {
+        // one move per refill of the buffer (of the partial line only), not one per line
+        size_t pending = this->end - this->start;
+        memmove(this->data.get(), this->data.get() + this->start, pending);
+        for (size_t i = this->lineIndex; i < this->lineCount; ++i) {
+            this->lines[i] -= (uint32_t)this->start;
+        }
+        this->scanned -= this->start;
+        this->start = 0;
+        this->end = pending;
+    }
+
+    *room = this->size - this->end;
+    return (this->data.get() + this->end);
+}
+
+void Line_buffer::commit(size_t bytes) {
+    this->end += bytes;
+}
+
+bool Line_buffer::scan(void) {
+    size_t covered = 0;
+
+    this->lineIndex = 0;
+    this->lineCount = Newline_scanner::scan(this->data.get() + this->scanned, this->end - this->scanned, this->lines, LINE_BATCH, &covered);
+    for (size_t i = 0; i < this->lineCount; ++i) {
+        this->lines[i] += (uint32_t)this->scanned;
+    }
+    this->scanned += covered;
+    return (this->lineCount > 0);
+}
+
+Line_buffer::Status Line_buffer::nextLine(std::string_view *line, size_t maxLength) {
+    while (this->lineIndex < this->lineCount || (this->scanned < this->end && this->scan())) {
+        size_t newline = this->lines[this->lineIndex++];
+        size_t first = this->start;
+
+        this->start = newline + 1;
+        if (this->discarding) {
+            this->discarding = false; // end of the overlong line
+            continue;
+        }
+
+        size_t len = newline - first;
+        *line = std::string_view(this->data.get() + first, (len > maxLength) ? maxLength : len);
+        return ((len > maxLength) ? OVERLONG : LINE);
+    }
+
+    // no complete line: the buffered bytes are a partial line (scanned entirely)
+    if (this->discarding) {
+        this->start = this->end;
+        return (PARTIAL);
+    }
+    if (this->end - this->start > maxLength) {
+        *line = std::string_view(this->data.get() + this->start, maxLength);
+        this->start = this->end;
+        this->discarding = true;
+        return (OVERLONG);
+    }
+    return (PARTIAL);
+}
@@ -0,0 +1,129 @@
+#include "Log_compressor.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <system_error>
+#include <unistd.h>
+#include <zlib.h>
+
+// ioprio_set() has no glibc wrapper
+static constexpr int IOPRIO_WHO_PROCESS = 1;
+static constexpr int IOPRIO_CLASS_IDLE = 3;
+static constexpr int IOPRIO_CLASS_SHIFT = 13;
+
+// (*) constructor & destructor
+
+Log_compressor::Log_compressor(): head(0), count(0), stopping(false) {}
+
+Log_compressor::~Log_compressor() {
+    this->stop();
+}
+
+// (*) private helpers
+
+bool Log_compressor::compress(const char *path) {
+    char tmpPath[PATH_MAX_LEN + 8];
+    char gzPath[PATH_MAX_LEN + 4];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.gz.tmp", path);
+    snprintf(gzPath, sizeof(gzPath), "%s.gz", path);
+
+    int in = open(path, O_RDONLY);
+    if (in < 0) {
+        return (false);
+    }
+
+    gzFile out = gzopen(tmpPath, "wb6");
+    if (out == NULL) {
+        close(in);
+        return (false);
+    }
+
+    char buffer[65536];
+    ssize_t got;
+    bool ok = true;
+    while ((got = read(in, buffer, sizeof(buffer))) != 0) {
+        if (got < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ok = false;
+            break;
+        }
+        if (gzwrite(out, buffer, (unsigned)got) != (int)got) {
+            ok = false;
+            break;
+        }
+    }
+    close(in);
+
+    if (gzclose(out) != Z_OK || !ok || rename(tmpPath, gzPath) < 0) {
+        unlink(tmpPath);
+        return (false);
+    }
+
+    unlink(path);
+    return (true);
+}
+
+void Log_compressor::loop(void) {
+    // this thread only: lowest cpu priority and idle io class, compression never competes with the event loop
+    setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), 19);
+    syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+
+    char path[PATH_MAX_LEN];
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->wakeup.wait(lock, [this] { return (this->stopping || this->count > 0); });
+            if (this->count == 0) {
+                return; // stopping, and nothing left to compress
+            }
+            memcpy(path, this->queue[this->head], PATH_MAX_LEN);
+            this->head = (this->head + 1) % QUEUE_MAX;
+            this->count -= 1;
+        }
+
+        Log_compressor::compress(path); // on failure the rotated file simply stays uncompressed
+    }
+}
+
+// (*) public interface
+
+bool Log_compressor::submit(const char *path) {
+    if (strlen(path) >= PATH_MAX_LEN) {
+        return (false);
+    }
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (this->stopping || this->count == QUEUE_MAX) {
+        return (false);
+    }
+
+    if (!this->thread.joinable()) {
+        try {
+            this->thread = std::thread(&Log_compressor::loop, this);
+        } catch (const std::system_error &e) {
+            return (false);
+        }
+    }
+
+    strcpy(this->queue[(this->head + this->count) % QUEUE_MAX], path);
+    this->count += 1;
+    this->wakeup.notify_one();
+    return (true);
+}
+
+void Log_compressor::stop(void) {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+        this->wakeup.notify_one();
+    }
+
+    if (this->thread.joinable()) {
+        this->thread.join();
+    }
+}
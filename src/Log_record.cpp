@@ -0,0 +1,48 @@
+#include "Log_record.hpp"
+#include <algorithm>
+#include <cstring>
+
+const char *Log_record::typeName(uint8_t type) {
+    switch (type) {
+        case 0:
+            return "LOG";
+        case 2:
+            return "ERROR";
+        default:
+            return "INFO";
+    }
+}
+
+size_t Log_record::formatText(char *out, size_t cap, const char *timestamp, size_t timestampLen, uint8_t type, const char *msg, size_t len) {
+    // "[<timestamp>] [ <type> ] - Matt_daemon: <msg>.\n", cut to cap - 1 bytes like snprintf() would
+    const char *typeStr = Log_record::typeName(type);
+    const char *parts[] = { "[", timestamp, "] [ ", typeStr, " ] - Matt_daemon: ", msg, ".\n" };
+    size_t written = 0;
+
+    for (size_t i = 0; i < sizeof(parts) / sizeof(*parts); ++i) {
+        size_t partLen = (parts[i] == timestamp) ? timestampLen : (parts[i] == msg) ? len : strlen(parts[i]);
+        size_t n = std::min(partLen, cap - 1 - written);
+        memcpy(out + written, parts[i], n);
+        written += n;
+    }
+    out[written] = '\0';
+
+    return (written);
+}
+
+size_t Log_record::encodeBinary(char *out, size_t cap, const struct timespec &ts, uint8_t type, const char *msg, size_t len) {
+    Log_binary_header header;
+
+    len = std::min(len, cap - sizeof(header) - 1);
+    header.magic = Log_binary_header::MAGIC;
+    header.type = type;
+    header.len = (uint16_t)len;
+    header.nsec = (uint32_t)ts.tv_nsec;
+    header.sec = (int64_t)ts.tv_sec;
+
+    memcpy(out, &header, sizeof(header));
+    memcpy(out + sizeof(header), msg, len);
+    out[sizeof(header) + len] = '\n';
+
+    return (sizeof(header) + len + 1);
+}
@@ -1,23 +1,68 @@
 #include "Matt_daemon.hpp"
+#include "Fd_closer.hpp"
+#include "Newline_scanner.hpp"
+#include "Stats_page.hpp"
 #include "Tintin_reporter.hpp"
 #include <cerrno>
+#include <cstddef>
 #include <csignal>
 #include <cstring>
 #include <netdb.h>
+#include <netinet/in.h>
 #include <cstdio>
 #include <cstdlib>
+#include <ctime>
+#include <functional>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/file.h>
+#include <sys/resource.h>
+#include <sys/eventfd.h>
+#include <sys/wait.h>
+#include <pthread.h>
+#include <system_error>
+#include <linux/io_uring.h>
 
 
 std::atomic<int> Matt_daemon::receivedSignal = 0;
 std::atomic<int> Matt_daemon::quitRequested = 0;
+std::atomic<int> Matt_daemon::reopenRequested = 0;
+std::atomic<int> Matt_daemon::restartRequested = 0;
+
+static int64_t clockNs(clockid_t clock) {
+    struct timespec now;
+
+    clock_gettime(clock, &now);
+    return ((int64_t)now.tv_sec * 1000000000 + now.tv_nsec);
+}
+
+// "read_to_line: 1234 samples, p50 1.2 us, p99 10.5 us, p999 31.0 us, max 120.3 us"
+static void formatLatency(char *out, size_t size, Latency_stats::Stage stage, const Latency_histogram::Summary &summary) {
+    snprintf(out, size, "%s: %llu samples, p50 %.1f us, p99 %.1f us, p999 %.1f us, max %.1f us", Latency_stats::stageName(stage),
+        (unsigned long long)summary.count, (double)summary.p50 / 1000, (double)summary.p99 / 1000, (double)summary.p999 / 1000,
+        (double)summary.max / 1000);
+}
 
 // (*) constructor & destructor
 
-Matt_daemon::Matt_daemon(const Tintin_reporter &tintin_reporter): lockFd(-1), listenFd(-1), tintin_reporter(tintin_reporter) {}
+Matt_daemon::Matt_daemon(const Tintin_reporter &tintin_reporter, const Options &options):
+    lockFd(-1),
+    wakeFd(-1),
+    unixFd(-1),
+    readyFd(-1),
+    options(options),
+    admission(options.maxClients, options.retryAfterMs, options.memoryBudget),
+    stopping(false),
+    successorFd(-1),
+    successorPid(0),
+    parkedWorkers(0),
+    handoffRound(0),
+    resumeServing(false),
+    lockHandedOff(false),
+    handedOff(false),
+    tintin_reporter(tintin_reporter) {}
 
 Matt_daemon::~Matt_daemon() {}
 
@@ -25,33 +70,101 @@ Matt_daemon::~Matt_daemon() {}
 // (*) public interface
 
 Matt_daemon &Matt_daemon::getMattDaemon(const Tintin_reporter &tintin_reporter) {
-    static Matt_daemon matt_daemon(tintin_reporter);
+    return (Matt_daemon::getMattDaemon(tintin_reporter, Options()));
+}
+
+Matt_daemon &Matt_daemon::getMattDaemon(const Tintin_reporter &tintin_reporter, const Options &options) {
+    static Matt_daemon matt_daemon(tintin_reporter, options);
 
     return (matt_daemon);
 }
 
-void Matt_daemon::start(void) {
-    this->createLockFile(); // locking the lock file (to ensure we always have only one running daemon)
+void Matt_daemon::start(Handoff::State *inherited) {
+    if (inherited == nullptr) {
+        this->createLockFile(); // locking the lock file (to ensure we always have only one running daemon)
+    } else if (inherited->complete) {
+        this->lockFd = inherited->lockFd; // the predecessor's open file description: the lock was never released
+        inherited->lockFd = -1;
+    } else {
+        Handoff::release(*inherited);
+        this->tintin_reporter.log(Tintin_reporter::ERROR, "ERROR hot restart (the predecessor didn't hand off)");
+        this->tintin_reporter.log(Tintin_reporter::INFO, "Quitting");
+        exit(EXIT_FAILURE);
+    }
+    if (inherited == nullptr || inherited->predecessorGone) {
+        this->tintin_reporter.recoverRing(); // records a crashed run didn't write go first (the lock guarantees the ring file is ours)
+    }
     this->tintin_reporter.log(Tintin_reporter::INFO, "Started");
-    this->daemonize(); // creating a daemon process (fully detached from terminal)
+    if (inherited == nullptr) {
+        this->daemonize(); // creating a daemon process (fully detached from terminal)
+    } else {
+        // forked and exec'd by the daemon: detached already (no session, no terminal, stdio on /dev/null, cwd /)
+        this->tintin_reporter.log<Tintin_reporter::INFO>(TINTIN_FMT("hot restart: taking over {} listeners and {} clients from PID {}"),
+            inherited->listenFds.size() + (inherited->unixFd >= 0 ? 1 : 0), inherited->clients.size(), inherited->predecessor);
+        if (!inherited->predecessorGone) {
+            // its ring file is still in use: neither replayed nor reused (our async ring stays in anonymous memory)
+            this->tintin_reporter.log<Tintin_reporter::ERROR>(TINTIN_FMT("hot restart: PID {} is still running, its log ring file is left alone"),
+                inherited->predecessor);
+        }
+    }
+    Latency_stats::setSampling(this->options.latencySampleEvery);
+    // the workers and the log writer get a slot each (after daemonizing: the page holds the daemon's PID)
+    if (!this->options.statsPath.empty() && !Stats_page::open(this->options.statsPath, std::max<size_t>(this->options.workers, 1) + 1)) {
+        this->tintin_reporter.log<Tintin_reporter::ERROR>(TINTIN_FMT("cannot create the stats page {} ({})"),
+            this->options.statsPath, (const char *)strerror(errno));
+    }
+    this->tintin_reporter.startBackground(); // the logger threads (if any) must be created by the daemon process itself
     this->setupSignals(); // handling signals
     this->tintin_reporter.log(Tintin_reporter::INFO, "Creating server");
-    this->createServer(); // create the server
+    this->createServer(inherited); // create the server
     this->tintin_reporter.log(Tintin_reporter::INFO, "Server created");
+    this->notifyReady(); // --wait-ready: the launching command returns now
+    this->tintin_reporter.log<Tintin_reporter::INFO>(TINTIN_FMT("newline scanner: {}"), Newline_scanner::implementation());
     this->tintin_reporter.log(Tintin_reporter::INFO, "Entering Daemon mode");
 
-    char buffer[32];
-    snprintf(buffer, 32, "started. PID: %d", getpid());
-    this->tintin_reporter.log(Tintin_reporter::INFO, buffer);
+    this->tintin_reporter.log<Tintin_reporter::INFO>(TINTIN_FMT("started. PID: {}"), getpid());
+
+    this->startWorkers(); // the other event loops (if any)
+    this->runWorker(*this->workers[0]); // event loop
+    this->joinWorkers();
+    Stall_watchdog::stop();
+
+    // reporting daemon exit reason
+    if (Matt_daemon::quitRequested) {
+        this->tintin_reporter.log(Tintin_reporter::INFO, "Request quit");
+    } else if (Matt_daemon::receivedSignal) {
+        this->tintin_reporter.log(Tintin_reporter::INFO, "Signal handler");
+    } else if (this->successorFd >= 0) {
+        this->tintin_reporter.log(Tintin_reporter::INFO, "Hot restart");
+    }
+
+    Admission::Counters counters = this->admission.counters();
+    this->tintin_reporter.log<Tintin_reporter::INFO>(TINTIN_FMT("admission: {} accepted, {} busy (limit), {} busy (pressure), {} shed (memory), {} shed (cpu), {} accept failures"),
+        counters.accepted, counters.busyLimit, counters.busyPressure, counters.shedMemory, counters.shedCpu, counters.acceptFailures);
+
+    // handed off by the first worker (the handoff socket stays open until we exit, the successor opens the log file after that)
+    if (this->handedOff) {
+        this->tintin_reporter.stopAsync();
+        this->tintin_reporter.log(Tintin_reporter::INFO, "Quitting");
+        return;
+    }
 
-    this->eventLoop(); // event loop
     this->cleanup(); // cleanup
+    this->tintin_reporter.stopAsync(); // flushes pending records (and reports the writer stats) before the last one
     this->tintin_reporter.log(Tintin_reporter::INFO, "Quitting");
 }
 
 // (*) private interface
 
-void Matt_daemon::daemonize(void) const {
+void Matt_daemon::daemonize(void) {
+    // --wait-ready: the launching parent waits for a byte from the daemon (or EOF: it died before serving)
+    int ready[2] = { -1, -1 };
+    if (this->options.waitReady && pipe2(ready, O_CLOEXEC) < 0) {
+        this->tintin_reporter.log(Tintin_reporter::ERROR, "failure to create the readiness pipe");
+        this->tintin_reporter.log(Tintin_reporter::INFO, "Quitting");
+        exit(EXIT_FAILURE);
+    }
+
     pid_t pid = fork();
 
     if (pid < 0) {
@@ -61,7 +174,14 @@ void Matt_daemon::daemonize(void) const {
     }
 
     if (pid > 0) {
-        exit(EXIT_SUCCESS); // parent job done!
+        ssize_t got = 1;
+        if (ready[0] >= 0) {
+            char byte;
+            close(ready[1]);
+            while ((got = read(ready[0], &byte, 1)) < 0 && errno == EINTR) {
+            }
+        }
+        _exit(got == 1 ? EXIT_SUCCESS : EXIT_FAILURE); // parent job done! (no static destructors: the logger belongs to the daemon now)
     }
 
     // child process is not a process group leader (the parent was) => we can run setsid()
@@ -85,17 +205,17 @@ void Matt_daemon::daemonize(void) const {
     }
 
     if (pid > 0) {
-        exit(EXIT_SUCCESS); // parent job done!
+        _exit(EXIT_SUCCESS); // parent job done! (no static destructors: the logger belongs to the daemon now)
     }
 
-    // closing all inherited file descriptors (except 0, 1, 2 and this->lockFd)
-    long maxfd = sysconf(_SC_OPEN_MAX);
-    int logFileFd = this->tintin_reporter.getLogFileFd();
-    for (int fd = 3; fd < maxfd; ++fd) {
-        if (fd != this->lockFd && fd != logFileFd) {
-            close(fd);
-        }
+    // closing all inherited file descriptors (except 0, 1, 2, this->lockFd, the log file and the readiness pipe):
+    // a few close_range() calls, not one close() per possible fd (RLIMIT_NOFILE may be a million)
+    if (ready[0] >= 0) {
+        close(ready[0]);
     }
+    this->readyFd = ready[1];
+    int keep[] = { this->lockFd, this->tintin_reporter.getLogFileFd(), this->readyFd };
+    Fd_closer::closeFrom(3, keep, sizeof(keep) / sizeof(keep[0]));
 
     // redirecting 0, 1, 2 to /dev/null
     int fd = open("/dev/null", O_RDWR);
@@ -107,6 +227,9 @@ void Matt_daemon::daemonize(void) const {
     dup2(fd, 0);
     dup2(fd, 1);
     dup2(fd, 2);
+    if (fd > 2) {
+        close(fd);
+    }
 
     // change directory to '/' (which is always mounted)
     if (chdir("/") < 0) {
@@ -116,6 +239,82 @@ void Matt_daemon::daemonize(void) const {
     }
 }
 
+void Matt_daemon::spawnSuccessor(void) {
+    if (this->successorFd >= 0) {
+        return; // already handing off
+    }
+
+    // this loop stalls until the successor is up (exec and option parsing: milliseconds), the others keep serving
+    int sock;
+    pid_t pid;
+    if (this->options.executable.empty() || !Handoff::spawn(this->options.executable, this->options.arguments, &sock, &pid)) {
+        this->tintin_reporter.log<Tintin_reporter::ERROR>(TINTIN_FMT("ERROR hot restart (cannot start {}: {})"),
+            this->options.executable, (const char *)strerror(errno));
+        return;
+    }
+    if (!Handoff::awaitReady(sock, pid)) {
+        close(sock);
+        this->tintin_reporter.log<Tintin_reporter::ERROR>(TINTIN_FMT("ERROR hot restart ({} didn't come up), still serving"),
+            this->options.executable);
+        return;
+    }
+
+    this->tintin_reporter.log<Tintin_reporter::INFO>(TINTIN_FMT("hot restart: PID {} is up, handing off"), pid);
+    this->successorPid = pid;
+    this->successorFd = sock;
+    this->stopWorkers();
+}
+
+bool Matt_daemon::handOff(void) {
+    Handoff::State state;
+
+    state.lockFd = this->lockFd;
+    state.unixFd = this->unixFd;
+    for (std::unique_ptr<Worker> &worker : this->workers) {
+        state.listenFds.push_back(worker->listenFd);
+        worker->clients.forEach([&state](Slot_map<Client>::Handle, Client &client) {
+            std::string pending(client.buffer.unhandled());
+            state.clients.push_back(Handoff::Client{ client.fd, pending + client.received });
+        });
+    }
+
+    // the lock is the first thing sent: from now on the successor may hold it, our LOCK_UN would release it for both
+    this->lockHandedOff = true;
+    if (!Handoff::send(this->successorFd, state)) {
+        this->tintin_reporter.log<Tintin_reporter::ERROR>(TINTIN_FMT("ERROR hot restart (handoff to PID {} failed: {}), still serving"),
+            this->successorPid, (const char *)strerror(errno));
+        return (false);
+    }
+    this->tintin_reporter.log<Tintin_reporter::INFO>(TINTIN_FMT("hot restart: {} clients handed off to PID {}"),
+        state.clients.size(), this->successorPid);
+
+    // only our copies: no unlock, no unlink (the lock and the socket file are the successor's now)
+    close(this->lockFd);
+    if (this->unixFd >= 0) {
+        close(this->unixFd);
+    }
+    for (const Handoff::Client &client : state.clients) {
+        close(client.fd);
+    }
+    for (std::unique_ptr<Worker> &worker : this->workers) {
+        close(worker->listenFd);
+    }
+    close(this->wakeFd);
+    return (true);
+}
+
+void Matt_daemon::notifyReady(void) {
+    if (this->readyFd < 0) {
+        return;
+    }
+
+    char byte = 1;
+    ssize_t ret = write(this->readyFd, &byte, 1); // the launcher is gone if it failed, nobody to tell
+    (void)ret;
+    close(this->readyFd);
+    this->readyFd = -1;
+}
+
 void Matt_daemon::createLockFile(void) {
     this->lockFd = open(Matt_daemon::lockFile, O_RDWR | O_CREAT, 0644);
 
@@ -128,15 +327,30 @@ void Matt_daemon::createLockFile(void) {
 }
 
 void Matt_daemon::removeLockFile() const {
-    flock(this->lockFd, LOCK_UN);
+    // a successor that got our open file description shares the lock: closing our fd only drops our reference
+    if (!this->lockHandedOff) {
+        flock(this->lockFd, LOCK_UN);
+    }
     close(this->lockFd);
-    unlink(Matt_daemon::lockFile);
+    if (!this->lockHandedOff) {
+        unlink(Matt_daemon::lockFile);
+    }
 }
 
 void Matt_daemon::signalHandler(int sig) {
     Matt_daemon::receivedSignal = sig;
 }
 
+void Matt_daemon::reopenHandler(int sig) {
+    (void)sig;
+    Matt_daemon::reopenRequested = 1;
+}
+
+void Matt_daemon::restartHandler(int sig) {
+    (void)sig;
+    Matt_daemon::restartRequested = 1;
+}
+
 void Matt_daemon::setupSignals() const {
     struct sigaction sa{};
     sa.sa_handler = Matt_daemon::signalHandler;
@@ -145,32 +359,67 @@ void Matt_daemon::setupSignals() const {
 
     sigaction(SIGTERM, &sa, nullptr);
     sigaction(SIGINT,  &sa, nullptr);
-    sigaction(SIGHUP,  &sa, nullptr);
+
+    // SIGHUP rotates (or reopens) the log file instead of quitting
+    struct sigaction hup{};
+    hup.sa_handler = Matt_daemon::reopenHandler;
+    sigemptyset(&hup.sa_mask);
+    hup.sa_flags = 0;
+    sigaction(SIGHUP,  &hup, nullptr);
+
+    // SIGUSR2 hands everything off to a new process (running the binary found at the same path)
+    struct sigaction usr2{};
+    usr2.sa_handler = Matt_daemon::restartHandler;
+    sigemptyset(&usr2.sa_mask);
+    usr2.sa_flags = 0;
+    sigaction(SIGUSR2, &usr2, nullptr);
 
     signal(SIGPIPE, SIG_IGN);
 }
 
 void Matt_daemon::cleanup(void) {
     this->removeLockFile();
+    Stats_page::close();
+
+    for (std::unique_ptr<Worker> &worker : this->workers) {
+        // closing listenFd
+        if (worker->listenFd >= 0) {
+            close(worker->listenFd);
+        }
 
-    // closing listenFd
-    if (this->listenFd >= 0) {
-        close(this->listenFd);
+        // closing clients sockets
+        worker->clients.forEach([](Slot_map<Client>::Handle, Client &client) {
+            close(client.fd);
+        });
     }
 
-    // closing clients sockets
-    for (const Client &client : clients) {
-        close(client.fd);
+    // the socket file would refuse the next bind (an abstract name goes away with the socket)
+    if (this->unixFd >= 0) {
+        close(this->unixFd);
+        if (this->options.unixPath[0] != '@') {
+            unlink(this->options.unixPath.c_str());
+        }
+    }
+
+    if (this->wakeFd >= 0) {
+        close(this->wakeFd);
     }
 }
 
-void Matt_daemon::createServer(void) {
+void Matt_daemon::createServer(Handoff::State *inherited) {
+    // built by the daemon process: the forks of daemonize() don't copy them, and they're only allocated here
+    // (any worker may end up with every client: the kernel balances connections, not load, the global limit is the admission's)
+    for (size_t i = 0; i < std::max<size_t>(this->options.workers, 1); ++i) {
+        this->workers.emplace_back(new Worker(this->options.maxClients, this->options.maxLineLength + 1 + this->options.readSize,
+            clockNs(CLOCK_MONOTONIC_COARSE) / 1000000));
+    }
+
     // getaddrinfo
     struct addrinfo hints;
     struct addrinfo *res = NULL;
 
     memset(&hints, 0, sizeof(hints));
-    hints.ai_family = AF_INET;
+    hints.ai_family = this->options.ipv6 ? AF_INET6 : AF_INET;
     hints.ai_socktype = SOCK_STREAM;
     hints.ai_flags = AI_PASSIVE; // socket needs binding 
 
@@ -180,135 +429,989 @@ void Matt_daemon::createServer(void) {
         exit(EXIT_FAILURE);
     }
 
-    // creating a TCP socket (to listen on connection requests)
-    this->listenFd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    // tens of thousands of clients need as many fds (the soft limit is usually 1024)
+    size_t neededFds = this->options.maxClients + RESERVED_FDS * this->workers.size();
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < neededFds) {
+        limit.rlim_cur = std::min<rlim_t>(limit.rlim_max, neededFds);
+        if (setrlimit(RLIMIT_NOFILE, &limit) < 0 || limit.rlim_cur < neededFds) {
+            this->tintin_reporter.log<Tintin_reporter::ERROR>(TINTIN_FMT("fd limit too low for {} clients (RLIMIT_NOFILE {})"),
+                this->options.maxClients, (uint64_t)limit.rlim_cur);
+        }
+    }
+
+    // written once by the first worker to stop, every reactor reports it
+    this->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (this->wakeFd < 0) {
+        this->tintin_reporter.log(Tintin_reporter::ERROR, "ERROR creating server (eventfd failure)");
+        this->tintin_reporter.log(Tintin_reporter::INFO, "Quitting");
+        exit(EXIT_FAILURE);
+    }
+
+    // hot restart: the listeners keep their backlogs (connections that arrived meanwhile are accepted by us). fewer
+    // inherited than workers: the others are created (the port is shared only if the predecessor had SO_REUSEPORT)
+    if (inherited != nullptr && inherited->unixFd >= 0 && !this->options.unixPath.empty()) {
+        this->unixFd = inherited->unixFd;
+        inherited->unixFd = -1;
+    } else if (!this->options.unixPath.empty()) {
+        this->createUnixListener();
+    }
+    for (size_t i = 0; i < this->workers.size(); ++i) {
+        if (inherited != nullptr && i < inherited->listenFds.size()) {
+            this->workers[i]->listenFd = inherited->listenFds[i];
+        } else {
+            this->createListener(*this->workers[i], res);
+        }
+        this->watchListeners(*this->workers[i]);
+    }
+    if (inherited != nullptr) {
+        for (size_t i = this->workers.size(); i < inherited->listenFds.size(); ++i) {
+            close(inherited->listenFds[i]); // the kernel moves its pending connections to the listeners sharing the port
+        }
+        inherited->listenFds.clear();
+        if (inherited->unixFd >= 0) {
+            close(inherited->unixFd); // --unix was dropped
+            inherited->unixFd = -1;
+        }
+    }
+    this->tintin_reporter.log<Tintin_reporter::INFO>(TINTIN_FMT("listening on {}:{}"),
+        this->options.ipv6 ? "[::]" : "0.0.0.0", Matt_daemon::PORT);
+    if (this->unixFd >= 0) {
+        this->tintin_reporter.log<Tintin_reporter::INFO>(TINTIN_FMT("listening on unix:{}"), this->options.unixPath);
+    }
+
+    // the epoll reactors stay ready: a worker whose ring can't be set up (or enabled) runs the readiness loop
+    if (this->options.engine == ENGINE_URING) {
+        for (std::unique_ptr<Worker> &worker : this->workers) {
+            if (!worker->uring.setup(URING_ENTRIES, this->options.readSize, URING_BUFFERS)) {
+                this->tintin_reporter.log<Tintin_reporter::INFO>(TINTIN_FMT("io_uring network engine unavailable ({}), using epoll"),
+                    (const char *)strerror(errno));
+                break;
+            }
+        }
+    }
+    this->tintin_reporter.log<Tintin_reporter::INFO>(TINTIN_FMT("network engine: {}"), this->workers[0]->uring.active() ? "io_uring" : "epoll");
+
+    if (inherited != nullptr) {
+        this->adoptClients(inherited->clients);
+    }
+
+    freeaddrinfo(res);
+}
+
+void Matt_daemon::createListener(Worker &worker, const struct addrinfo *res) {
+    // creating a TCP socket (to listen on connection requests), non-blocking: acceptClients() accepts until EAGAIN
+    worker.listenFd = socket(res->ai_family, res->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, res->ai_protocol);
 
-    if (this->listenFd < 0) {
+    if (worker.listenFd < 0) {
         this->tintin_reporter.log(Tintin_reporter::ERROR, "ERROR creating server (socket creation failure)");
         this->tintin_reporter.log(Tintin_reporter::INFO, "Quitting");
         exit(EXIT_FAILURE);
     }
 
     int opt = 1;
-    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    setsockopt(worker.listenFd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    // dual stack: IPv4 clients reach the same socket (whatever net.ipv6.bindv6only says)
+    int v6only = 0;
+    if (res->ai_family == AF_INET6 && setsockopt(worker.listenFd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only)) < 0) {
+        this->tintin_reporter.log(Tintin_reporter::ERROR, "ERROR creating server (IPV6_V6ONLY failure)");
+        this->tintin_reporter.log(Tintin_reporter::INFO, "Quitting");
+        exit(EXIT_FAILURE);
+    }
+
+    // every worker binds the same port, the kernel hashes each new connection to one of the sockets
+    // (only with several workers: a single daemon shouldn't let another process share its port)
+    if (this->workers.size() > 1 && setsockopt(worker.listenFd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        this->tintin_reporter.log(Tintin_reporter::ERROR, "ERROR creating server (SO_REUSEPORT failure)");
+        this->tintin_reporter.log(Tintin_reporter::INFO, "Quitting");
+        exit(EXIT_FAILURE);
+    }
 
     // binding the socket
-    if (bind(this->listenFd, res->ai_addr, res->ai_addrlen) < 0) {
+    if (bind(worker.listenFd, res->ai_addr, res->ai_addrlen) < 0) {
         this->tintin_reporter.log(Tintin_reporter::ERROR, "ERROR creating server (socket binding failure)");
         this->tintin_reporter.log(Tintin_reporter::INFO, "Quitting");
         exit(EXIT_FAILURE);
     }
 
-    if (listen(this->listenFd, Matt_daemon::MAX_CLIENTS) < 0) {
+    // the connection limit is enforced by acceptClients(), the backlog only absorbs bursts
+    if (listen(worker.listenFd, this->options.backlog) < 0) {
         this->tintin_reporter.log(Tintin_reporter::ERROR, "ERROR creating server (listen failure)");
         this->tintin_reporter.log(Tintin_reporter::INFO, "Quitting");
         exit(EXIT_FAILURE);
     }
+}
+
+void Matt_daemon::watchListeners(Worker &worker) {
+    if (!worker.reactor.open()) {
+        this->tintin_reporter.log(Tintin_reporter::ERROR, "ERROR creating server (epoll failure)");
+        this->tintin_reporter.log(Tintin_reporter::INFO, "Quitting");
+        exit(EXIT_FAILURE);
+    }
 
-    freeaddrinfo(res);
+    // every worker watches the unix listener: the ones that lose the race for a connection get EAGAIN
+    if (!worker.reactor.watch(worker.listenFd, Reactor::LISTENER, TCP_ENDPOINT)
+        || (this->unixFd >= 0 && !worker.reactor.watch(this->unixFd, Reactor::LISTENER, UNIX_ENDPOINT))
+        || !worker.reactor.watch(this->wakeFd, Reactor::WAKEUP, this->wakeFd)) {
+        this->tintin_reporter.log(Tintin_reporter::ERROR, "ERROR creating server (epoll registration failure)");
+        this->tintin_reporter.log(Tintin_reporter::INFO, "Quitting");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void Matt_daemon::createUnixListener(void) {
+    // same host clients skip the TCP stack: no checksums, acks or loopback routing per line
+    struct sockaddr_un addr;
+    const std::string &path = this->options.unixPath;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        this->tintin_reporter.log(Tintin_reporter::ERROR, "ERROR creating server (unix socket path too long)");
+        this->tintin_reporter.log(Tintin_reporter::INFO, "Quitting");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(addr.sun_path, path.data(), path.size());
+    socklen_t addrLen = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + path.size());
+    if (path[0] == '@') {
+        addr.sun_path[0] = '\0'; // abstract namespace: no file, the name is the bytes after the NUL
+    } else {
+        addrLen += 1;
+        unlink(path.c_str()); // left behind by a crashed run (the lock says no other daemon is using it)
+    }
+
+    this->unixFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (this->unixFd < 0) {
+        this->tintin_reporter.log(Tintin_reporter::ERROR, "ERROR creating server (unix socket creation failure)");
+        this->tintin_reporter.log(Tintin_reporter::INFO, "Quitting");
+        exit(EXIT_FAILURE);
+    }
+    if (bind(this->unixFd, (struct sockaddr *)&addr, addrLen) < 0) {
+        this->tintin_reporter.log<Tintin_reporter::ERROR>(TINTIN_FMT("ERROR creating server (unix socket binding failure: {})"),
+            (const char *)strerror(errno));
+        this->tintin_reporter.log(Tintin_reporter::INFO, "Quitting");
+        exit(EXIT_FAILURE);
+    }
+    if (listen(this->unixFd, this->options.backlog) < 0) {
+        this->tintin_reporter.log(Tintin_reporter::ERROR, "ERROR creating server (listen failure)");
+        this->tintin_reporter.log(Tintin_reporter::INFO, "Quitting");
+        exit(EXIT_FAILURE);
+    }
+}
+
+int Matt_daemon::listenerFd(const Worker &worker, uint64_t endpoint) const {
+    return (endpoint == UNIX_ENDPOINT ? this->unixFd : worker.listenFd);
+}
+
+void Matt_daemon::startWorkers(void) {
+    // the worker threads inherit a mask blocking the handled signals: they're always delivered to the main thread,
+    // whose epoll_wait() they interrupt (it then stops the others)
+    sigset_t handled;
+    sigset_t previous;
+    sigemptyset(&handled);
+    sigaddset(&handled, SIGTERM);
+    sigaddset(&handled, SIGINT);
+    sigaddset(&handled, SIGHUP);
+    sigaddset(&handled, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &handled, &previous);
+
+    if (this->options.stallThresholdMs > 0
+        && !Stall_watchdog::start(this->tintin_reporter, this->options.stallThresholdMs, this->options.stallBacktrace)) {
+        this->tintin_reporter.log(Tintin_reporter::ERROR, "failure to start the stall watchdog thread");
+    }
+    try {
+        for (size_t i = 1; i < this->workers.size(); ++i) {
+            Worker *worker = this->workers[i].get();
+            worker->thread = std::thread([this, worker]() { this->runWorker(*worker); });
+        }
+    } catch (const std::system_error &e) {
+        this->tintin_reporter.log(Tintin_reporter::ERROR, "failure to start the worker threads");
+        this->stopWorkers();
+    }
+
+    pthread_sigmask(SIG_SETMASK, &previous, nullptr);
 }
 
-void Matt_daemon::eventLoop(void) {
-    while (Matt_daemon::receivedSignal == 0 && Matt_daemon::quitRequested == 0) {
-        fd_set readfds;
-        FD_ZERO(&readfds);
+void Matt_daemon::stopWorkers(void) {
+    if (this->stopping.exchange(true)) {
+        return;
+    }
 
-        FD_SET(listenFd, &readfds);
-        int maxFd = listenFd;
+    uint64_t one = 1;
+    ssize_t ret = write(this->wakeFd, &one, sizeof(one)); // written once, the counter can't overflow
+    (void)ret;
+}
 
-        for (const Client &client : clients) {
-            FD_SET(client.fd, &readfds);
-            if (client.fd > maxFd) {
-                maxFd = client.fd;
+void Matt_daemon::joinWorkers(void) {
+    this->stopWorkers(); // the main thread's loop is over, whatever the reason
+    for (std::unique_ptr<Worker> &worker : this->workers) {
+        if (worker->thread.joinable()) {
+            worker->thread.join();
+        }
+    }
+}
+
+bool Matt_daemon::running(void) const {
+    return (Matt_daemon::receivedSignal == 0 && Matt_daemon::quitRequested == 0 && !this->stopping.load(std::memory_order_relaxed));
+}
+
+void Matt_daemon::runWorker(Worker &worker) {
+    size_t index = 0;
+    while (this->workers[index].get() != &worker) {
+        ++index;
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "worker %zu", index);
+    Stats_page::attach(name);
+    Latency_stats::attach();
+    Stall_watchdog::watch(name);
+    this->startTimers(worker);
+
+    // the ring is bound to the thread that enables it: the worker keeps its thread across a failed handoff
+    bool uring = worker.uring.active() && worker.uring.enable();
+    do {
+        if (uring) {
+            this->uringLoop(worker);
+            if (this->successorFd >= 0) {
+                this->drainUring(worker);
             }
+        } else {
+            this->eventLoop(worker);
         }
 
-        int ready = select(maxFd + 1, &readfds, NULL, NULL, NULL);
+        // the first worker to stop (quit, signal delivered to the main thread, failure) takes the others along
+        this->stopWorkers();
+    } while (this->awaitHandoff(worker));
+    Stall_watchdog::leave();
+}
+
+bool Matt_daemon::awaitHandoff(Worker &worker) {
+    if (this->successorFd < 0) {
+        return (false);
+    }
+
+    std::unique_lock<std::mutex> lock(this->handoffMutex);
+    Stall_watchdog::idle();
+    if (&worker != this->workers[0].get()) {
+        // parked until the first worker (the main thread) handed off: then we exit, or serve again if it failed
+        uint64_t round = this->handoffRound;
+        this->parkedWorkers += 1;
+        this->handoffChanged.notify_all();
+        this->handoffChanged.wait(lock, [this, round]() { return (this->handoffRound != round); });
+        return (this->resumeServing);
+    }
+
+    size_t threads = 0;
+    for (std::unique_ptr<Worker> &other : this->workers) {
+        threads += other->thread.joinable() ? 1 : 0;
+    }
+    this->handoffChanged.wait(lock, [this, threads]() { return (this->parkedWorkers == threads); });
+    this->parkedWorkers = 0;
+
+    // a quit or a signal that came during the handoff wins: the successor sees EOF instead of the state and leaves
+    bool quitting = Matt_daemon::quitRequested != 0 || Matt_daemon::receivedSignal != 0;
+    Stall_watchdog::begin(clockNs(CLOCK_MONOTONIC_COARSE) / 1000000);
+    Stall_watchdog::enter("handoff", -1);
+    this->handedOff = !quitting && this->handOff();
+    this->resumeServing = !quitting && !this->handedOff;
+    if (this->resumeServing) {
+        this->resumeAfterHandoff();
+    }
+    Stall_watchdog::idle();
+    this->handoffRound += 1;
+    this->handoffChanged.notify_all();
+    return (this->resumeServing);
+}
+
+void Matt_daemon::resumeAfterHandoff(void) {
+    // whatever the successor got from us dies with it (the lock fd included: our description stays locked)
+    close(this->successorFd);
+    this->successorFd = -1;
+    kill(this->successorPid, SIGKILL);
+    waitpid(this->successorPid, nullptr, 0);
+    this->successorPid = 0;
+
+    // the wakeup eventfd is readable until it's read, the loops would stop again right away
+    uint64_t count;
+    ssize_t ret = read(this->wakeFd, &count, sizeof(count));
+    (void)ret;
+    this->stopping = false;
+
+    // every client gets a turn first: the bytes its stopped loop left (epoll: edge-triggered, the socket may not be
+    // reported again; io_uring: its recv was cancelled, what it completed with is in received, it's armed again after).
+    // The list is rebuilt, a stopped revisit loop dropped the handles it didn't reach with their flag still set
+    for (std::unique_ptr<Worker> &worker : this->workers) {
+        worker->unfinished.clear();
+        worker->clients.forEach([&worker](Slot_map<Client>::Handle handle, Client &client) {
+            client.unfinished = true;
+            worker->unfinished.push_back(handle);
+        });
+    }
+}
+
+void Matt_daemon::eventLoop(Worker &worker) {
+    while (this->running()) {
+        if (Matt_daemon::reopenRequested.exchange(0)) {
+            Stall_watchdog::enter("reopen", -1);
+            this->tintin_reporter.reopen();
+        }
+        if (Matt_daemon::restartRequested.exchange(0)) {
+            Stall_watchdog::enter("restart", -1); // fork, exec, waiting for the successor (waitpid if it fails)
+            this->spawnSuccessor(); // once it's up, every loop stops
+        }
+
+        long timeout = this->pollTimeout(worker);
+        Stall_watchdog::idle();
+        int ready = worker.reactor.wait(timeout);
+        worker.nowMs = clockNs(CLOCK_MONOTONIC_COARSE) / 1000000;
+        Stall_watchdog::begin(worker.nowMs); // interrupted as well: a signal's work (reopen, restart) is done next turn
 
-        if (ready <= 0) {
-            if (ready == 0 || errno == EINTR) {
+        if (ready < 0) {
+            if (errno == EINTR) {
                 continue;
             }
 
-            // if select failed and it wasn't interrupted we report the error and break the event loop
-            this->tintin_reporter.log(Tintin_reporter::ERROR, "select failure");
+            // if epoll_wait failed and it wasn't interrupted we report the error and break the event loop
+            this->tintin_reporter.log(Tintin_reporter::ERROR, "epoll_wait failure");
             break;
         }
 
-        // checking new connection requests
-        if (FD_ISSET(this->listenFd, &readfds)) {
-            int clientFd = accept(this->listenFd, NULL, NULL);
+        // only the fds that became ready, whatever the number of connected clients
+        for (int i = 0; i < ready && this->running(); ++i) {
+            const struct epoll_event &event = worker.reactor.event(i);
 
-            if (clientFd < 0) {
-                if (errno != EINTR) {
-                    this->tintin_reporter.log(Tintin_reporter::ERROR, "accept failure");
-                }
+            if (Reactor::kindOf(event) == Reactor::LISTENER) {
+                Stall_watchdog::enter("accept", -1);
+                this->acceptClients(worker, this->listenerFd(worker, Reactor::idOf(event)));
+                continue;
+            }
+            if (Reactor::kindOf(event) == Reactor::WAKEUP) {
+                continue; // stopping (the eventfd is never read, it stays readable)
             }
 
-            if (this->clients.size() >= MAX_CLIENTS) {
-                close(clientFd);
-            } else if (clientFd >= 0) {
-                this->clients.emplace_back(clientFd);
+            this->serveClient(worker, Reactor::idOf(event));
+        }
+
+        // edge-triggered: the sockets left behind by their read budget won't be reported again, they get another turn
+        worker.revisited.swap(worker.unfinished);
+        for (size_t i = 0; i < worker.revisited.size() && this->running(); ++i) {
+            Client *client = worker.clients.get(worker.revisited[i]);
+            if (client != nullptr) {
+                client->unfinished = false;
+                this->serveClient(worker, worker.revisited[i]);
             }
         }
+        worker.revisited.clear();
+        Stall_watchdog::enter("memory", -1);
+        this->checkMemory(worker);
+        Stall_watchdog::enter("timers", -1);
+        this->runTimers(worker);
+    }
+}
+
+void Matt_daemon::adoptClients(std::vector<Handoff::Client> &clients) {
+    // round robin: whatever the predecessor's balance was (or its number of workers)
+    size_t next = 0;
+    for (Handoff::Client &inherited : clients) {
+        Worker &worker = *this->workers[next++ % this->workers.size()];
+        Slot_map<Client>::Handle handle = this->addClient(worker, inherited.fd); // refused (lower limits): told to retry
+
+        // watched by the epoll set even if the worker runs io_uring (it falls back to epoll if the ring can't be enabled)
+        if (handle != 0 && !worker.reactor.watch(inherited.fd, Reactor::CLIENT, handle)) {
+            this->closeClient(worker, handle);
+            continue;
+        }
+
+        size_t taken; // all of it: the loops haven't started, nothing stops them yet
+        if (handle != 0 && !this->receiveClient(*worker.clients.get(handle), inherited.pending.data(), inherited.pending.size(), &taken)) {
+            this->closeClient(worker, handle);
+        }
+    }
+    clients.clear();
+}
+
+void Matt_daemon::uringLoop(Worker &worker) {
+    // armed once: every connection and every wakeup comes back as a completion
+    if (!worker.uring.acceptMultishot(worker.listenFd, Reactor::token(Reactor::LISTENER, TCP_ENDPOINT))
+        || (this->unixFd >= 0 && !worker.uring.acceptMultishot(this->unixFd, Reactor::token(Reactor::LISTENER, UNIX_ENDPOINT)))
+        || !worker.uring.pollMultishot(this->wakeFd, Reactor::token(Reactor::WAKEUP, 0))) {
+        this->tintin_reporter.log(Tintin_reporter::ERROR, "io_uring submission failure");
+        return;
+    }
+    // clients taken over by a hot restart were added before the ring was enabled (after a failed handoff, the clients
+    // are all unfinished: armed once their kept chunks are handled)
+    worker.clients.forEach([&worker](Slot_map<Client>::Handle handle, Client &client) {
+        if (!client.unfinished && !client.receiving) {
+            client.receiving = worker.uring.recvMultishot(client.fd, Reactor::token(Reactor::CLIENT, handle));
+        }
+    });
 
-        // handle clients activity
-        for (size_t i = 0; i < this->clients.size(); ) {
-            if (FD_ISSET(this->clients[i].fd, &readfds)) {
-                char buffer[1024];
-                ssize_t bytes = read(clients[i].fd, buffer, sizeof(buffer));
+    while (this->running()) {
+        if (Matt_daemon::reopenRequested.exchange(0)) {
+            Stall_watchdog::enter("reopen", -1);
+            this->tintin_reporter.reopen();
+        }
+        if (Matt_daemon::restartRequested.exchange(0)) {
+            Stall_watchdog::enter("restart", -1); // fork, exec, waiting for the successor (waitpid if it fails)
+            this->spawnSuccessor(); // once it's up, every loop stops
+        }
 
-                // if read was interrupted break 
-                if (bytes < 0 && errno == EINTR) {
-                    break;
+        // one syscall submits the new requests (re-armed recvs, cancellations) and waits for a batch of completions
+        long timeout = this->pollTimeout(worker);
+        Stall_watchdog::idle();
+        int waited = worker.uring.wait(timeout);
+        worker.nowMs = clockNs(CLOCK_MONOTONIC_COARSE) / 1000000;
+        Stall_watchdog::begin(worker.nowMs);
+        if (waited < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            this->tintin_reporter.log(Tintin_reporter::ERROR, "io_uring_enter failure");
+            break;
+        }
+
+        Net_uring::Completion completion;
+        ++worker.turns;
+        while (this->running() && worker.uring.next(&completion)) {
+            bool more = (completion.flags & IORING_CQE_F_MORE) != 0; // false: the multishot request is over
+
+            if (Reactor::kindOf(completion.tag) == Reactor::LISTENER) {
+                Stall_watchdog::enter("accept", -1);
+                if (completion.res >= 0) {
+                    Slot_map<Client>::Handle handle = this->addClient(worker, completion.res);
+                    if (handle != 0) {
+                        worker.clients.get(handle)->receiving = worker.uring.recvMultishot(completion.res, Reactor::token(Reactor::CLIENT, handle));
+                    }
+                } else if (completion.res != -ECONNABORTED && completion.res != -EINTR) {
+                    this->admission.acceptFailed();
+                    this->tintin_reporter.log(Tintin_reporter::ERROR, "accept failure");
+                }
+                if (!more) {
+                    worker.uring.acceptMultishot(this->listenerFd(worker, Reactor::idOf(completion.tag)), completion.tag);
                 }
+                continue;
+            }
+            if (Reactor::kindOf(completion.tag) != Reactor::CLIENT) {
+                continue; // WAKEUP (stopping) or a cancellation
+            }
 
-                // if client was diconnected or read failed, close client socket and erase client from clients vector
-                if (bytes <= 0) {
-                    close(clients[i].fd);
-                    this->clients.erase(this->clients.begin() + i);
+            // a stale handle (the client was closed, its cancelled recv completes later) finds nothing, even if its slot was reused
+            Slot_map<Client>::Handle handle = Reactor::idOf(completion.tag);
+            Client *client = worker.clients.get(handle);
+            bool alive = (client != nullptr);
+            if (alive) {
+                client->receiving = more;
+                Stall_watchdog::enter("client", client->fd);
+            }
+
+            if (completion.flags & IORING_CQE_F_BUFFER) {
+                uint16_t id = (uint16_t)(completion.flags >> IORING_CQE_BUFFER_SHIFT);
+                if (alive && completion.res > 0) {
+                    Stats_page::add(Stats_page::READS);
+                    Stats_page::add(Stats_page::BYTES, (uint64_t)completion.res);
+                    client->lastActiveMs = worker.nowMs;
+                    if (client->turn != worker.turns) {
+                        client->turn = worker.turns;
+                        client->turnReads = 0;
+                    }
+                    // the same budget as the epoll engine's reads, behind what it already had to keep
+                    if (client->unfinished || client->turnReads >= READS_PER_TURN) {
+                        this->deferChunk(worker, handle, *client, worker.uring.buffer(id), (size_t)completion.res);
+                    } else {
+                        // a stop in the middle: the rest is kept (handed off, or handled first if the handoff fails)
+                        size_t taken;
+                        client->turnReads += 1;
+                        alive = this->receiveClient(*client, worker.uring.buffer(id), (size_t)completion.res, &taken);
+                        client->received.append(worker.uring.buffer(id) + taken, alive ? (size_t)completion.res - taken : 0);
+                    }
+                }
+                worker.uring.recycle(id);
+                if (!alive && client != nullptr) {
+                    this->closeClient(worker, handle);
                     continue;
                 }
+            }
+            if (!alive) {
+                continue;
+            }
+
+            if (completion.res == 0 || (completion.res < 0 && completion.res != -ENOBUFS && completion.res != -ECANCELED)) {
+                // disconnected (or failed): its last kept chunks are handled now (stopping: what's left goes along with it)
+                size_t taken = 0;
+                alive = !client->unfinished || this->receiveClient(*client, client->received.data(), client->received.size(), &taken);
+                client->received.erase(0, taken);
+                if (!alive || client->received.empty()) {
+                    this->closeClient(worker, handle);
+                }
+            } else if (!more && !client->unfinished) {
+                // out of provided buffers (they came back while this batch was handled) or the kernel ended the multishot
+                // (a client over its budget is armed again once its kept chunks are handled)
+                client->receiving = worker.uring.recvMultishot(client->fd, completion.tag);
+            }
+        }
 
-                // append received bytes to the client's buffer, then extract and process each line
-                this->clients[i].buffer.append(buffer, bytes);
-                while (Matt_daemon::receivedSignal == 0 && Matt_daemon::quitRequested == 0)
-                {
-                    size_t pos = clients[i].buffer.find('\n');
-                    if (pos == std::string::npos) {
-                        break;
-                    }
+        // the clients over their budget get another turn, like the epoll engine's undrained sockets
+        worker.revisited.swap(worker.unfinished);
+        for (size_t i = 0; i < worker.revisited.size() && this->running(); ++i) {
+            Client *client = worker.clients.get(worker.revisited[i]);
+            if (client != nullptr) {
+                Stall_watchdog::enter("client", client->fd);
+                if (!this->resumeClient(worker, worker.revisited[i], *client)) {
+                    this->closeClient(worker, worker.revisited[i]);
+                }
+            }
+        }
+        worker.revisited.clear();
+        Stall_watchdog::enter("memory", -1);
+        this->checkMemory(worker);
+        Stall_watchdog::enter("timers", -1);
+        this->runTimers(worker);
+    }
+}
+
+void Matt_daemon::deferChunk(Worker &worker, Slot_map<Client>::Handle handle, Client &client, const char *data, size_t len) {
+    client.received.append(data, len);
+    if (client.unfinished) {
+        return;
+    }
+
+    // its recv is cancelled: the kernel stops taking its bytes off the socket (the sender is throttled by TCP) until
+    // what was kept is handled; the chunks already completed still come, they're kept as well
+    client.unfinished = true;
+    worker.unfinished.push_back(handle);
+    if (client.receiving) {
+        worker.uring.cancel(Reactor::token(Reactor::CLIENT, handle));
+    }
+}
+
+bool Matt_daemon::resumeClient(Worker &worker, Slot_map<Client>::Handle handle, Client &client) {
+    size_t len = std::min(client.received.size(), READS_PER_TURN * this->options.readSize);
+
+    client.turn = worker.turns;
+    client.turnReads = READS_PER_TURN;
+    if (!this->receiveClient(client, client.received.data(), len, &len)) {
+        return (false);
+    }
+    client.received.erase(0, len); // all of it, unless stopping
+    if (!client.received.empty()) {
+        worker.unfinished.push_back(handle);
+        return (true);
+    }
+
+    // caught up: received again (once its cancelled recv completed, if it hasn't yet)
+    client.unfinished = false;
+    if (!client.receiving) {
+        client.receiving = worker.uring.recvMultishot(client.fd, Reactor::token(Reactor::CLIENT, handle));
+    }
+    return (true);
+}
+
+void Matt_daemon::drainUring(Worker &worker) {
+    // the multishot recvs take bytes off the sockets until they're cancelled, the accepts take connections off the
+    // backlogs: what they still complete with is kept for the successor (bounded wait, a lost completion isn't worth more)
+    size_t outstanding = 0;
+    for (uint64_t endpoint : { TCP_ENDPOINT, UNIX_ENDPOINT }) {
+        if (this->listenerFd(worker, endpoint) >= 0 && worker.uring.cancel(Reactor::token(Reactor::LISTENER, endpoint))) {
+            outstanding += 1;
+        }
+    }
+    worker.uring.cancel(Reactor::token(Reactor::WAKEUP, 0));
+    worker.clients.forEach([&worker, &outstanding](Slot_map<Client>::Handle handle, Client &client) {
+        if (client.receiving && worker.uring.cancel(Reactor::token(Reactor::CLIENT, handle))) {
+            outstanding += 1;
+        }
+    });
 
-                    std::string line = clients[i].buffer.substr(0, pos);
-                    clients[i].buffer.erase(0, pos + 1);
+    int64_t deadlineNs = clockNs(CLOCK_MONOTONIC) + HANDOFF_DRAIN_MS * 1000000;
+    while (outstanding > 0 && clockNs(CLOCK_MONOTONIC) < deadlineNs) {
+        if (worker.uring.wait(HANDOFF_DRAIN_MS) < 0 && errno != EINTR) {
+            break;
+        }
+
+        Net_uring::Completion completion;
+        while (worker.uring.next(&completion)) {
+            bool more = (completion.flags & IORING_CQE_F_MORE) != 0;
+
+            if (completion.tag != 0 && Reactor::kindOf(completion.tag) == Reactor::LISTENER) {
+                if (completion.res >= 0) {
+                    this->addClient(worker, completion.res); // no recv: it's the successor's
+                }
+                outstanding -= (!more && outstanding > 0) ? 1 : 0;
+                continue;
+            }
+            if (completion.tag == 0 || Reactor::kindOf(completion.tag) != Reactor::CLIENT) {
+                continue;
+            }
 
-                    this->handleMessage(line);
+            Client *client = worker.clients.get(Reactor::idOf(completion.tag));
+            if (completion.flags & IORING_CQE_F_BUFFER) {
+                uint16_t id = (uint16_t)(completion.flags >> IORING_CQE_BUFFER_SHIFT);
+                if (client != nullptr && completion.res > 0) {
+                    client->received.append(worker.uring.buffer(id), (size_t)completion.res);
                 }
+                worker.uring.recycle(id);
             }
+            if (client != nullptr && client->receiving && !more) {
+                client->receiving = false;
+                outstanding -= 1;
+            }
+        }
+    }
+}
 
-            if (Matt_daemon::receivedSignal || Matt_daemon::quitRequested) {
-                break;
+void Matt_daemon::acceptClients(Worker &worker, int listenFd) {
+    while (true) {
+        int clientFd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if (clientFd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                this->admission.acceptFailed();
+                this->tintin_reporter.log(Tintin_reporter::ERROR, "accept failure");
             }
+            return;
+        }
 
-            i += 1;
+        Slot_map<Client>::Handle handle = this->addClient(worker, clientFd);
+        if (handle != 0 && !worker.reactor.watch(clientFd, Reactor::CLIENT, handle)) {
+            this->closeClient(worker, handle);
         }
     }
+}
 
-    // reporting daemon exit reason
+Slot_map<Matt_daemon::Client>::Handle Matt_daemon::addClient(Worker &worker, int clientFd) {
+    // connection limit reached (all workers together) or under pressure: the peer is told when to come back
+    if (this->admission.admit(worker.pressure) != Admission::ADMIT) {
+        this->admission.refuse(clientFd);
+        Stats_page::add(Stats_page::REFUSED);
+        return (0);
+    }
 
-    if (Matt_daemon::quitRequested) {
-        this->tintin_reporter.log(Tintin_reporter::INFO, "Request quit");
-    } else if (Matt_daemon::receivedSignal) {
-        this->tintin_reporter.log(Tintin_reporter::INFO, "Signal handler");
+    Slot_map<Client>::Handle handle = worker.clients.insert(clientFd, worker.bufferPool.acquire(), ++worker.admissions);
+    if (handle == 0) {
+        this->admission.release();
+        this->admission.refuse(clientFd);
+        Stats_page::add(Stats_page::REFUSED);
+        return (0);
+    }
+    Stats_page::add(Stats_page::ACCEPTED);
+
+    Client *client = worker.clients.get(handle);
+    client->lastActiveMs = worker.nowMs;
+    if (this->options.idleTimeoutSec > 0) {
+        client->idleTimer = worker.timers.arm(worker.nowMs, this->options.idleTimeoutSec * 1000, Reactor::token(Reactor::CLIENT, handle));
+    }
+    return (handle);
+}
+
+void Matt_daemon::accountBuffered(Client &client) {
+    if (this->options.memoryBudget == 0) {
+        return;
+    }
+
+    size_t buffered = client.buffer.pending();
+    this->admission.addBuffered((int64_t)buffered - (int64_t)client.buffered);
+    client.buffered = buffered;
+}
+
+void Matt_daemon::checkMemory(Worker &worker) {
+    if (this->admission.overMemoryBudget() <= 0) {
+        return;
+    }
+
+    // the clients holding the biggest partial lines go first (slow senders of huge lines), the other workers
+    // shed their own as soon as their batch ends
+    std::vector<std::pair<size_t, Slot_map<Client>::Handle> > holders;
+    worker.clients.forEach([&holders](Slot_map<Client>::Handle handle, Client &client) {
+        if (client.buffered > 0) {
+            holders.emplace_back(client.buffered, handle);
+        }
+    });
+    std::sort(holders.begin(), holders.end(), std::greater<std::pair<size_t, Slot_map<Client>::Handle> >());
+
+    // the excess is the whole daemon's, every worker sees all of it: it's read again before each close (a close gives
+    // its bytes back at once, ours or another worker's), so concurrent workers overshoot by a client each, not by N times
+    // the excess. A share per worker would leave the rest to workers that may have no batch ending any time soon
+    for (size_t i = 0; i < holders.size() && this->admission.overMemoryBudget() > 0; ++i) {
+        this->admission.shed(Admission::SHED_MEMORY);
+        this->closeClient(worker, holders[i].second);
+    }
+}
+
+void Matt_daemon::startTimers(Worker &worker) {
+    worker.nowMs = clockNs(CLOCK_MONOTONIC_COARSE) / 1000000;
+    if (this->options.cpuBudget > 0) {
+        worker.windowStartNs = clockNs(CLOCK_MONOTONIC);
+        worker.windowCpuNs = clockNs(CLOCK_THREAD_CPUTIME_ID);
+        worker.timers.arm(worker.nowMs, PRESSURE_WINDOW_MS, Reactor::token(Reactor::TIMER, CPU_WINDOW), PRESSURE_WINDOW_MS);
+    }
+    // the histograms are the whole daemon's: one worker reports them
+    if (this->options.latencyReportSec > 0 && &worker == this->workers[0].get()) {
+        long periodMs = this->options.latencyReportSec * 1000;
+        worker.timers.arm(worker.nowMs, periodMs, Reactor::token(Reactor::TIMER, LATENCY_REPORT), periodMs);
+    }
+}
+
+long Matt_daemon::pollTimeout(Worker &worker) {
+    if (!worker.unfinished.empty()) {
+        return (0);
+    }
+
+    // a pending "last message repeated" count bounds how long we may sleep, so does the next timer
+    long repeats = this->tintin_reporter.flushRepeats();
+    long timers = worker.timers.nextTimeout(clockNs(CLOCK_MONOTONIC_COARSE) / 1000000);
+    if (repeats < 0 || timers < 0) {
+        return (std::max(repeats, timers));
+    }
+    return (std::min(repeats, timers));
+}
+
+void Matt_daemon::runTimers(Worker &worker) {
+    Timer_wheel::Expired expired;
+
+    worker.nowMs = clockNs(CLOCK_MONOTONIC_COARSE) / 1000000;
+    while (this->running() && worker.timers.expireNext(worker.nowMs, &expired)) {
+        if (Reactor::kindOf(expired.data) == Reactor::CLIENT) {
+            this->expireIdle(worker, Reactor::idOf(expired.data));
+        } else if (Reactor::idOf(expired.data) == CPU_WINDOW) {
+            this->checkCpu(worker);
+        } else if (Reactor::idOf(expired.data) == LATENCY_REPORT) {
+            this->reportLatency();
+        }
+    }
+}
+
+void Matt_daemon::expireIdle(Worker &worker, Slot_map<Client>::Handle handle) {
+    Client *client = worker.clients.get(handle);
+    if (client == nullptr) {
+        return;
+    }
+
+    // the timer isn't moved on every read: when it fires early (the client spoke since), it's armed for the rest
+    long timeoutMs = this->options.idleTimeoutSec * 1000;
+    long idleMs = (long)(worker.nowMs - client->lastActiveMs);
+    client->idleTimer = 0;
+    if (idleMs < timeoutMs) {
+        client->idleTimer = worker.timers.arm(worker.nowMs, timeoutMs - idleMs, Reactor::token(Reactor::CLIENT, handle));
+        return;
+    }
+
+    this->tintin_reporter.log<Tintin_reporter::INFO>(TINTIN_FMT("client disconnected: idle for more than {} s"),
+        this->options.idleTimeoutSec);
+    this->closeClient(worker, handle);
+}
+
+void Matt_daemon::reportLatency(void) {
+    Latency_histogram::Summary summaries[Latency_stats::STAGES];
+
+    for (int stage = 0; stage < Latency_stats::STAGES; ++stage) {
+        Latency_histogram::Snapshot merged = Latency_stats::snapshot((Latency_stats::Stage)stage);
+        summaries[stage] = merged.since(this->latencyReported[stage]).summarize();
+        this->latencyReported[stage] = std::move(merged);
+    }
+
+    // no line came in: nothing to report (the summaries are log records themselves, they'd keep an idle daemon reporting)
+    if (summaries[Latency_stats::READ_TO_LINE].count == 0) {
+        return;
+    }
+    for (int stage = 0; stage < Latency_stats::STAGES; ++stage) {
+        char text[256];
+        formatLatency(text, sizeof(text), (Latency_stats::Stage)stage, summaries[stage]);
+        this->tintin_reporter.log<Tintin_reporter::INFO>(TINTIN_FMT("latency (last {} s) {}"), this->options.latencyReportSec, (const char *)text);
+    }
+}
+
+void Matt_daemon::checkCpu(Worker &worker) {
+    // cpu time the worker's thread got over the last window (what it really used, not the wall clock between waits:
+    // those stretch as soon as it shares a cpu)
+    int64_t nowNs = clockNs(CLOCK_MONOTONIC);
+    int64_t cpuNs = clockNs(CLOCK_THREAD_CPUTIME_ID);
+    int64_t windowNs = nowNs - worker.windowStartNs;
+    int64_t busyPercent = (windowNs > 0) ? (cpuNs - worker.windowCpuNs) * 100 / windowNs : 0;
+
+    worker.windowStartNs = nowNs;
+    worker.windowCpuNs = cpuNs;
+    worker.pressure = (busyPercent > (int64_t)this->options.cpuBudget);
+    if (!worker.pressure) {
+        return;
+    }
+
+    // newcomers are refused while the pressure lasts, the newest client is shed once per window
+    Slot_map<Client>::Handle newest = 0;
+    uint64_t newestAdmitted = 0;
+    worker.clients.forEach([&newest, &newestAdmitted](Slot_map<Client>::Handle handle, Client &client) {
+        if (client.admitted > newestAdmitted) {
+            newest = handle;
+            newestAdmitted = client.admitted;
+        }
+    });
+    if (newest != 0) {
+        this->admission.shed(Admission::SHED_CPU);
+        this->closeClient(worker, newest);
     }
 }
 
-void Matt_daemon::handleMessage(const std::string &line) const {
-    if (line == "quit") {
-        Matt_daemon::quitRequested = 1;
+void Matt_daemon::serveClient(Worker &worker, Slot_map<Client>::Handle handle) {
+    // a stale handle (the client was closed earlier in this batch) finds nothing, even if its slot was reused
+    Client *client = worker.clients.get(handle);
+    if (client == nullptr) {
         return;
     }
 
-    std::string userMessage = "User input: " + line;
-    this->tintin_reporter.log(Tintin_reporter::LOG, userMessage.c_str());
+    bool drained = true;
+    Stall_watchdog::enter("client", client->fd); // reading, handling its lines, logging them
+    client->lastActiveMs = worker.nowMs;
+    if (!this->readClient(*client, &drained)) {
+        this->closeClient(worker, handle);
+    } else if (!drained && !client->unfinished) {
+        client->unfinished = true;
+        worker.unfinished.push_back(handle);
+    }
+}
+
+bool Matt_daemon::readClient(Client &client, bool *drained) {
+    // edge-triggered: the socket has to be drained, what is left behind wouldn't be reported again (the caller
+    // comes back to it when the read budget runs out first)
+    *drained = false;
+    for (int reads = 0; reads < READS_PER_TURN && this->running(); ++reads) {
+        size_t room;
+        char *tail = client.buffer.tail(&room);
+        ssize_t bytes = recv(client.fd, tail, room, MSG_DONTWAIT); // straight into the client's buffer, up to readSize bytes and more
+
+        if (bytes < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            *drained = true;
+            return (errno == EAGAIN || errno == EWOULDBLOCK);
+        }
+
+        // the client disconnected
+        if (bytes == 0) {
+            return (false);
+        }
+
+        int64_t readNs = clockNs(CLOCK_MONOTONIC);
+        Stats_page::add(Stats_page::READS);
+        Stats_page::add(Stats_page::BYTES, (uint64_t)bytes);
+        client.buffer.commit((size_t)bytes);
+        if (!this->handleLines(client, readNs)) {
+            return (false);
+        }
+        this->accountBuffered(client);
+    }
+    return (true);
+}
+
+bool Matt_daemon::receiveClient(Client &client, const char *data, size_t len, size_t *taken) {
+    // the kernel's buffer goes back to it right after: the bytes are copied behind the client's partial line
+    int64_t readNs = clockNs(CLOCK_MONOTONIC);
+    *taken = 0;
+    while (len > 0 && this->running()) {
+        size_t room;
+        char *tail = client.buffer.tail(&room);
+        size_t chunk = std::min(room, len);
+
+        memcpy(tail, data, chunk);
+        client.buffer.commit(chunk);
+        data += chunk;
+        len -= chunk;
+        *taken += chunk;
+        if (!this->handleLines(client, readNs)) {
+            return (false);
+        }
+        this->accountBuffered(client);
+    }
+    return (true);
+}
+
+bool Matt_daemon::handleLines(Client &client, int64_t readNs) {
+    // every complete line is handled in place, the partial one stays in the buffer
+    std::string_view line;
+    Line_buffer::Status status;
+    uint64_t lines = 0;
+
+    while (this->running() && (status = client.buffer.nextLine(&line, this->options.maxLineLength)) != Line_buffer::PARTIAL) {
+        // a line waits for the ones before it in the same read: that's part of its read to line latency
+        int64_t extractedNs = Latency_stats::sample() ? clockNs(CLOCK_MONOTONIC) : 0;
+        if (extractedNs != 0) {
+            Latency_stats::record(Latency_stats::READ_TO_LINE, extractedNs - readNs);
+        }
+
+        if (status == Line_buffer::OVERLONG && this->options.longLines == DISCONNECT) {
+            this->tintin_reporter.log<Tintin_reporter::INFO>(TINTIN_FMT("client disconnected: line longer than {} bytes"),
+                this->options.maxLineLength);
+            Stats_page::add(Stats_page::LINES, lines);
+            return (false);
+        }
+
+        this->handleMessage(client, line); // truncated if OVERLONG
+        if (extractedNs != 0) {
+            Latency_stats::record(Latency_stats::HANDLE, clockNs(CLOCK_MONOTONIC) - extractedNs);
+        }
+        lines += 1;
+    }
+    Stats_page::add(Stats_page::LINES, lines);
+    return (true);
+}
+
+void Matt_daemon::closeClient(Worker &worker, Slot_map<Client>::Handle handle) {
+    Client *client = worker.clients.get(handle);
+
+    // the pending recv holds its own reference to the socket: it's only released once the cancellation went through
+    if (client->receiving) {
+        worker.uring.cancel(Reactor::token(Reactor::CLIENT, handle));
+    }
+    close(client->fd); // also removes it from the epoll set
+    Stats_page::add(Stats_page::CLOSED);
+    if (client->idleTimer != 0) {
+        worker.timers.cancel(client->idleTimer);
+    }
+    this->admission.addBuffered(-(int64_t)client->buffered);
+    this->admission.release();
+    worker.bufferPool.release(std::move(client->buffer));
+    worker.clients.remove(handle);
+}
+
+void Matt_daemon::handleMessage(Client &client, std::string_view line) const {
+    // the commands are all short: a single length check keeps user input off the compares
+    if (line.size() <= sizeof("latency") - 1) {
+        if (line == "quit") {
+            Matt_daemon::quitRequested = 1;
+            return;
+        }
+
+        // liveness probe (--ping, load_bench measures its round trip): answered, not logged
+        if (this->options.answerPing && line == "ping") {
+            ssize_t ret = send(client.fd, "pong\n", 5, MSG_DONTWAIT | MSG_NOSIGNAL);
+            (void)ret;
+            return;
+        }
+
+        // latency percentiles since startup (--latency-command, not logged either)
+        if (this->options.answerLatency && line == "latency") {
+            this->replyLatency(client);
+            return;
+        }
+    }
+
+    this->tintin_reporter.log<Tintin_reporter::LOG>(TINTIN_FMT("User input: {}"), line);
+}
+
+void Matt_daemon::replyLatency(Client &client) const {
+    char reply[Latency_stats::STAGES * 256];
+    size_t len = 0;
+
+    // one line per stage
+    for (int stage = 0; stage < Latency_stats::STAGES; ++stage) {
+        Latency_histogram::Summary summary = Latency_stats::snapshot((Latency_stats::Stage)stage).summarize();
+        formatLatency(reply + len, sizeof(reply) - len - 1, (Latency_stats::Stage)stage, summary);
+        len += strlen(reply + len);
+        reply[len++] = '\n';
+    }
+    ssize_t ret = send(client.fd, reply, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    (void)ret;
 }
@@ -0,0 +1,166 @@
+#include "Mmap_log.hpp"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// (*) constructor & destructor
+
+Mmap_log::Mmap_log(): fd(-1), segmentSize(0), map(nullptr), mapOffset(0), tail(0) {}
+
+Mmap_log::~Mmap_log() {
+    this->detach();
+}
+
+// (*) private helpers
+
+off_t Mmap_log::findTail(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        throw std::runtime_error("failure to stat the log file");
+    }
+
+    // a run that didn't shut down cleanly leaves its preallocated zeros behind, the data ends at the last non zero byte
+    char chunk[65536];
+    off_t end = st.st_size;
+    while (end > 0) {
+        off_t start = (end > (off_t)sizeof(chunk)) ? end - (off_t)sizeof(chunk) : 0;
+        ssize_t got = pread(fd, chunk, end - start, start);
+        if (got < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error("failure to read the log file");
+        }
+        for (ssize_t i = got; i > 0; --i) {
+            if (chunk[i - 1] != '\0') {
+                return (start + i);
+            }
+        }
+        end = start;
+    }
+    return (0);
+}
+
+void Mmap_log::mapSegment(off_t from) {
+    if (this->map != nullptr) {
+        munmap(this->map, this->segmentSize);
+        this->map = nullptr;
+    }
+
+    off_t offset = from - (from % sysconf(_SC_PAGESIZE));
+    int ret = posix_fallocate(this->fd, offset, this->segmentSize);
+    if (ret == EOPNOTSUPP || ret == EINVAL) {
+        // no real preallocation on this filesystem: at least extend the file so the mapping is backed
+        struct stat st;
+        if (fstat(this->fd, &st) == 0 && st.st_size < offset + (off_t)this->segmentSize) {
+            ret = ftruncate(this->fd, offset + this->segmentSize) < 0 ? errno : 0;
+        } else {
+            ret = 0;
+        }
+    }
+    if (ret != 0) {
+        throw std::runtime_error("failure to preallocate a log segment");
+    }
+
+    void *mem = mmap(nullptr, this->segmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, offset);
+    if (mem == MAP_FAILED) {
+        throw std::runtime_error("failure to map a log segment");
+    }
+
+    this->map = static_cast<char *>(mem);
+    this->mapOffset = offset;
+}
+
+// (*) public interface
+
+void Mmap_log::attach(int fd, size_t segmentSize) {
+    size_t page = sysconf(_SC_PAGESIZE);
+
+    this->fd = fd;
+    this->segmentSize = ((segmentSize + page - 1) / page) * page;
+    this->tail = Mmap_log::findTail(fd);
+    this->mapSegment(this->tail);
+}
+
+void Mmap_log::append(const char *data, size_t len) {
+    if (len > this->segmentSize - sysconf(_SC_PAGESIZE)) {
+        exit(EXIT_FAILURE); // can't fit in any segment (segments are far larger than LOG_MAX_LEN)
+    }
+
+    while (true) {
+        {
+            std::shared_lock<std::shared_mutex> lock(this->remapLock);
+            off_t mapEnd = this->mapOffset + (off_t)this->segmentSize;
+            off_t pos = this->tail.load(std::memory_order_relaxed);
+
+            while (pos + (off_t)len <= mapEnd) {
+                if (this->tail.compare_exchange_weak(pos, pos + len, std::memory_order_relaxed)) {
+                    memcpy(this->map + (pos - this->mapOffset), data, len);
+                    return;
+                }
+            }
+        }
+
+        // the segment is full: move the window (its first page keeps the current tail, so there is never a hole)
+        std::unique_lock<std::shared_mutex> lock(this->remapLock);
+        off_t pos = this->tail.load(std::memory_order_relaxed);
+        if (pos + (off_t)len > this->mapOffset + (off_t)this->segmentSize) {
+            try {
+                this->mapSegment(pos);
+            } catch (const std::runtime_error &e) {
+                exit(EXIT_FAILURE); // same as a failed write()
+            }
+        }
+    }
+}
+
+void Mmap_log::append(const struct iovec *iov, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        this->append(static_cast<const char *>(iov[i].iov_base), iov[i].iov_len);
+    }
+}
+
+void Mmap_log::reopen(int newFd) {
+    std::unique_lock<std::shared_mutex> lock(this->remapLock);
+
+    // appenders are all out (exclusive lock): close the old file at its real length, then switch the fd under them
+    if (this->map != nullptr) {
+        munmap(this->map, this->segmentSize);
+        this->map = nullptr;
+    }
+    if (ftruncate(this->fd, this->tail.load()) < 0 || dup2(newFd, this->fd) < 0) {
+        throw std::runtime_error("failure to switch the log file");
+    }
+
+    this->tail = Mmap_log::findTail(this->fd);
+    this->mapSegment(this->tail);
+}
+
+void Mmap_log::detach(void) {
+    if (this->map == nullptr) {
+        return;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(this->remapLock);
+    munmap(this->map, this->segmentSize);
+    this->map = nullptr;
+
+    // drop the unused preallocation, the file ends exactly where the text does
+    if (ftruncate(this->fd, this->tail.load()) < 0) {
+        return;
+    }
+}
+
+bool Mmap_log::attached(void) const {
+    return (this->map != nullptr);
+}
+
+off_t Mmap_log::size(void) const {
+    return (this->tail.load(std::memory_order_relaxed));
+}
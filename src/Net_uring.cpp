@@ -0,0 +1,320 @@
+#include "Net_uring.hpp"
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <csignal>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// io_uring has no glibc wrappers
+
+static int uringSetup(unsigned entries, struct io_uring_params *params) {
+    return ((int)syscall(SYS_io_uring_setup, entries, params));
+}
+
+static int uringEnter(int ringFd, unsigned toSubmit, unsigned minComplete, unsigned flags, const void *arg, size_t argSize) {
+    return ((int)syscall(SYS_io_uring_enter, ringFd, toSubmit, minComplete, flags, arg, argSize));
+}
+
+static int uringRegister(int ringFd, unsigned opcode, const void *arg, unsigned count) {
+    return ((int)syscall(SYS_io_uring_register, ringFd, opcode, arg, count));
+}
+
+// (*) constructor & destructor
+
+Net_uring::Net_uring():
+    ringFd(-1),
+    toSubmit(0),
+    sqHead(nullptr),
+    sqTail(nullptr),
+    sqMask(nullptr),
+    sqArray(nullptr),
+    sqEntries(0),
+    sqes(nullptr),
+    cqHead(nullptr),
+    cqTail(nullptr),
+    cqMask(nullptr),
+    cqes(nullptr),
+    sqRing(MAP_FAILED),
+    sqRingSize(0),
+    cqRing(MAP_FAILED),
+    cqRingSize(0),
+    sqesSize(0),
+    bufRing(nullptr),
+    bufRingSize(0),
+    buffers(nullptr),
+    bufferSize(0),
+    bufferCount(0) {}
+
+Net_uring::~Net_uring() {
+    this->teardown();
+}
+
+void Net_uring::teardown(void) {
+    if (this->sqes != nullptr) {
+        munmap(this->sqes, this->sqesSize);
+    }
+    if (this->cqRing != MAP_FAILED && this->cqRing != this->sqRing) {
+        munmap(this->cqRing, this->cqRingSize);
+    }
+    if (this->sqRing != MAP_FAILED) {
+        munmap(this->sqRing, this->sqRingSize);
+    }
+    if (this->ringFd >= 0) {
+        close(this->ringFd); // also cancels the pending requests and unregisters the buffer ring
+    }
+    if (this->bufRing != nullptr) {
+        munmap(this->bufRing, this->bufRingSize);
+    }
+    if (this->buffers != nullptr) {
+        munmap(this->buffers, this->bufferSize * this->bufferCount);
+    }
+
+    this->ringFd = -1;
+    this->sqes = nullptr;
+    this->sqRing = MAP_FAILED;
+    this->cqRing = MAP_FAILED;
+    this->bufRing = nullptr;
+    this->buffers = nullptr;
+}
+
+// (*) setup
+
+bool Net_uring::setup(unsigned entries, size_t bufferSize, unsigned bufferCount) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    // a completion queue much larger than the submission queue: one recv request yields many completions.
+    // SINGLE_ISSUER (6.0, the same release as multishot recv) doubles as the kernel version check
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN
+        | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_R_DISABLED;
+    params.cq_entries = entries * 16;
+    this->ringFd = uringSetup(entries, &params);
+    if (this->ringFd < 0) {
+        return (false); // ENOSYS (no io_uring), EINVAL (kernel < 6.0), EPERM (kernel.io_uring_disabled), ...
+    }
+
+    // (*) the rings and the submission entries are shared with the kernel
+    this->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    this->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        this->sqRingSize = (this->cqRingSize > this->sqRingSize) ? this->cqRingSize : this->sqRingSize;
+    }
+
+    this->sqRing = mmap(nullptr, this->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->ringFd, IORING_OFF_SQ_RING);
+    if (this->sqRing != MAP_FAILED && (params.features & IORING_FEAT_SINGLE_MMAP)) {
+        this->cqRing = this->sqRing;
+    } else if (this->sqRing != MAP_FAILED) {
+        this->cqRing = mmap(nullptr, this->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->ringFd, IORING_OFF_CQ_RING);
+    }
+    this->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqes = mmap(nullptr, this->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->ringFd, IORING_OFF_SQES);
+    this->sqes = (sqes == MAP_FAILED) ? nullptr : static_cast<struct io_uring_sqe *>(sqes);
+
+    if (this->sqRing == MAP_FAILED || this->cqRing == MAP_FAILED || this->sqes == nullptr) {
+        int error = errno;
+        this->teardown();
+        errno = error;
+        return (false);
+    }
+
+    char *sq = static_cast<char *>(this->sqRing);
+    char *cq = static_cast<char *>(this->cqRing);
+    this->sqHead = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    this->sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    this->sqMask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    this->sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    this->sqEntries = params.sq_entries;
+    this->cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    this->cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    this->cqMask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    this->cqes = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+
+    // (*) provided buffer ring (5.19): page aligned ring of buffer descriptors, the buffers themselves
+    unsigned count = 1;
+    while (count < bufferCount && count < 32768) {
+        count <<= 1;
+    }
+    this->bufRingSize = count * sizeof(struct io_uring_buf);
+    void *bufRing = mmap(nullptr, this->bufRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    void *buffers = mmap(nullptr, bufferSize * count, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    this->bufRing = (bufRing == MAP_FAILED) ? nullptr : static_cast<struct io_uring_buf_ring *>(bufRing);
+    this->buffers = (buffers == MAP_FAILED) ? nullptr : static_cast<char *>(buffers);
+    this->bufferSize = bufferSize;
+    this->bufferCount = count;
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)this->bufRing;
+    reg.ring_entries = count;
+    reg.bgid = 0;
+
+    if (this->bufRing == nullptr || this->buffers == nullptr || uringRegister(this->ringFd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        int error = errno;
+        this->teardown();
+        errno = error;
+        return (false);
+    }
+
+    for (unsigned id = 0; id < count; ++id) {
+        this->recycle((uint16_t)id);
+    }
+    return (true);
+}
+
+bool Net_uring::enable(void) {
+    return (uringRegister(this->ringFd, IORING_REGISTER_ENABLE_RINGS, nullptr, 0) >= 0);
+}
+
+bool Net_uring::active(void) const {
+    return (this->ringFd >= 0);
+}
+
+// (*) submissions
+
+struct io_uring_sqe *Net_uring::nextSqe(void) {
+    unsigned tail = *this->sqTail;
+
+    // queue full: hand the queued entries to the kernel first
+    while (tail - __atomic_load_n(this->sqHead, __ATOMIC_ACQUIRE) >= this->sqEntries) {
+        int submitted = uringEnter(this->ringFd, this->toSubmit, 0, 0, nullptr, 0);
+        if (submitted < 0 && errno != EINTR) {
+            return (nullptr);
+        }
+        this->toSubmit -= (submitted > 0) ? (unsigned)submitted : 0;
+    }
+
+    unsigned slot = tail & *this->sqMask;
+    struct io_uring_sqe *sqe = &this->sqes[slot];
+    memset(sqe, 0, sizeof(*sqe));
+    this->sqArray[slot] = slot;
+    __atomic_store_n(this->sqTail, tail + 1, __ATOMIC_RELEASE);
+    this->toSubmit += 1;
+    return (sqe);
+}
+
+bool Net_uring::acceptMultishot(int listenFd, uint64_t tag) {
+    struct io_uring_sqe *sqe = this->nextSqe();
+    if (sqe == nullptr) {
+        return (false);
+    }
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listenFd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = tag;
+    return (true);
+}
+
+bool Net_uring::recvMultishot(int fd, uint64_t tag) {
+    struct io_uring_sqe *sqe = this->nextSqe();
+    if (sqe == nullptr) {
+        return (false);
+    }
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    sqe->user_data = tag;
+    return (true);
+}
+
+bool Net_uring::pollMultishot(int fd, uint64_t tag) {
+    struct io_uring_sqe *sqe = this->nextSqe();
+    if (sqe == nullptr) {
+        return (false);
+    }
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = tag;
+    return (true);
+}
+
+bool Net_uring::cancel(uint64_t tag) {
+    struct io_uring_sqe *sqe = this->nextSqe();
+    if (sqe == nullptr) {
+        return (false);
+    }
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = tag;
+    sqe->user_data = 0;
+    return (true);
+}
+
+// (*) completions
+
+int Net_uring::wait(long timeoutMs) {
+    unsigned flags = IORING_ENTER_GETEVENTS;
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    const void *argPtr = nullptr;
+    size_t argSize = 0;
+
+    if (timeoutMs >= 0) {
+        ts.tv_sec = timeoutMs / 1000;
+        ts.tv_nsec = (timeoutMs % 1000) * 1000000;
+        memset(&arg, 0, sizeof(arg));
+        arg.sigmask_sz = _NSIG / 8;
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+        flags |= IORING_ENTER_EXT_ARG;
+        argPtr = &arg;
+        argSize = sizeof(arg);
+    }
+
+    // completions already waiting: only submit
+    unsigned minComplete = (*this->cqHead != __atomic_load_n(this->cqTail, __ATOMIC_ACQUIRE)) ? 0 : 1;
+    int submitted = uringEnter(this->ringFd, this->toSubmit, minComplete, flags, argPtr, argSize);
+    if (submitted < 0) {
+        if (errno == ETIME || errno == EBUSY) {
+            return (0); // timed out / completions to reap first
+        }
+        return (-1);
+    }
+    this->toSubmit -= (unsigned)submitted;
+    return (0);
+}
+
+bool Net_uring::next(Completion *completion) {
+    unsigned head = *this->cqHead;
+
+    if (head == __atomic_load_n(this->cqTail, __ATOMIC_ACQUIRE)) {
+        return (false);
+    }
+
+    const struct io_uring_cqe &cqe = this->cqes[head & *this->cqMask];
+    completion->tag = cqe.user_data;
+    completion->res = cqe.res;
+    completion->flags = cqe.flags;
+    __atomic_store_n(this->cqHead, head + 1, __ATOMIC_RELEASE);
+    return (true);
+}
+
+const char *Net_uring::buffer(uint16_t id) const {
+    return (this->buffers + (size_t)id * this->bufferSize);
+}
+
+void Net_uring::recycle(uint16_t id) {
+    // the ring's tail overlays the first descriptor's reserved field.
+    // descriptors are indexed from the ring's address: in C++ the header's flexible array sits 8 bytes too far
+    // (its empty struct {} placeholder takes a byte, unlike in C)
+    unsigned short tail = this->bufRing->tail;
+    struct io_uring_buf *bufs = reinterpret_cast<struct io_uring_buf *>(this->bufRing);
+    struct io_uring_buf &buf = bufs[tail & (this->bufferCount - 1)];
+
+    buf.addr = (uint64_t)(uintptr_t)(this->buffers + (size_t)id * this->bufferSize);
+    buf.len = (uint32_t)this->bufferSize;
+    buf.bid = id;
+    __atomic_store_n(&this->bufRing->tail, (unsigned short)(tail + 1), __ATOMIC_RELEASE);
+}
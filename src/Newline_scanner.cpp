@@ -0,0 +1,154 @@
+#include "Newline_scanner.hpp"
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+# include <immintrin.h>
+#endif
+
+// (*) public interface
+
+size_t Newline_scanner::scan(const char *data, size_t len, uint32_t *offsets, size_t maxOffsets, size_t *scanned) {
+    static const ScanFn best = Newline_scanner::resolve(); // thread-safe, once
+
+    return (best(data, len, offsets, maxOffsets, scanned));
+}
+
+const char *Newline_scanner::implementation(void) {
+    ScanFn best = Newline_scanner::resolve();
+
+#if defined(__x86_64__) || defined(__i386__)
+    if (best == Newline_scanner::scanAvx2) {
+        return ("avx2");
+    }
+    if (best == Newline_scanner::scanSse2) {
+        return ("sse2");
+    }
+#endif
+    (void)best;
+    return ("scalar");
+}
+
+Newline_scanner::ScanFn Newline_scanner::resolve(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return (Newline_scanner::scanAvx2);
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return (Newline_scanner::scanSse2);
+    }
+#endif
+    return (Newline_scanner::scanScalar);
+}
+
+// (*) implementations
+
+size_t Newline_scanner::scanScalar(const char *data, size_t len, uint32_t *offsets, size_t maxOffsets, size_t *scanned) {
+    size_t count = 0;
+    size_t pos = 0;
+
+    // memchr is the libc's own vectorized search (one call per line)
+    while (count < maxOffsets && pos < len) {
+        const char *newline = static_cast<const char *>(memchr(data + pos, '\n', len - pos));
+        if (newline == nullptr) {
+            pos = len;
+            break;
+        }
+        offsets[count++] = (uint32_t)(newline - data);
+        pos = (size_t)(newline - data) + 1;
+    }
+
+    *scanned = (count == maxOffsets) ? pos : len;
+    return (count);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+// every set bit of mask is a newline at base + bit; false once the offsets array is full (*scanned set)
+static inline bool collect(uint32_t mask, size_t base, uint32_t *offsets, size_t maxOffsets, size_t *count, size_t *scanned) {
+    while (mask != 0) {
+        size_t offset = base + (size_t)__builtin_ctz(mask);
+        offsets[(*count)++] = (uint32_t)offset;
+        mask &= mask - 1;
+        if (*count == maxOffsets) {
+            *scanned = offset + 1;
+            return (false);
+        }
+    }
+    return (true);
+}
+
+__attribute__((target("sse2")))
+size_t Newline_scanner::scanSse2(const char *data, size_t len, uint32_t *offsets, size_t maxOffsets, size_t *scanned) {
+    const __m128i newline = _mm_set1_epi8('\n');
+    size_t count = 0;
+    size_t i = 0;
+
+    *scanned = len;
+    if (maxOffsets == 0) {
+        *scanned = 0;
+        return (0);
+    }
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(block, newline));
+        if (!collect(mask, i, offsets, maxOffsets, &count, scanned)) {
+            return (count);
+        }
+    }
+
+    // the last < 16 bytes
+    uint32_t mask = 0;
+    for (size_t j = i; j < len; ++j) {
+        mask |= (uint32_t)(data[j] == '\n') << (j - i);
+    }
+    collect(mask, i, offsets, maxOffsets, &count, scanned);
+    return (count);
+}
+
+__attribute__((target("avx2")))
+size_t Newline_scanner::scanAvx2(const char *data, size_t len, uint32_t *offsets, size_t maxOffsets, size_t *scanned) {
+    const __m256i newline = _mm256_set1_epi8('\n');
+    size_t count = 0;
+    size_t i = 0;
+
+    *scanned = len;
+    if (maxOffsets == 0) {
+        *scanned = 0;
+        return (0);
+    }
+
+    // 64 bytes per iteration: blocks without any newline (long lines) cost one test
+    for (; i + 64 <= len; i += 64) {
+        __m256i low = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+        __m256i high = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i + 32));
+        uint32_t lowMask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(low, newline));
+        uint32_t highMask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(high, newline));
+        if ((lowMask | highMask) == 0) {
+            continue;
+        }
+        if (!collect(lowMask, i, offsets, maxOffsets, &count, scanned)
+            || !collect(highMask, i + 32, offsets, maxOffsets, &count, scanned)) {
+            return (count);
+        }
+    }
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, newline));
+        if (!collect(mask, i, offsets, maxOffsets, &count, scanned)) {
+            return (count);
+        }
+    }
+
+    // the last < 32 bytes
+    uint32_t mask = 0;
+    for (size_t j = i; j < len; ++j) {
+        mask |= (uint32_t)(data[j] == '\n') << (j - i);
+    }
+    collect(mask, i, offsets, maxOffsets, &count, scanned);
+    return (count);
+}
+
+#endif
@@ -0,0 +1,236 @@
+#include "Stall_watchdog.hpp"
+#include "Tintin_reporter.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <cxxabi.h>
+#include <execinfo.h>
+#include <string>
+#include <system_error>
+#include <unistd.h>
+
+Stall_watchdog::Beat *Stall_watchdog::beats[MAX_BEATS];
+std::atomic<size_t> Stall_watchdog::beatCount(0);
+std::mutex Stall_watchdog::mutex;
+std::condition_variable Stall_watchdog::wakeup;
+std::thread Stall_watchdog::watchdog;
+bool Stall_watchdog::stopping = false;
+void *Stall_watchdog::frames[MAX_FRAMES];
+std::atomic<int> Stall_watchdog::frameCount(-1);
+std::atomic<uint64_t> Stall_watchdog::request(0);
+uint64_t Stall_watchdog::requests = 0;
+
+// the loops read the coarse clock after their waits: same clock, same resolution (a tick is a few ms)
+static int64_t coarseMs(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    return ((int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000);
+}
+
+// "./Matt_daemon(_ZN11Matt_daemon9eventLoopERNS_6WorkerE+0x1f) [0x...]": the mangled name between '(' and '+'
+static std::string demangle(const char *symbol) {
+    std::string text(symbol);
+    size_t open = text.find('(');
+    size_t plus = (open != std::string::npos) ? text.find('+', open) : std::string::npos;
+
+    if (plus == std::string::npos || plus == open + 1) {
+        return (text);
+    }
+    int status = -1;
+    char *name = abi::__cxa_demangle(text.substr(open + 1, plus - open - 1).c_str(), nullptr, nullptr, &status);
+    if (status == 0 && name != nullptr) {
+        text.replace(open + 1, plus - open - 1, name);
+    }
+    free(name);
+    return (text);
+}
+
+// (*) public interface
+
+bool Stall_watchdog::start(const Tintin_reporter &reporter, long thresholdMs, bool backtraces) {
+    if (backtraces) {
+        // backtrace() loads libgcc on its first call (not async signal safe): done here, the handler only walks the stack.
+        // SA_RESTART: the interrupted syscall (a write, a waitpid) goes on. SA_SIGINFO: the request number comes with the signal
+        void *warmup[1];
+        backtrace(warmup, 1);
+
+        struct sigaction sa{};
+        sa.sa_sigaction = Stall_watchdog::backtraceHandler;
+        sigemptyset(&sa.sa_mask);
+        sa.sa_flags = SA_RESTART | SA_SIGINFO;
+        sigaction(SIGRTMIN, &sa, nullptr);
+    }
+
+    // created with every signal blocked: they're the event loops' to handle (a signal delivered to the watchdog
+    // wouldn't interrupt their waits)
+    sigset_t all;
+    sigset_t previous;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &previous);
+
+    bool started = true;
+    Stall_watchdog::stopping = false;
+    try {
+        Stall_watchdog::watchdog = std::thread(&Stall_watchdog::run, &reporter, thresholdMs, backtraces);
+    } catch (const std::system_error &e) {
+        started = false;
+    }
+    pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+    return (started);
+}
+
+void Stall_watchdog::stop(void) {
+    {
+        std::lock_guard<std::mutex> lock(Stall_watchdog::mutex);
+        Stall_watchdog::stopping = true;
+    }
+    Stall_watchdog::wakeup.notify_one();
+    if (Stall_watchdog::watchdog.joinable()) {
+        Stall_watchdog::watchdog.join();
+    }
+}
+
+void Stall_watchdog::watch(const char *name) {
+    if (Stall_watchdog::current != nullptr) {
+        return;
+    }
+
+    // never freed: the watchdog may still be reading a beat whose thread left
+    std::lock_guard<std::mutex> lock(Stall_watchdog::mutex);
+    size_t count = Stall_watchdog::beatCount.load(std::memory_order_relaxed);
+    if (count >= MAX_BEATS) {
+        return;
+    }
+    Beat *beat = new Beat();
+    beat->thread = pthread_self();
+    snprintf(beat->name, sizeof(beat->name), "%s", name);
+    Stall_watchdog::beats[count] = beat;
+    Stall_watchdog::beatCount.store(count + 1, std::memory_order_release);
+    Stall_watchdog::current = beat;
+}
+
+void Stall_watchdog::leave(void) {
+    Beat *beat = Stall_watchdog::current;
+    if (beat == nullptr) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(Stall_watchdog::mutex);
+    beat->left = true;
+    beat->sinceMs.store(0, std::memory_order_relaxed);
+    Stall_watchdog::current = nullptr;
+}
+
+// (*) private helpers
+
+void Stall_watchdog::run(const Tintin_reporter *reporter, long thresholdMs, bool backtraces) {
+    const std::chrono::milliseconds period(std::max(thresholdMs / 4, 10L));
+    int64_t reported[MAX_BEATS] = { 0 }; // start of the iteration reported last, per beat (0: none in progress)
+    std::unique_lock<std::mutex> lock(Stall_watchdog::mutex);
+
+    while (!Stall_watchdog::stopping) {
+        Stall_watchdog::wakeup.wait_for(lock, period);
+        if (Stall_watchdog::stopping) {
+            break;
+        }
+        lock.unlock(); // the loops may register or leave meanwhile, logging may take a while
+
+        int64_t nowMs = coarseMs();
+        size_t count = Stall_watchdog::beatCount.load(std::memory_order_acquire);
+        for (size_t i = 0; i < count; ++i) {
+            Beat &beat = *Stall_watchdog::beats[i];
+            int64_t sinceMs = beat.sinceMs.load(std::memory_order_relaxed);
+
+            // the reported iteration is over (somewhere in the last period)
+            if (reported[i] != 0 && sinceMs != reported[i]) {
+                reporter->log<Tintin_reporter::ERROR>(TINTIN_FMT("stall: {} back after ~{} ms"), (const char *)beat.name, nowMs - reported[i]);
+                reported[i] = 0;
+            }
+            if (sinceMs != 0 && sinceMs != reported[i] && nowMs - sinceMs >= thresholdMs) {
+                Stall_watchdog::report(*reporter, beat, sinceMs, nowMs, backtraces);
+                reported[i] = sinceMs;
+            }
+        }
+        lock.lock();
+    }
+}
+
+void Stall_watchdog::report(const Tintin_reporter &reporter, Beat &beat, int64_t sinceMs, int64_t nowMs, bool backtraces) {
+    const char *phase = beat.phase.load(std::memory_order_relaxed);
+    int fd = beat.fd.load(std::memory_order_relaxed);
+
+    if (fd >= 0) {
+        reporter.log<Tintin_reporter::ERROR>(TINTIN_FMT("stall: {} busy for {} ms, phase {} (client fd {})"), (const char *)beat.name,
+            nowMs - sinceMs, phase, fd);
+    } else {
+        reporter.log<Tintin_reporter::ERROR>(TINTIN_FMT("stall: {} busy for {} ms, phase {}"), (const char *)beat.name, nowMs - sinceMs, phase);
+    }
+    if (backtraces) {
+        Stall_watchdog::logBacktrace(reporter, beat);
+    }
+}
+
+void Stall_watchdog::logBacktrace(const Tintin_reporter &reporter, Beat &beat) {
+    // numbered: the handler only fills frames[] for the request still open, one that runs after we gave up leaves it alone
+    uint64_t number = ++Stall_watchdog::requests;
+    {
+        // a thread that left may not exist any more: signaling it is undefined
+        std::lock_guard<std::mutex> lock(Stall_watchdog::mutex);
+        if (beat.left) {
+            return;
+        }
+        Stall_watchdog::frameCount.store(-1, std::memory_order_relaxed);
+        Stall_watchdog::request.store(number * 2, std::memory_order_release);
+        union sigval value;
+        value.sival_ptr = (void *)(uintptr_t)number;
+        if (pthread_sigqueue(beat.thread, SIGRTMIN, value) != 0) {
+            Stall_watchdog::request.store(0, std::memory_order_relaxed);
+            return;
+        }
+    }
+
+    int count = -1;
+    for (long waited = 0; waited < BACKTRACE_WAIT_MS && count < 0; ++waited) {
+        usleep(1000);
+        count = Stall_watchdog::frameCount.load(std::memory_order_acquire);
+    }
+    // closing the request: if the handler claimed it meanwhile, it's walking the stack, its frames are waited for
+    uint64_t open = number * 2;
+    if (count < 0 && !Stall_watchdog::request.compare_exchange_strong(open, 0, std::memory_order_acq_rel)) {
+        while ((count = Stall_watchdog::frameCount.load(std::memory_order_acquire)) < 0) {
+            usleep(1000);
+        }
+    }
+    if (count < 0) {
+        reporter.log<Tintin_reporter::ERROR>(TINTIN_FMT("stall: {} didn't answer the backtrace request"), (const char *)beat.name);
+        return;
+    }
+
+    // the first two frames are the handler and the kernel's signal trampoline
+    char **symbols = backtrace_symbols(Stall_watchdog::frames, count);
+    if (symbols == nullptr) {
+        return;
+    }
+    for (int i = 2; i < count; ++i) {
+        reporter.log<Tintin_reporter::ERROR>(TINTIN_FMT("stall: {} #{} {}"), (const char *)beat.name, i - 2, demangle(symbols[i]));
+    }
+    free(symbols);
+}
+
+void Stall_watchdog::backtraceHandler(int sig, siginfo_t *info, void *context) {
+    (void)sig;
+    (void)context;
+    int savedErrno = errno;
+
+    // a request the watchdog gave up on (or a signal someone else sent) isn't answered
+    uint64_t open = (uint64_t)(uintptr_t)info->si_value.sival_ptr * 2;
+    if (info->si_code == SI_QUEUE && open != 0
+        && Stall_watchdog::request.compare_exchange_strong(open, open + 1, std::memory_order_acquire)) {
+        Stall_watchdog::frameCount.store(backtrace(Stall_watchdog::frames, MAX_FRAMES), std::memory_order_release);
+        Stall_watchdog::request.store(0, std::memory_order_relaxed);
+    }
+    errno = savedErrno;
+}
@@ -0,0 +1,131 @@
+#include "Stats_page.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <new>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+Stats_page::Header *Stats_page::header = nullptr;
+Stats_page::Slot *Stats_page::slots = nullptr;
+std::string Stats_page::path;
+dev_t Stats_page::device = 0;
+ino_t Stats_page::inode = 0;
+std::mutex Stats_page::attachMutex;
+std::atomic<Stats_page::Slot *> Stats_page::shared(nullptr);
+
+// (*) public interface
+
+size_t Stats_page::pageSize(size_t slots) {
+    return (sizeof(Header) + slots * sizeof(Slot));
+}
+
+bool Stats_page::open(const std::string &path, size_t threads) {
+    // built aside and renamed into place: a reader never maps a half initialized page, and a hot restart successor
+    // replaces its predecessor's page without a moment where there is none
+    size_t count = threads + 1; // + the shared slot
+    size_t size = Stats_page::pageSize(count);
+    std::string building = path + "." + std::to_string(getpid());
+
+    int fd = ::open(building.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return (false);
+    }
+
+    struct stat st;
+    void *page = MAP_FAILED;
+    if (fchmod(fd, 0644) < 0 || ftruncate(fd, (off_t)size) < 0 || fstat(fd, &st) < 0
+        || (page = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        int error = errno;
+        ::close(fd);
+        unlink(building.c_str());
+        errno = error;
+        return (false);
+    }
+    ::close(fd); // the mapping keeps the file
+
+    Header *header = new (page) Header();
+    Slot *slots = reinterpret_cast<Slot *>(static_cast<char *>(page) + sizeof(Header));
+    for (size_t i = 0; i < count; ++i) {
+        new (&slots[i]) Slot();
+    }
+    header->magic = MAGIC;
+    header->version = VERSION;
+    header->slotSize = (uint32_t)sizeof(Slot);
+    header->slotCount = (uint32_t)count;
+    header->counterCount = COUNTERS;
+    header->pid = getpid();
+    header->startedAt = time(NULL);
+    header->sequence.store(0, std::memory_order_relaxed);
+    uint64_t other[NAME_WORDS] = { 0 };
+    memcpy(other, "other", 5);
+    for (size_t i = 0; i < NAME_WORDS; ++i) {
+        slots[0].name[i].store(other[i], std::memory_order_relaxed);
+    }
+    header->slotsUsed.store(1, std::memory_order_relaxed);
+
+    if (rename(building.c_str(), path.c_str()) < 0) {
+        int error = errno;
+        munmap(page, size);
+        unlink(building.c_str());
+        errno = error;
+        return (false);
+    }
+
+    Stats_page::path = path;
+    Stats_page::device = st.st_dev;
+    Stats_page::inode = st.st_ino;
+    Stats_page::slots = slots;
+    Stats_page::header = header;
+    Stats_page::shared.store(&slots[0], std::memory_order_release);
+    return (true);
+}
+
+void Stats_page::attach(const char *name) {
+    std::lock_guard<std::mutex> lock(Stats_page::attachMutex);
+    Header *header = Stats_page::header;
+
+    if (header == nullptr || Stats_page::current != nullptr) {
+        return;
+    }
+    uint32_t used = header->slotsUsed.load(std::memory_order_relaxed);
+    if (used >= header->slotCount) {
+        return; // more threads than planned: they share slot 0
+    }
+
+    uint64_t words[NAME_WORDS] = { 0 };
+    memcpy(words, name, std::min(strlen(name), sizeof(words))); // a 16 byte name isn't null terminated
+
+    // the only writer of the header is this mutex' owner: no compare-exchange needed to enter the write section
+    uint32_t sequence = header->sequence.load(std::memory_order_relaxed);
+    header->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < NAME_WORDS; ++i) {
+        Stats_page::slots[used].name[i].store(words[i], std::memory_order_relaxed);
+    }
+    header->slotsUsed.store(used + 1, std::memory_order_relaxed);
+    header->sequence.store(sequence + 2, std::memory_order_release);
+
+    Stats_page::current = &Stats_page::slots[used];
+}
+
+void Stats_page::close(void) {
+    struct stat st;
+
+    if (Stats_page::header != nullptr && stat(Stats_page::path.c_str(), &st) == 0
+        && st.st_dev == Stats_page::device && st.st_ino == Stats_page::inode) {
+        unlink(Stats_page::path.c_str());
+    }
+}
+
+const char *Stats_page::counterName(Counter counter) {
+    static const char *names[COUNTERS] = {
+        "accepted", "refused", "closed", "reads", "bytes", "lines",
+        "log_records", "log_dropped", "log_written", "log_batched", "log_queue_us"
+    };
+
+    return (counter < COUNTERS ? names[counter] : "?");
+}
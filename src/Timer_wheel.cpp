@@ -0,0 +1,240 @@
+#include "Timer_wheel.hpp"
+#include <algorithm>
+
+static uint64_t rotateRight(uint64_t bits, unsigned count) {
+    count &= 63;
+    return (count == 0 ? bits : (bits >> count) | (bits << (64 - count)));
+}
+
+// (*) constructor
+
+Timer_wheel::Timer_wheel(long tickMs, int64_t originMs):
+    tickMs(tickMs),
+    originMs(originMs),
+    current(0),
+    freeHead(NIL),
+    armedCount(0) {
+    std::fill(this->heads, this->heads + DUE + 1, NIL);
+    std::fill(this->occupied, this->occupied + LEVELS, 0);
+}
+
+// (*) private interface
+
+Timer_wheel::Node *Timer_wheel::find(Id id) {
+    uint32_t index = (uint32_t)id;
+
+    if (index >= this->nodes.size() || this->nodes[index].generation != (uint32_t)(id >> 32)
+        || !(this->nodes[index].generation & 1)) {
+        return (nullptr);
+    }
+    return (&this->nodes[index]);
+}
+
+uint64_t Timer_wheel::tickAt(int64_t nowMs, bool roundUp) const {
+    int64_t elapsed = nowMs - this->originMs;
+
+    if (elapsed <= 0) {
+        return (0);
+    }
+    return ((uint64_t)((roundUp ? elapsed + this->tickMs - 1 : elapsed) / this->tickMs));
+}
+
+void Timer_wheel::place(uint32_t index) {
+    // the level is picked by the distance, the slot by the expiry's own bits at that level: a slot of level L is
+    // cascaded exactly when current reaches its range (a timer further than 64^4 ticks waits in the last level)
+    uint64_t expiry = std::min(this->nodes[index].expiry, this->current + MAX_DELTA);
+    uint64_t delta = expiry - this->current;
+    unsigned level = 0;
+
+    while (level + 1 < LEVELS && delta >= ((uint64_t)1 << (LEVEL_BITS * (level + 1)))) {
+        ++level;
+    }
+    this->link(index, (uint16_t)(level * SLOTS + ((expiry >> (LEVEL_BITS * level)) & (SLOTS - 1))));
+}
+
+void Timer_wheel::link(uint32_t index, uint16_t list) {
+    Node &node = this->nodes[index];
+
+    node.prev = NIL;
+    node.next = this->heads[list];
+    node.list = list;
+    if (node.next != NIL) {
+        this->nodes[node.next].prev = index;
+    }
+    this->heads[list] = index;
+    if (list < DUE) {
+        this->occupied[list / SLOTS] |= (uint64_t)1 << (list % SLOTS);
+    }
+}
+
+void Timer_wheel::unlink(uint32_t index) {
+    Node &node = this->nodes[index];
+
+    if (node.prev != NIL) {
+        this->nodes[node.prev].next = node.next;
+    } else {
+        this->heads[node.list] = node.next;
+    }
+    if (node.next != NIL) {
+        this->nodes[node.next].prev = node.prev;
+    }
+    if (node.list < DUE && this->heads[node.list] == NIL) {
+        this->occupied[node.list / SLOTS] &= ~((uint64_t)1 << (node.list % SLOTS));
+    }
+    node.list = UNARMED;
+}
+
+void Timer_wheel::cascade(unsigned level) {
+    uint16_t list = (uint16_t)(level * SLOTS + ((this->current >> (LEVEL_BITS * level)) & (SLOTS - 1)));
+    uint32_t index = this->heads[list];
+
+    this->heads[list] = NIL;
+    this->occupied[level] &= ~((uint64_t)1 << (list % SLOTS));
+    while (index != NIL) {
+        uint32_t next = this->nodes[index].next;
+        this->place(index); // a lower level: the distance is now under 64^level ticks
+        index = next;
+    }
+}
+
+void Timer_wheel::processTick(void) {
+    // the higher levels only move when the one below wraps around
+    for (unsigned level = 1; level < LEVELS; ++level) {
+        if (this->current & (((uint64_t)1 << (LEVEL_BITS * level)) - 1)) {
+            break;
+        }
+        this->cascade(level);
+    }
+
+    uint16_t slot = (uint16_t)(this->current & (SLOTS - 1));
+    uint32_t index = this->heads[slot];
+    this->heads[slot] = NIL;
+    this->occupied[0] &= ~((uint64_t)1 << slot);
+    while (index != NIL) {
+        uint32_t next = this->nodes[index].next;
+        this->link(index, DUE);
+        index = next;
+    }
+    this->current += 1;
+}
+
+// (*) public interface
+
+Timer_wheel::Id Timer_wheel::arm(int64_t nowMs, long delayMs, uint64_t data, long periodMs) {
+    uint32_t index = this->freeHead;
+
+    if (index != NIL) {
+        this->freeHead = this->nodes[index].next;
+    } else {
+        if (this->nodes.size() >= NIL) {
+            return (0);
+        }
+        index = (uint32_t)this->nodes.size();
+        this->nodes.push_back(Node());
+        this->nodes[index].generation = 0;
+    }
+
+    Node &node = this->nodes[index];
+    node.expiry = std::max(this->tickAt(nowMs + delayMs, true), this->current);
+    node.periodTicks = (periodMs > 0) ? std::max((uint64_t)1, this->tickAt(this->originMs + periodMs, true)) : 0;
+    node.data = data;
+    node.generation += 1; // odd: armed
+    this->place(index);
+    this->armedCount += 1;
+    return (((uint64_t)node.generation << 32) | index);
+}
+
+bool Timer_wheel::rearm(Id id, int64_t nowMs, long delayMs) {
+    Node *node = this->find(id);
+
+    if (node == nullptr) {
+        return (false);
+    }
+    this->unlink((uint32_t)id);
+    node->expiry = std::max(this->tickAt(nowMs + delayMs, true), this->current);
+    this->place((uint32_t)id);
+    return (true);
+}
+
+bool Timer_wheel::cancel(Id id) {
+    Node *node = this->find(id);
+
+    if (node == nullptr) {
+        return (false);
+    }
+    this->unlink((uint32_t)id);
+    node->generation += 1; // even: free
+    node->next = this->freeHead;
+    this->freeHead = (uint32_t)id;
+    this->armedCount -= 1;
+    return (true);
+}
+
+bool Timer_wheel::expireNext(int64_t nowMs, Expired *expired) {
+    uint64_t target = this->tickAt(nowMs, false);
+
+    while (true) {
+        uint32_t index = this->heads[DUE];
+        if (index != NIL) {
+            Node &node = this->nodes[index];
+
+            expired->id = ((uint64_t)node.generation << 32) | index;
+            expired->data = node.data;
+            if (node.periodTicks != 0) {
+                // a late loop doesn't get a burst of catch-up expiries: the next one is after nowMs
+                this->unlink(index);
+                node.expiry = std::max(node.expiry + node.periodTicks, target + 1);
+                this->place(index);
+            } else {
+                this->cancel(expired->id);
+            }
+            return (true);
+        }
+
+        if (this->current > target) {
+            return (false);
+        }
+        if (this->armedCount == 0) {
+            this->current = target + 1;
+            return (false);
+        }
+        if (this->occupied[0] == 0 && (this->current & (SLOTS - 1)) != 0) {
+            // nothing at level 0: straight to the next cascade
+            this->current = std::min(target + 1, (this->current | (SLOTS - 1)) + 1);
+            continue;
+        }
+        this->processTick();
+    }
+}
+
+long Timer_wheel::nextTimeout(int64_t nowMs) const {
+    if (this->armedCount == 0) {
+        return (-1);
+    }
+    if (this->heads[DUE] != NIL) {
+        return (0);
+    }
+
+    // per level, the first non-empty slot from current's on: its expiry (level 0) or its cascade (the tick where the
+    // level below wraps into it). a bound, not the exact expiry: the loop may wake up only to cascade
+    uint64_t next = UINT64_MAX;
+    for (unsigned level = 0; level < LEVELS; ++level) {
+        if (this->occupied[level] == 0) {
+            continue;
+        }
+
+        unsigned shift = LEVEL_BITS * level;
+        uint64_t base = this->current >> shift;
+        bool aligned = (this->current & (((uint64_t)1 << shift) - 1)) == 0; // current's own slot at that level is still ahead
+        unsigned first = aligned ? 0 : 1;
+        uint64_t bits = rotateRight(this->occupied[level], (unsigned)(base & (SLOTS - 1)) + first);
+        next = std::min(next, (base + first + (uint64_t)__builtin_ctzll(bits)) << shift);
+    }
+
+    int64_t timeout = this->originMs + (int64_t)next * this->tickMs - nowMs;
+    return (timeout > 0 ? (long)timeout : 0);
+}
+
+size_t Timer_wheel::armed(void) const {
+    return (this->armedCount);
+}
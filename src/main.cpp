@@ -1,22 +1,417 @@
 #include "Tintin_reporter.hpp"
 #include "Matt_daemon.hpp"
+#include "Handoff.hpp"
+#include <algorithm>
+#include <climits>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <fcntl.h>
+#include <getopt.h>
+#include <string>
 #include <sys/file.h>
 #include <unistd.h>
 
-int main() {
+static void usage(const char *name) {
+    printf("usage: %s [options]\n", name);
+    printf("  --max-clients=N           connections served at once (default 3)\n");
+    printf("  --workers=N               event loop threads, each with its own SO_REUSEPORT listener (default 1)\n");
+    printf("  --max-line=BYTES          longest client line (default 4096)\n");
+    printf("  --long-lines=POLICY       truncate (default): handle the first --max-line bytes, disconnect: close the client\n");
+    printf("  --read-size=BYTES         bytes a client read may return (default 16384)\n");
+    printf("  --engine=ENGINE           epoll (default) or uring: multishot accept/recv with provided buffers (falls back to epoll)\n");
+    printf("  --backlog=N               pending connections per listening socket (default SOMAXCONN)\n");
+    printf("  --retry-after=MS          delay suggested to the refused clients in their \"busy\" reply (default 1000)\n");
+    printf("  --memory-budget=BYTES     partial lines buffered by all the clients: over it, newcomers are refused and the\n"
+           "                            biggest holders disconnected (default none)\n");
+    printf("  --cpu-budget=PERCENT      busy share of a worker's time: over it, newcomers are refused and its newest client\n"
+           "                            is disconnected (default none)\n");
+    printf("  --ipv6                    listen on [::]:4242, dual stack (IPv4 clients still connect)\n");
+    printf("  --unix=PATH               also listen on an AF_UNIX stream socket (@NAME: abstract namespace)\n");
+    printf("  --idle-timeout=SEC        disconnect the clients that sent nothing for SEC seconds (default never)\n");
+    printf("  --ping                    answer the \"ping\" lines with \"pong\" instead of logging them (for the benchmarks)\n");
+    printf("  --wait-ready              return only once the daemon is listening (exit status 1 if it failed to)\n");
+    printf("  --latency-report=SEC      log the read, handling and logging latency percentiles every SEC seconds (default 60,\n"
+           "                            0: never)\n");
+    printf("  --latency-sample=N        time one line and log record in N for the latency histograms (default 16, 1: all)\n");
+    printf("  --latency-command         answer the \"latency\" lines with the percentiles since startup instead of logging them\n");
+    printf("  --stall-threshold=MS      log the event loop iterations and log writes that run longer, with their phase and\n"
+           "                            client fd (default 250, 0: no watchdog)\n");
+    printf("  --stall-backtrace         and the backtrace of the stalled thread\n");
+    printf("  --stats=PATH              counters mapped for matt_stat (default /run/matt_daemon.stats, none: no page)\n");
+    printf("  --async                   format and write log records from a background thread\n");
+    printf("  --ring-size=N             number of preallocated records in the async log ring (default 512, at most 65536)\n");
+    printf("  --ring-file=PATH          async mode: shared file holding the ring, replayed after a crash (default /dev/shm/matt_daemon.ring, none: anonymous)\n");
+    printf("  --overflow=POLICY         when the async log ring is full: block (default), drop, drop-oldest\n");
+    printf("  --batch-size=N            async mode: records per writev() at most (default 64)\n");
+    printf("  --batch-latency=MS        async mode: how long a partial batch waits for more records (default 5)\n");
+    printf("  --durability=MODE         none (default), interval (fdatasync every --sync-interval) or batch (fdatasync per batch)\n");
+    printf("  --sync-interval=MS        fdatasync period of the interval durability mode (default 1000)\n");
+    printf("  --timestamp-precision=P   s (default), ms or us: adds a sub-second field to the log timestamps\n");
+    printf("  --sink=SINK               write (default): write()/writev() calls, mmap: memcpy into preallocated mapped segments,\n"
+           "                            uring: async batches submitted through io_uring (needs --async, falls back to write)\n");
+    printf("  --segment-size=BYTES      mmap sink: bytes preallocated and mapped at once (default 4194304)\n");
+    printf("  --rotate-size=BYTES       rotate the log file when it would grow past BYTES\n");
+    printf("  --rotate-interval=SEC     rotate the log file every SEC seconds (SIGHUP also rotates)\n");
+    printf("  --no-compress             keep rotated log files uncompressed\n");
+    printf("  --log-format=FORMAT       text (default) or binary (render it with tintin_decode)\n");
+    printf("  --log-level=TYPE          log (default), info or error: records of lower types are suppressed\n");
+    printf("  --rate-limit=TYPE:N[/B]   at most N records of TYPE per second, bursts of B (default N)\n");
+    printf("  --sample=TYPE:N           keep one record of TYPE in N\n");
+    printf("  --coalesce=MS             fold identical consecutive records into \"last message repeated N times\" (flushed after MS)\n");
+    printf("  --suppress-report=SEC     how often suppressed records are counted in the log (default 10, 0: never)\n");
+    printf("signals:\n");
+    printf("  SIGHUP                    rotate the log file (reopen it when rotation is off)\n");
+    printf("  SIGUSR2                   hot restart: the binary at the same path takes over the clients and the lock\n");
+    exit(EXIT_FAILURE);
+}
+
+static size_t parseSize(const char *name, const char *arg) {
+    char *end = nullptr;
+    unsigned long long value = strtoull(arg, &end, 10);
+
+    if (*arg == '\0' || *end != '\0' || value == 0) {
+        printf("invalid value for %s: '%s'\n", name, arg);
+        exit(EXIT_FAILURE);
+    }
+    return ((size_t)value);
+}
+
+// "log", "info" or "error" (up to end), -1 otherwise
+static int parseLogType(const char *arg, const char *end) {
+    static const char *names[] = { "log", "info", "error" };
+
+    for (int type = Tintin_reporter::LOG; type <= Tintin_reporter::ERROR; ++type) {
+        if (strlen(names[type]) == (size_t)(end - arg) && strncmp(arg, names[type], end - arg) == 0) {
+            return (type);
+        }
+    }
+    return (-1);
+}
+
+// "TYPE:N" => the type, *value = N (and *extra = M for "TYPE:N/M" when extra is not null)
+static int parseTypeValue(const char *name, const char *arg, uint32_t *value, uint32_t *extra) {
+    const char *colon = strchr(arg, ':');
+    int type = colon ? parseLogType(arg, colon) : -1;
+    std::string numbers(colon ? colon + 1 : "");
+    size_t slash = numbers.find('/');
+
+    if (type < 0 || (slash != std::string::npos && extra == nullptr)) {
+        printf("invalid value for %s: '%s'\n", name, arg);
+        exit(EXIT_FAILURE);
+    }
+
+    *value = (uint32_t)parseSize(name, numbers.substr(0, slash).c_str());
+    if (slash != std::string::npos) {
+        *extra = (uint32_t)parseSize(name, numbers.substr(slash + 1).c_str());
+    }
+    return (type);
+}
+
+static void parseOptions(int argc, char **argv, Tintin_reporter::Options &logOptions, Matt_daemon::Options &daemonOptions) {
+    enum { OPT_ASYNC = 1, OPT_RING_SIZE, OPT_OVERFLOW, OPT_BATCH_SIZE, OPT_BATCH_LATENCY, OPT_DURABILITY, OPT_SYNC_INTERVAL, OPT_TIMESTAMP_PRECISION,
+        OPT_SINK, OPT_SEGMENT_SIZE, OPT_ROTATE_SIZE, OPT_ROTATE_INTERVAL, OPT_NO_COMPRESS,
+        OPT_LOG_FORMAT, OPT_LOG_LEVEL, OPT_RATE_LIMIT, OPT_SAMPLE, OPT_SUPPRESS_REPORT, OPT_COALESCE, OPT_RING_FILE,
+        OPT_MAX_CLIENTS, OPT_WORKERS, OPT_MAX_LINE, OPT_LONG_LINES, OPT_READ_SIZE, OPT_ENGINE,
+        OPT_BACKLOG, OPT_RETRY_AFTER, OPT_MEMORY_BUDGET, OPT_CPU_BUDGET, OPT_IDLE_TIMEOUT,
+        OPT_IPV6, OPT_UNIX, OPT_PING, OPT_WAIT_READY, OPT_STATS, OPT_LATENCY_REPORT, OPT_LATENCY_SAMPLE, OPT_LATENCY_COMMAND,
+        OPT_STALL_THRESHOLD, OPT_STALL_BACKTRACE };
+    static const struct option longOptions[] = {
+        {"async",           no_argument,        nullptr, OPT_ASYNC},
+        {"ring-size",       required_argument,  nullptr, OPT_RING_SIZE},
+        {"overflow",        required_argument,  nullptr, OPT_OVERFLOW},
+        {"batch-size",      required_argument,  nullptr, OPT_BATCH_SIZE},
+        {"batch-latency",   required_argument,  nullptr, OPT_BATCH_LATENCY},
+        {"durability",      required_argument,  nullptr, OPT_DURABILITY},
+        {"sync-interval",   required_argument,  nullptr, OPT_SYNC_INTERVAL},
+        {"timestamp-precision", required_argument, nullptr, OPT_TIMESTAMP_PRECISION},
+        {"sink",            required_argument,  nullptr, OPT_SINK},
+        {"segment-size",    required_argument,  nullptr, OPT_SEGMENT_SIZE},
+        {"rotate-size",     required_argument,  nullptr, OPT_ROTATE_SIZE},
+        {"rotate-interval", required_argument,  nullptr, OPT_ROTATE_INTERVAL},
+        {"no-compress",     no_argument,        nullptr, OPT_NO_COMPRESS},
+        {"log-format",      required_argument,  nullptr, OPT_LOG_FORMAT},
+        {"log-level",       required_argument,  nullptr, OPT_LOG_LEVEL},
+        {"rate-limit",      required_argument,  nullptr, OPT_RATE_LIMIT},
+        {"sample",          required_argument,  nullptr, OPT_SAMPLE},
+        {"suppress-report", required_argument,  nullptr, OPT_SUPPRESS_REPORT},
+        {"coalesce",        required_argument,  nullptr, OPT_COALESCE},
+        {"ring-file",       required_argument,  nullptr, OPT_RING_FILE},
+        {"max-clients",     required_argument,  nullptr, OPT_MAX_CLIENTS},
+        {"workers",         required_argument,  nullptr, OPT_WORKERS},
+        {"max-line",        required_argument,  nullptr, OPT_MAX_LINE},
+        {"long-lines",      required_argument,  nullptr, OPT_LONG_LINES},
+        {"read-size",       required_argument,  nullptr, OPT_READ_SIZE},
+        {"engine",          required_argument,  nullptr, OPT_ENGINE},
+        {"backlog",         required_argument,  nullptr, OPT_BACKLOG},
+        {"retry-after",     required_argument,  nullptr, OPT_RETRY_AFTER},
+        {"memory-budget",   required_argument,  nullptr, OPT_MEMORY_BUDGET},
+        {"cpu-budget",      required_argument,  nullptr, OPT_CPU_BUDGET},
+        {"idle-timeout",    required_argument,  nullptr, OPT_IDLE_TIMEOUT},
+        {"ipv6",            no_argument,        nullptr, OPT_IPV6},
+        {"unix",            required_argument,  nullptr, OPT_UNIX},
+        {"ping",            no_argument,        nullptr, OPT_PING},
+        {"wait-ready",      no_argument,        nullptr, OPT_WAIT_READY},
+        {"stats",           required_argument,  nullptr, OPT_STATS},
+        {"latency-report",  required_argument,  nullptr, OPT_LATENCY_REPORT},
+        {"latency-sample",  required_argument,  nullptr, OPT_LATENCY_SAMPLE},
+        {"latency-command", no_argument,        nullptr, OPT_LATENCY_COMMAND},
+        {"stall-threshold", required_argument,  nullptr, OPT_STALL_THRESHOLD},
+        {"stall-backtrace", no_argument,        nullptr, OPT_STALL_BACKTRACE},
+        {nullptr,           0,                  nullptr, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", longOptions, nullptr)) != -1) {
+        switch (opt) {
+            case OPT_ASYNC:
+                logOptions.async = true;
+                break;
+            case OPT_RING_SIZE:
+                logOptions.ringCapacity = parseSize("--ring-size", optarg);
+                if (logOptions.ringCapacity > Log_ring::MAX_CAPACITY) {
+                    printf("invalid value for --ring-size: '%s' (at most %zu)\n", optarg, Log_ring::MAX_CAPACITY);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPT_OVERFLOW:
+                if (strcmp(optarg, "block") == 0) {
+                    logOptions.overflowPolicy = Tintin_reporter::BLOCK;
+                } else if (strcmp(optarg, "drop") == 0) {
+                    logOptions.overflowPolicy = Tintin_reporter::DROP;
+                } else if (strcmp(optarg, "drop-oldest") == 0) {
+                    logOptions.overflowPolicy = Tintin_reporter::DROP_OLDEST;
+                } else {
+                    usage(argv[0]);
+                }
+                break;
+            case OPT_BATCH_SIZE:
+                logOptions.batchMaxRecords = parseSize("--batch-size", optarg);
+                break;
+            case OPT_BATCH_LATENCY:
+                logOptions.batchMaxLatencyMs = (long)parseSize("--batch-latency", optarg);
+                break;
+            case OPT_DURABILITY:
+                if (strcmp(optarg, "none") == 0) {
+                    logOptions.durability = Tintin_reporter::SYNC_NONE;
+                } else if (strcmp(optarg, "interval") == 0) {
+                    logOptions.durability = Tintin_reporter::SYNC_INTERVAL;
+                } else if (strcmp(optarg, "batch") == 0) {
+                    logOptions.durability = Tintin_reporter::SYNC_BATCH;
+                } else {
+                    usage(argv[0]);
+                }
+                break;
+            case OPT_SYNC_INTERVAL:
+                logOptions.syncIntervalMs = (long)parseSize("--sync-interval", optarg);
+                break;
+            case OPT_TIMESTAMP_PRECISION:
+                if (strcmp(optarg, "s") == 0) {
+                    logOptions.timestampPrecision = Timestamp_cache::SECONDS;
+                } else if (strcmp(optarg, "ms") == 0) {
+                    logOptions.timestampPrecision = Timestamp_cache::MILLISECONDS;
+                } else if (strcmp(optarg, "us") == 0) {
+                    logOptions.timestampPrecision = Timestamp_cache::MICROSECONDS;
+                } else {
+                    usage(argv[0]);
+                }
+                break;
+            case OPT_SINK:
+                if (strcmp(optarg, "write") == 0) {
+                    logOptions.sink = Tintin_reporter::SINK_WRITE;
+                } else if (strcmp(optarg, "mmap") == 0) {
+                    logOptions.sink = Tintin_reporter::SINK_MMAP;
+                } else if (strcmp(optarg, "uring") == 0) {
+                    logOptions.sink = Tintin_reporter::SINK_URING;
+                } else {
+                    usage(argv[0]);
+                }
+                break;
+            case OPT_SEGMENT_SIZE:
+                logOptions.segmentSize = parseSize("--segment-size", optarg);
+                break;
+            case OPT_ROTATE_SIZE:
+                logOptions.rotateSize = parseSize("--rotate-size", optarg);
+                break;
+            case OPT_ROTATE_INTERVAL:
+                logOptions.rotateIntervalSec = (long)parseSize("--rotate-interval", optarg);
+                break;
+            case OPT_NO_COMPRESS:
+                logOptions.compressRotated = false;
+                break;
+            case OPT_LOG_FORMAT:
+                if (strcmp(optarg, "text") == 0) {
+                    logOptions.format = Tintin_reporter::FORMAT_TEXT;
+                } else if (strcmp(optarg, "binary") == 0) {
+                    logOptions.format = Tintin_reporter::FORMAT_BINARY;
+                } else {
+                    usage(argv[0]);
+                }
+                break;
+            case OPT_LOG_LEVEL: {
+                int level = parseLogType(optarg, optarg + strlen(optarg));
+                if (level < 0) {
+                    usage(argv[0]);
+                }
+                for (int type = Tintin_reporter::LOG; type <= Tintin_reporter::ERROR; ++type) {
+                    logOptions.filters[type].enabled = (type >= level);
+                }
+                break;
+            }
+            case OPT_RATE_LIMIT: {
+                uint32_t rate = 0;
+                uint32_t burst = 0;
+                int type = parseTypeValue("--rate-limit", optarg, &rate, &burst);
+                logOptions.filters[type].ratePerSec = rate;
+                logOptions.filters[type].burst = burst;
+                break;
+            }
+            case OPT_SAMPLE: {
+                uint32_t every = 1;
+                int type = parseTypeValue("--sample", optarg, &every, nullptr);
+                logOptions.filters[type].sampleEvery = every;
+                break;
+            }
+            case OPT_SUPPRESS_REPORT:
+                logOptions.suppressReportSec = (strcmp(optarg, "0") == 0) ? 0 : (long)parseSize("--suppress-report", optarg);
+                break;
+            case OPT_MAX_CLIENTS:
+                daemonOptions.maxClients = parseSize("--max-clients", optarg);
+                break;
+            case OPT_WORKERS:
+                daemonOptions.workers = parseSize("--workers", optarg);
+                break;
+            case OPT_MAX_LINE:
+                daemonOptions.maxLineLength = parseSize("--max-line", optarg);
+                break;
+            case OPT_ENGINE:
+                if (strcmp(optarg, "epoll") == 0) {
+                    daemonOptions.engine = Matt_daemon::ENGINE_EPOLL;
+                } else if (strcmp(optarg, "uring") == 0) {
+                    daemonOptions.engine = Matt_daemon::ENGINE_URING;
+                } else {
+                    usage(argv[0]);
+                }
+                break;
+            case OPT_READ_SIZE:
+                daemonOptions.readSize = parseSize("--read-size", optarg);
+                break;
+            case OPT_BACKLOG:
+                daemonOptions.backlog = (int)std::min(parseSize("--backlog", optarg), (size_t)INT_MAX);
+                break;
+            case OPT_RETRY_AFTER:
+                daemonOptions.retryAfterMs = (long)parseSize("--retry-after", optarg);
+                break;
+            case OPT_MEMORY_BUDGET:
+                daemonOptions.memoryBudget = parseSize("--memory-budget", optarg);
+                break;
+            case OPT_CPU_BUDGET:
+                daemonOptions.cpuBudget = (unsigned)parseSize("--cpu-budget", optarg);
+                if (daemonOptions.cpuBudget > 100) {
+                    usage(argv[0]);
+                }
+                break;
+            case OPT_IDLE_TIMEOUT:
+                daemonOptions.idleTimeoutSec = (long)parseSize("--idle-timeout", optarg);
+                break;
+            case OPT_IPV6:
+                daemonOptions.ipv6 = true;
+                break;
+            case OPT_UNIX:
+                if (optarg[0] == '\0' || strcmp(optarg, "@") == 0) {
+                    usage(argv[0]);
+                }
+                daemonOptions.unixPath = optarg;
+                break;
+            case OPT_PING:
+                daemonOptions.answerPing = true;
+                break;
+            case OPT_WAIT_READY:
+                daemonOptions.waitReady = true;
+                break;
+            case OPT_STATS:
+                if (optarg[0] == '\0') {
+                    usage(argv[0]);
+                }
+                daemonOptions.statsPath = (strcmp(optarg, "none") == 0) ? "" : optarg;
+                break;
+            case OPT_LATENCY_REPORT:
+                daemonOptions.latencyReportSec = (strcmp(optarg, "0") == 0) ? 0 : (long)parseSize("--latency-report", optarg);
+                break;
+            case OPT_LATENCY_SAMPLE:
+                daemonOptions.latencySampleEvery = parseSize("--latency-sample", optarg);
+                break;
+            case OPT_LATENCY_COMMAND:
+                daemonOptions.answerLatency = true;
+                break;
+            case OPT_STALL_THRESHOLD:
+                daemonOptions.stallThresholdMs = (strcmp(optarg, "0") == 0) ? 0 : (long)parseSize("--stall-threshold", optarg);
+                break;
+            case OPT_STALL_BACKTRACE:
+                daemonOptions.stallBacktrace = true;
+                break;
+            case OPT_LONG_LINES:
+                if (strcmp(optarg, "truncate") == 0) {
+                    daemonOptions.longLines = Matt_daemon::TRUNCATE;
+                } else if (strcmp(optarg, "disconnect") == 0) {
+                    daemonOptions.longLines = Matt_daemon::DISCONNECT;
+                } else {
+                    usage(argv[0]);
+                }
+                break;
+            case OPT_RING_FILE:
+                logOptions.ringFile = (strcmp(optarg, "none") == 0) ? nullptr : optarg;
+                break;
+            case OPT_COALESCE:
+                logOptions.coalesceMs = (long)parseSize("--coalesce", optarg);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if (optind < argc) {
+        usage(argv[0]);
+    }
+
+    // io_uring batches are the async writer's: without it, every record would silently go through write()
+    if (logOptions.sink == Tintin_reporter::SINK_URING && !logOptions.async) {
+        printf("--sink=uring needs --async\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+int main(int argc, char **argv) {
     // (*) the user is must be root
     if (geteuid() != 0) {
         printf("only root can run this program!");
         exit(EXIT_FAILURE);
     }
 
+    // (*) parsing the command line (every option has a default, the daemon runs fine without any)
+    Tintin_reporter::Options logOptions;
+    Matt_daemon::Options daemonOptions;
+    parseOptions(argc, argv, logOptions, daemonOptions);
+
+    // (*) hot restart: resolved now, the daemon runs from / (a rebuilt binary at the same path is what the successor runs)
+    char executable[PATH_MAX];
+    ssize_t len = readlink("/proc/self/exe", executable, sizeof(executable) - 1);
+    if (len > 0) {
+        daemonOptions.executable.assign(executable, (size_t)len);
+    }
+    daemonOptions.arguments.assign(argv, argv + argc);
+
+    // (*) started by a hot restart: the predecessor's state comes before the logger (it still writes the log file)
+    Handoff::State inherited;
+    int handoffFd = Handoff::inheritedSocket();
+    if (handoffFd >= 0) {
+        Handoff::receive(handoffFd, &inherited);
+    }
+
     // (*) creating the logger instance
-    const Tintin_reporter &tintin_reporter = Tintin_reporter::getLoggerInstance("/var/log/matt_daemon/matt_daemon.log");
+    const Tintin_reporter &tintin_reporter = Tintin_reporter::getLoggerInstance("/var/log/matt_daemon/matt_daemon.log", logOptions);
 
-    Matt_daemon &matt_daemon = Matt_daemon::getMattDaemon(tintin_reporter);
+    Matt_daemon &matt_daemon = Matt_daemon::getMattDaemon(tintin_reporter, daemonOptions);
 
-    matt_daemon.start();
+    matt_daemon.start(handoffFd >= 0 ? &inherited : nullptr);
 }
@@ -0,0 +1,229 @@
+#include "Stats_page.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+// prints the counters of a running Matt_daemon from its stats page (--stats): the page is mapped read only, the
+// daemon never hears about it. once, or every SEC seconds as per second rates (the page is mapped again when a
+// hot restart or a new daemon replaced it)
+
+static constexpr const char *DEFAULT_PATH = "/run/matt_daemon.stats";
+static constexpr int SEQLOCK_RETRIES = 1000;
+
+struct Page {
+    const Stats_page::Header *header = nullptr;
+    const Stats_page::Slot *slots = nullptr;
+    size_t size = 0;
+    dev_t device = 0;
+    ino_t inode = 0;
+};
+
+struct Snapshot {
+    int64_t pid;
+    int64_t startedAt;
+    std::vector<std::string> names;
+    std::vector<uint64_t> values; // names.size() * COUNTERS
+};
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-i SEC] [-n COUNT] [PATH] (default %s)\n", name, DEFAULT_PATH);
+    exit(EXIT_FAILURE);
+}
+
+static bool mapPage(const char *path, Page *page) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "%s: %s (is the daemon running?)\n", path, strerror(errno));
+        return (false);
+    }
+
+    struct stat st;
+    void *mapping = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(Stats_page::Header)) {
+        mapping = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "%s: not a stats page\n", path);
+        return (false);
+    }
+
+    const Stats_page::Header *header = static_cast<const Stats_page::Header *>(mapping);
+    if (header->magic != Stats_page::MAGIC || header->version != Stats_page::VERSION || header->slotSize != sizeof(Stats_page::Slot)
+        || header->counterCount != Stats_page::COUNTERS || Stats_page::pageSize(header->slotCount) > (size_t)st.st_size) {
+        fprintf(stderr, "%s: not a stats page of this version\n", path);
+        munmap(mapping, (size_t)st.st_size);
+        return (false);
+    }
+
+    page->header = header;
+    page->slots = reinterpret_cast<const Stats_page::Slot *>(static_cast<const char *>(mapping) + sizeof(Stats_page::Header));
+    page->size = (size_t)st.st_size;
+    page->device = st.st_dev;
+    page->inode = st.st_ino;
+    return (true);
+}
+
+static void unmapPage(Page *page) {
+    munmap(const_cast<Stats_page::Header *>(page->header), page->size);
+    *page = Page();
+}
+
+// the path now names another file (hot restart, new daemon) or none
+static bool replaced(const char *path, const Page &page) {
+    struct stat st;
+    return (stat(path, &st) < 0 || st.st_dev != page.device || st.st_ino != page.inode);
+}
+
+static bool snapshot(const Page &page, Snapshot *out) {
+    const Stats_page::Header &header = *page.header;
+    uint32_t used = 0;
+    uint64_t words[64][Stats_page::NAME_WORDS];
+
+    // the slots in use and their names, consistent with each other (the counters are read one by one after)
+    bool consistent = false;
+    for (int attempt = 0; attempt < SEQLOCK_RETRIES && !consistent; ++attempt) {
+        uint32_t before = header.sequence.load(std::memory_order_acquire);
+        if (before & 1) {
+            continue;
+        }
+        used = std::min(header.slotsUsed.load(std::memory_order_relaxed), std::min(header.slotCount, 64u));
+        for (uint32_t slot = 0; slot < used; ++slot) {
+            for (size_t i = 0; i < Stats_page::NAME_WORDS; ++i) {
+                words[slot][i] = page.slots[slot].name[i].load(std::memory_order_relaxed);
+            }
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        consistent = (header.sequence.load(std::memory_order_relaxed) == before);
+    }
+    if (!consistent) {
+        return (false);
+    }
+
+    out->pid = header.pid;
+    out->startedAt = header.startedAt;
+    out->names.clear();
+    out->values.clear();
+    for (uint32_t slot = 0; slot < used; ++slot) {
+        char name[sizeof(words[slot]) + 1] = { 0 };
+        memcpy(name, words[slot], sizeof(words[slot]));
+        out->names.push_back(name);
+        for (size_t counter = 0; counter < Stats_page::COUNTERS; ++counter) {
+            out->values.push_back(page.slots[slot].values[counter].load(std::memory_order_relaxed));
+        }
+    }
+    return (true);
+}
+
+// values (or their rate since previous, over seconds) per thread and in total
+static void print(const Snapshot &now, const Snapshot *previous, double seconds) {
+    size_t columns = now.names.size();
+    long uptime = (long)(time(NULL) - now.startedAt);
+
+    printf("Matt_daemon PID %lld, up %ldh%02ldm%02lds%s\n", (long long)now.pid, uptime / 3600, uptime / 60 % 60, uptime % 60,
+        previous ? " (per second)" : "");
+    printf("%-14s", "");
+    for (const std::string &name : now.names) {
+        printf(" %12s", name.c_str());
+    }
+    printf(" %12s\n", "total");
+
+    for (size_t counter = 0; counter < Stats_page::COUNTERS; ++counter) {
+        double total = 0;
+        printf("%-14s", Stats_page::counterName((Stats_page::Counter)counter));
+        for (size_t slot = 0; slot < columns; ++slot) {
+            double value = (double)now.values[slot * Stats_page::COUNTERS + counter];
+            if (previous != nullptr) {
+                // a thread that registered during the interval starts from 0
+                size_t index = slot * Stats_page::COUNTERS + counter;
+                value -= (index < previous->values.size()) ? (double)previous->values[index] : 0;
+                value /= seconds;
+            }
+            total += value;
+            printf(" %12.0f", value);
+        }
+        printf(" %12.0f\n", total);
+    }
+
+    double batched = 0;
+    double queuedUs = 0;
+    for (size_t slot = 0; slot < columns; ++slot) {
+        batched += (double)now.values[slot * Stats_page::COUNTERS + Stats_page::LOG_BATCHED];
+        queuedUs += (double)now.values[slot * Stats_page::COUNTERS + Stats_page::LOG_QUEUE_US];
+        if (previous != nullptr && (slot + 1) * Stats_page::COUNTERS <= previous->values.size()) {
+            batched -= (double)previous->values[slot * Stats_page::COUNTERS + Stats_page::LOG_BATCHED];
+            queuedUs -= (double)previous->values[slot * Stats_page::COUNTERS + Stats_page::LOG_QUEUE_US];
+        }
+    }
+    if (batched > 0) {
+        printf("log queue: %.0f us on average from log() to written\n", queuedUs / batched);
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+    double interval = 0;
+    long count = -1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "i:n:")) != -1) {
+        if (opt == 'i') {
+            interval = atof(optarg);
+        } else if (opt == 'n') {
+            count = atol(optarg);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (argc - optind > 1 || (interval <= 0 && count > 0)) {
+        usage(argv[0]);
+    }
+    const char *path = (optind < argc) ? argv[optind] : DEFAULT_PATH;
+
+    Page page;
+    Snapshot current;
+    if (!mapPage(path, &page) || !snapshot(page, &current)) {
+        return (EXIT_FAILURE);
+    }
+    if (interval <= 0) {
+        print(current, nullptr, 0);
+        return (EXIT_SUCCESS);
+    }
+
+    Snapshot previous;
+    struct timespec last;
+    clock_gettime(CLOCK_MONOTONIC, &last);
+    for (long n = 0; count < 0 || n < count; ++n) {
+        usleep((useconds_t)(interval * 1e6));
+
+        previous = current;
+        if (replaced(path, page)) {
+            unmapPage(&page);
+            if (!mapPage(path, &page)) {
+                return (EXIT_FAILURE);
+            }
+            previous.values.clear(); // a new page starts from 0
+        }
+        if (!snapshot(page, &current)) {
+            return (EXIT_FAILURE);
+        }
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        double seconds = (double)(now.tv_sec - last.tv_sec) + (double)(now.tv_nsec - last.tv_nsec) / 1e9;
+        last = now;
+
+        printf("\n");
+        print(current, &previous, seconds);
+    }
+    return (EXIT_SUCCESS);
+}
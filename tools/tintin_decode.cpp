@@ -0,0 +1,139 @@
+#include "Log_record.hpp"
+#include "Timestamp_cache.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+// renders a binary Matt_daemon log (--log-format=binary) as the text the daemon would have written
+// text lines (a log that was switched between formats) are copied as they are
+
+static constexpr size_t BUFFER_SIZE = 1 << 20;
+static constexpr size_t LINE_MAX_LEN = 4096; // Tintin_reporter::LOG_MAX_LEN
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-p s|ms|us] [file ...] (reads stdin without file)\n", name);
+    exit(EXIT_FAILURE);
+}
+
+// decodes every complete record of data, returns how many bytes it consumed
+static size_t decode(const char *data, size_t size, bool eof, Timestamp_cache &timestamps, Timestamp_cache::Precision precision, unsigned long long &corrupted) {
+    char line[LINE_MAX_LEN];
+    char timestamp[Timestamp_cache::MAX_LEN];
+    size_t pos = 0;
+
+    while (pos < size) {
+        if ((unsigned char)data[pos] == Log_binary_header::MAGIC) {
+            Log_binary_header header;
+            if (size - pos < sizeof(header)) {
+                break; // incomplete header
+            }
+            memcpy(&header, data + pos, sizeof(header));
+
+            size_t recordLen = sizeof(header) + header.len + 1;
+            if (size - pos < recordLen) {
+                if (!eof) {
+                    break; // incomplete payload
+                }
+            } else if (data[pos + recordLen - 1] == '\n') {
+                struct timespec ts;
+                ts.tv_sec = (time_t)header.sec;
+                ts.tv_nsec = (long)header.nsec;
+
+                size_t timestampLen = timestamps.format(timestamp, ts, precision);
+                size_t len = Log_record::formatText(line, sizeof(line), timestamp, timestampLen, header.type, data + pos + sizeof(header), header.len);
+                fwrite(line, 1, len, stdout);
+                pos += recordLen;
+                continue;
+            }
+            // not a record after all: skip this byte and resynchronize
+            corrupted += 1;
+            pos += 1;
+            continue;
+        }
+
+        // a text line
+        const char *newline = static_cast<const char *>(memchr(data + pos, '\n', size - pos));
+        if (newline == nullptr && !eof) {
+            break;
+        }
+        size_t len = (newline == nullptr) ? size - pos : (size_t)(newline - (data + pos)) + 1;
+        fwrite(data + pos, 1, len, stdout);
+        pos += len;
+    }
+
+    return (pos);
+}
+
+static bool decodeFd(int fd, char *buffer, Timestamp_cache &timestamps, Timestamp_cache::Precision precision, unsigned long long &corrupted) {
+    size_t filled = 0;
+
+    while (true) {
+        ssize_t got = read(fd, buffer + filled, BUFFER_SIZE - filled);
+        if (got < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return (false);
+        }
+
+        filled += got;
+        size_t used = decode(buffer, filled, got == 0, timestamps, precision, corrupted);
+        memmove(buffer, buffer + used, filled - used);
+        filled -= used;
+
+        if (got == 0) {
+            return (true);
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    Timestamp_cache::Precision precision = Timestamp_cache::SECONDS;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:")) != -1) {
+        if (opt != 'p') {
+            usage(argv[0]);
+        }
+        if (strcmp(optarg, "s") == 0) {
+            precision = Timestamp_cache::SECONDS;
+        } else if (strcmp(optarg, "ms") == 0) {
+            precision = Timestamp_cache::MILLISECONDS;
+        } else if (strcmp(optarg, "us") == 0) {
+            precision = Timestamp_cache::MICROSECONDS;
+        } else {
+            usage(argv[0]);
+        }
+    }
+
+    static char buffer[BUFFER_SIZE];
+    Timestamp_cache timestamps;
+    unsigned long long corrupted = 0;
+    int status = EXIT_SUCCESS;
+
+    if (optind == argc) {
+        if (!decodeFd(STDIN_FILENO, buffer, timestamps, precision, corrupted)) {
+            perror("stdin");
+            status = EXIT_FAILURE;
+        }
+    }
+    for (int i = optind; i < argc; ++i) {
+        int fd = open(argv[i], O_RDONLY);
+        if (fd < 0 || !decodeFd(fd, buffer, timestamps, precision, corrupted)) {
+            perror(argv[i]);
+            status = EXIT_FAILURE;
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    fflush(stdout);
+    if (corrupted > 0) {
+        fprintf(stderr, "%s: skipped %llu corrupted bytes\n", argv[0], corrupted);
+    }
+    return (status);
+}